@@ -0,0 +1,71 @@
+#ifndef __AABB_H__
+#define __AABB_H__
+
+#pragma once
+#include "vec3.h"
+#include "ray.h"
+#include <cfloat>
+#include <algorithm>
+
+// Axis aligned bounding box. A default constructed box is empty and can be grown with expand().
+class AABB
+{
+public:
+    AABB() : pMin(FLT_MAX), pMax(-FLT_MAX) {}
+    AABB(const Vec3& p) : pMin(p), pMax(p) {}
+    AABB(const Vec3& a, const Vec3& b)
+        : pMin(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()))
+        , pMax(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z())) {}
+
+    void expand(const Vec3& p) {
+        pMin = Vec3(std::min(pMin.x(), p.x()), std::min(pMin.y(), p.y()), std::min(pMin.z(), p.z()));
+        pMax = Vec3(std::max(pMax.x(), p.x()), std::max(pMax.y(), p.y()), std::max(pMax.z(), p.z()));
+    }
+    void expand(const AABB& b) { expand(b.pMin); expand(b.pMax); }
+
+    bool empty() const { return pMin.x() > pMax.x() || pMin.y() > pMax.y() || pMin.z() > pMax.z(); }
+    Vec3 centroid() const { return 0.5f * (pMin + pMax); }
+    Vec3 extent() const { return pMax - pMin; }
+    float surfaceArea() const {
+        if (empty()) return 0.f;
+        Vec3 d = extent();
+        return 2.f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+    int maxExtent() const {
+        Vec3 d = extent();
+        if (d.x() > d.y() && d.x() > d.z()) return 0;
+        return d.y() > d.z() ? 1 : 2;
+    }
+    // relative position of p inside the box along each axis, 0 at pMin and 1 at pMax
+    Vec3 offset(const Vec3& p) const {
+        Vec3 o = p - pMin;
+        Vec3 d = extent();
+        return Vec3(d.x() > 0.f ? o.x() / d.x() : 0.f,
+                    d.y() > 0.f ? o.y() / d.y() : 0.f,
+                    d.z() > 0.f ? o.z() / d.z() : 0.f);
+    }
+
+    // Slab test against a ray with precomputed reciprocal direction. dirIsNeg selects the
+    // near and far planes per axis so no min/max swaps are needed.
+    bool intersect(const Ray& ray, const Vec3& invDir, const int dirIsNeg[3], float minT, float maxT) const {
+        const Vec3* bounds[2] = { &pMin, &pMax };
+        float t0 = (bounds[dirIsNeg[0]]->x() - ray.o.x()) * invDir.x();
+        float t1 = (bounds[1 - dirIsNeg[0]]->x() - ray.o.x()) * invDir.x();
+        float ty0 = (bounds[dirIsNeg[1]]->y() - ray.o.y()) * invDir.y();
+        float ty1 = (bounds[1 - dirIsNeg[1]]->y() - ray.o.y()) * invDir.y();
+        if (t0 > ty1 || ty0 > t1) return false;
+        if (ty0 > t0) t0 = ty0;
+        if (ty1 < t1) t1 = ty1;
+        float tz0 = (bounds[dirIsNeg[2]]->z() - ray.o.z()) * invDir.z();
+        float tz1 = (bounds[1 - dirIsNeg[2]]->z() - ray.o.z()) * invDir.z();
+        if (t0 > tz1 || tz0 > t1) return false;
+        if (tz0 > t0) t0 = tz0;
+        if (tz1 < t1) t1 = tz1;
+        return t0 <= maxT && t1 >= minT;
+    }
+
+    Vec3 pMin;
+    Vec3 pMax;
+};
+
+#endif
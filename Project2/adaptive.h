@@ -0,0 +1,147 @@
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#pragma once
+#include "camera.h"
+#include "shape.h"
+#include "integrator.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Running statistics of one pixel. The luminance mean and variance are tracked with
+// Welford's update, the colour is a plain sum.
+struct PixelStats
+{
+    PixelStats() : sum(0.f), mean(0.f), m2(0.f), n(0), converged(false) {}
+
+    void add(const Vec3& L) {
+        sum += L;
+        float y = 0.2126f * L.x() + 0.7152f * L.y() + 0.0722f * L.z();
+        n++;
+        float delta = y - mean;
+        mean += delta / n;
+        m2 += delta * (y - mean);
+    }
+
+    // Standard error of the mean luminance after gamma 2 correction, i.e. in the units of
+    // the displayed image where 1 is full white. d sqrt(Y) = dY / (2 sqrt(Y)).
+    float error() const {
+        if (n < 2) return FLT_MAX;
+        float variance = m2 / (n - 1);
+        return std::sqrt(variance / n) / (2.f * std::sqrt(std::max(mean, 1e-4f)));
+    }
+
+    Vec3 sum;
+    float mean;
+    float m2;
+    int n;
+    bool converged;
+};
+
+// Progressive renderer that spends its samples where the image is still noisy. The budget
+// is the same as for the TileRenderer, ns samples per pixel on average. Every pixel first
+// gets minSpp samples; after that the renderer works in passes of minSpp samples and only
+// visits pixels whose error is above the noise threshold and that are below maxSpp. When
+// the remaining budget cannot cover a full pass it goes to the noisiest pixels first.
+// Rendering stops when the budget is spent or every pixel has converged.
+// Sample n of a pixel is always sampler sample n, so the image does not depend on the
+// number of threads. Traits selects the specialized kernel, see KernelTraits.
+class AdaptiveRenderer
+{
+public:
+    AdaptiveRenderer(int nx, int ny, int ns, float noise = 0.01f, int minSpp = 16, int maxSpp = 0)
+        : mWidth(nx), mHeight(ny), mSamples(ns), mNoise(noise)
+        , mMinSpp(std::max(std::min(minSpp, ns), 1)), mMaxSpp(maxSpp > 0 ? maxSpp : 8 * ns)
+        , mTotalSamples(0), mConvergedPixels(0) {
+        mMaxSpp = std::max(mMaxSpp, mMinSpp);
+    }
+
+    template <typename Traits = GenericKernel>
+    void render(const Camera& camera, const Shape& world, const PathIntegrator& integrator, const Sampler& sampler,
+                ThreadPool& pool, Framebuffer& framebuffer) {
+        const int nPixels = mWidth * mHeight;
+        std::vector<PixelStats> stats(nPixels);
+        std::vector<std::unique_ptr<Sampler>> samplers(pool.size());
+        for (auto& s : samplers) s = sampler.clone();
+
+        int64_t budget = (int64_t)nPixels * mSamples;
+        std::vector<int> active(nPixels);
+        for (int p = 0; p < nPixels; p++) active[p] = p;
+
+        while (!active.empty() && budget > 0) {
+            // not enough budget left for everybody, the noisiest pixels go first
+            int64_t passCost = (int64_t)active.size() * mMinSpp;
+            if (passCost > budget) {
+                size_t keep = std::max<size_t>((size_t)(budget / mMinSpp), 1);
+                std::nth_element(active.begin(), active.begin() + (keep - 1), active.end(), [&](int a, int b) {
+                    float ea = stats[a].error(), eb = stats[b].error();
+                    return ea > eb || (ea == eb && a < b);
+                });
+                active.resize(keep);
+                std::sort(active.begin(), active.end());
+            }
+            for (int p : active) budget -= std::min(mMinSpp, mMaxSpp - stats[p].n);
+
+            // one pass over the active pixels in chunks of consecutive pixels
+            const int chunkSize = 256;
+            int nChunks = ((int)active.size() + chunkSize - 1) / chunkSize;
+            pool.parallelFor(nChunks, [&](int chunk, int threadId) {
+                int end = std::min((int)active.size(), (chunk + 1) * chunkSize);
+                for (int k = chunk * chunkSize; k < end; k++) {
+                    int p = active[k];
+                    int i = p % mWidth, j = p / mWidth;
+                    PixelStats& s = stats[p];
+                    Sampler& pixelSampler = *samplers[threadId];
+                    int n = std::min(mMinSpp, mMaxSpp - s.n);
+                    for (int sample = 0; sample < n; sample++) {
+                        pixelSampler.startPixelSample(i, j, s.n);
+                        Point2f sp = pixelSampler.get2D();
+                        float u = (float(i + sp.x) / float(mWidth));
+                        float v = (float(j + sp.y) / float(mHeight));
+                        Ray r = camera.generateRay(u, v, pixelSampler, typename Traits::Lens());
+                        s.add(integrator.Li<Traits>(r, world, pixelSampler));
+                    }
+                    s.converged = s.error() <= mNoise;
+                }
+            });
+
+            int remaining = 0;
+            for (int p : active) {
+                if (!stats[p].converged && stats[p].n < mMaxSpp) active[remaining++] = p;
+            }
+            active.resize(remaining);
+        }
+
+        mTotalSamples = 0;
+        mConvergedPixels = 0;
+        for (int p = 0; p < nPixels; p++) {
+            const PixelStats& s = stats[p];
+            framebuffer.pixels[p] = s.n > 0 ? s.sum / float(s.n) : Vec3(0.f);
+            mTotalSamples += s.n;
+            mConvergedPixels += s.converged;
+        }
+    }
+
+    // statistics of the last render
+    int64_t totalSamples() const { return mTotalSamples; }
+    int convergedPixels() const { return mConvergedPixels; }
+
+private:
+    int mWidth;
+    int mHeight;
+    int mSamples;
+    float mNoise;
+    int mMinSpp;
+    int mMaxSpp;
+    int64_t mTotalSamples;
+    int mConvergedPixels;
+};
+
+#endif
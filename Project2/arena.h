@@ -0,0 +1,82 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for objects that live as long as the arena. Objects are placed one after
+// the other in large blocks, so objects created in sequence are adjacent in memory, and
+// everything is released at once when the arena goes away. Destructors run in reverse
+// order of creation, only for types that have a non-trivial one.
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 64 * 1024)
+        : mBlockSize(blockSize), mCurrent(nullptr), mRemaining(0), mBytesUsed(0) {}
+    ~Arena() { clear(); }
+    Arena(const Arena&) = delete;
+    Arena& operator= (const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t padding = (alignment - (uintptr_t)mCurrent % alignment) % alignment;
+        if (mCurrent == nullptr || padding + size > mRemaining) {
+            // operator new only guarantees the alignment of max_align_t, leave room to align
+            size_t blockSize = std::max(mBlockSize, size + alignment);
+            mBlocks.push_back(std::unique_ptr<unsigned char[]>(new unsigned char[blockSize]));
+            mCurrent = mBlocks.back().get();
+            mRemaining = blockSize;
+            padding = (alignment - (uintptr_t)mCurrent % alignment) % alignment;
+        }
+        void* p = mCurrent + padding;
+        mCurrent += padding + size;
+        mRemaining -= padding + size;
+        mBytesUsed += size;
+        return p;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) mDestructors.push_back(Destructor{ object, &destroy<T> });
+        return object;
+    }
+
+    void clear() {
+        for (auto it = mDestructors.rbegin(); it != mDestructors.rend(); ++it) it->destroy(it->object);
+        mDestructors.clear();
+        mBlocks.clear();
+        mCurrent = nullptr;
+        mRemaining = 0;
+        mBytesUsed = 0;
+    }
+
+    // bytes handed out, without alignment padding and unused block tails
+    size_t bytesUsed() const { return mBytesUsed; }
+    size_t numBlocks() const { return mBlocks.size(); }
+
+private:
+    struct Destructor
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    template <typename T>
+    static void destroy(void* object) { static_cast<T*>(object)->~T(); }
+
+    size_t mBlockSize;
+    unsigned char* mCurrent;
+    size_t mRemaining;
+    size_t mBytesUsed;
+    std::vector<std::unique_ptr<unsigned char[]>> mBlocks;
+    std::vector<Destructor> mDestructors;
+};
+
+#endif
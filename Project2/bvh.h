@@ -0,0 +1,382 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#pragma once
+#include "shape.h"
+#include "mesh.h"
+#include "aabb.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Node of the flattened hierarchy, stored depth first so the first child of an interior
+// node always directly follows its parent. With the scalar Vec3 a node is 32 bytes and two
+// share a cache line, the SSE Vec3 pads the bounds to 48. The node is not over-aligned:
+// std::vector only guarantees the alignment of max_align_t before C++17.
+struct LinearBVHNode
+{
+    AABB bounds;
+    union {
+        int primitivesOffset;   // leaf
+        int secondChildOffset;  // interior
+    };
+    uint16_t nPrimitives;       // 0 for interior nodes
+    uint8_t axis;               // split axis of interior nodes
+    uint8_t pad;
+};
+#if defined(RT_VEC3_SSE)
+static_assert(sizeof(LinearBVHNode) == 48, "LinearBVHNode should be three 16 byte blocks");
+#else
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be half a cache line");
+#endif
+
+// Bounding volume hierarchy over the objects of a ShapeList, built with the binned
+// surface area heuristic. Traversal visits the child nearer to the ray origin first so
+// the closest hit found so far can cull the far child. The type of every primitive is
+// stored next to it and leaves call spheres, quads and triangles without virtual dispatch.
+class BVH : public Shape
+{
+public:
+    // parameters of the builder, which the scene cache key includes. Bump BuildVersion when
+    // the builder changes the trees it makes in any other way.
+    static const int DefaultMaxPrimsInNode = 4;
+    static const int SAHBuckets = 16;
+    static constexpr float SAHTraversalCost = 0.125f;
+    static const int BuildVersion = 2;
+    // entries of the traversal stack, one per interior node above the current one
+    static const int TraversalStackSize = 64;
+
+    BVH(const ShapeList& list, int maxPrimsInNode = DefaultMaxPrimsInNode)
+        : mMaxPrimsInNode(std::min(maxPrimsInNode, 255)) {
+        std::vector<BuildPrimitive> buildPrims;
+        buildPrims.reserve(list.mObjects.size());
+        for (auto& o : list.mObjects) {
+            if (o == nullptr) continue;
+            BuildPrimitive p;
+            p.bounds = o->bounds();
+            p.centroid = p.bounds.centroid();
+            p.index = (int)mPrimitives.size();
+            buildPrims.push_back(p);
+            mPrimitives.push_back(o);
+        }
+        if (buildPrims.empty()) return;
+
+        mNodes.reserve(2 * buildPrims.size());
+        std::vector<const Shape*> orderedPrims;
+        orderedPrims.reserve(mPrimitives.size());
+        build(buildPrims, 0, (int)buildPrims.size(), 0, orderedPrims);
+        mPrimitives.swap(orderedPrims);
+        mPrimitiveTypes.reserve(mPrimitives.size());
+        for (const Shape* p : mPrimitives) mPrimitiveTypes.push_back((uint8_t)p->type());
+    }
+
+    bool hit(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        if (mNodes.empty()) return false;
+        Vec3 invDir(1.f / ray.d.x(), 1.f / ray.d.y(), 1.f / ray.d.z());
+        int dirIsNeg[3] = { invDir.x() < 0.f, invDir.y() < 0.f, invDir.z() < 0.f };
+        float closest = maxT;
+        bool hitAnything = false;
+        int toVisit[TraversalStackSize];
+        int toVisitOffset = 0;
+        int current = 0;
+        for (;;) {
+            const LinearBVHNode& node = mNodes[current];
+            RT_STATS_ADD(nodeTests, 1);
+            if (node.bounds.intersect(ray, invDir, dirIsNeg, minT, closest)) {
+                if (node.nPrimitives > 0) {
+                    RT_STATS_ADD(primitiveTests, node.nPrimitives);
+                    for (int i = 0; i < node.nPrimitives; i++) {
+                        if (hitPrimitive(node.primitivesOffset + i, ray, minT, closest, record)) {
+                            closest = record.t;
+                            hitAnything = true;
+                        }
+                    }
+                    if (toVisitOffset == 0) break;
+                    current = toVisit[--toVisitOffset];
+                } else {
+                    // descend into the near child, remember the far one
+                    if (dirIsNeg[node.axis]) {
+                        toVisit[toVisitOffset++] = current + 1;
+                        current = node.secondChildOffset;
+                    } else {
+                        toVisit[toVisitOffset++] = node.secondChildOffset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return hitAnything;
+    }
+
+    // Any hit traversal for shadow rays. Returns at the first primitive that blocks the ray,
+    // the interval is never shortened so the visiting order only matters for how soon
+    // that happens.
+    bool occluded(const Ray& ray, const float minT, const float maxT) const {
+        if (mNodes.empty()) return false;
+        Vec3 invDir(1.f / ray.d.x(), 1.f / ray.d.y(), 1.f / ray.d.z());
+        int dirIsNeg[3] = { invDir.x() < 0.f, invDir.y() < 0.f, invDir.z() < 0.f };
+        int toVisit[TraversalStackSize];
+        int toVisitOffset = 0;
+        int current = 0;
+        for (;;) {
+            const LinearBVHNode& node = mNodes[current];
+            RT_STATS_ADD(nodeTests, 1);
+            if (node.bounds.intersect(ray, invDir, dirIsNeg, minT, maxT)) {
+                if (node.nPrimitives > 0) {
+                    RT_STATS_ADD(primitiveTests, node.nPrimitives);
+                    for (int i = 0; i < node.nPrimitives; i++)
+                        if (occludedPrimitive(node.primitivesOffset + i, ray, minT, maxT)) return true;
+                    if (toVisitOffset == 0) break;
+                    current = toVisit[--toVisitOffset];
+                } else {
+                    if (dirIsNeg[node.axis]) {
+                        toVisit[toVisitOffset++] = current + 1;
+                        current = node.secondChildOffset;
+                    } else {
+                        toVisit[toVisitOffset++] = node.secondChildOffset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return false;
+    }
+
+    // Packet traversal visits a node when any active lane hits its box. The visiting order
+    // follows the direction signs of the first active lane, which for coherent packets
+    // matches the order of all the others.
+    vmask hit(const RayPacket& packet, const float minT, const vmask& active, PacketHitRecord& records) const {
+        vmask hitAnything(false);
+        int activeBits = active.bits();
+        if (mNodes.empty() || activeBits == 0) return hitAnything;
+        int lead = 0;
+        while (!((activeBits >> lead) & 1)) lead++;
+        int dirIsNeg[3] = { packet.dx[lead] < 0.f, packet.dy[lead] < 0.f, packet.dz[lead] < 0.f };
+
+        vfloat ox = vfloat::load(packet.ox), oy = vfloat::load(packet.oy), oz = vfloat::load(packet.oz);
+        vfloat invDx = 1.f / vfloat::load(packet.dx);
+        vfloat invDy = 1.f / vfloat::load(packet.dy);
+        vfloat invDz = 1.f / vfloat::load(packet.dz);
+        vfloat lowT(minT);
+
+        int toVisit[TraversalStackSize];
+        int toVisitOffset = 0;
+        int current = 0;
+        for (;;) {
+            const LinearBVHNode& node = mNodes[current];
+            RT_STATS_ADD(nodeTests, 1);
+            vfloat tx0 = (vfloat(node.bounds.pMin.x()) - ox) * invDx;
+            vfloat tx1 = (vfloat(node.bounds.pMax.x()) - ox) * invDx;
+            vfloat ty0 = (vfloat(node.bounds.pMin.y()) - oy) * invDy;
+            vfloat ty1 = (vfloat(node.bounds.pMax.y()) - oy) * invDy;
+            vfloat tz0 = (vfloat(node.bounds.pMin.z()) - oz) * invDz;
+            vfloat tz1 = (vfloat(node.bounds.pMax.z()) - oz) * invDz;
+            vfloat tNear = vmax(vmax(vmin(tx0, tx1), vmin(ty0, ty1)), vmax(vmin(tz0, tz1), lowT));
+            vfloat tFar = vmin(vmin(vmax(tx0, tx1), vmax(ty0, ty1)), vmin(vmax(tz0, tz1), vfloat::load(records.t)));
+            vmask hitBox = active & (tNear <= tFar);
+            if (hitBox.any()) {
+                if (node.nPrimitives > 0) {
+                    RT_STATS_ADD(primitiveTests, node.nPrimitives);
+                    for (int i = 0; i < node.nPrimitives; i++)
+                        hitAnything = hitAnything | hitPrimitive(node.primitivesOffset + i, packet, minT, hitBox, records);
+                    if (toVisitOffset == 0) break;
+                    current = toVisit[--toVisitOffset];
+                } else {
+                    if (dirIsNeg[node.axis]) {
+                        toVisit[toVisitOffset++] = current + 1;
+                        current = node.secondChildOffset;
+                    } else {
+                        toVisit[toVisitOffset++] = node.secondChildOffset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return hitAnything;
+    }
+
+    AABB bounds() const { return mNodes.empty() ? AABB() : mNodes[0].bounds; }
+
+    int numNodes() const { return (int)mNodes.size(); }
+
+    // the flattened nodes and the primitives in the order the leaves refer to them
+    const std::vector<LinearBVHNode>& nodes() const { return mNodes; }
+    const std::vector<const Shape*>& primitives() const { return mPrimitives; }
+
+private:
+    struct BuildPrimitive
+    {
+        AABB bounds;
+        Vec3 centroid;
+        int index;
+    };
+
+    struct Bucket
+    {
+        Bucket() : count(0) {}
+        int count;
+        AABB bounds;
+    };
+
+    // qualified calls, resolved at compile time for the known shape classes
+    bool hitPrimitive(int index, const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        const Shape* p = mPrimitives[index];
+        switch (mPrimitiveTypes[index]) {
+        case ShapeSphere: return static_cast<const Sphere*>(p)->Sphere::hit(ray, minT, maxT, record);
+        case ShapeQuad: return static_cast<const Quad*>(p)->Quad::hit(ray, minT, maxT, record);
+        case ShapeTriangle: return static_cast<const Triangle*>(p)->Triangle::hit(ray, minT, maxT, record);
+        default: return p->hit(ray, minT, maxT, record);
+        }
+    }
+
+    bool occludedPrimitive(int index, const Ray& ray, const float minT, const float maxT) const {
+        const Shape* p = mPrimitives[index];
+        switch (mPrimitiveTypes[index]) {
+        case ShapeSphere: return static_cast<const Sphere*>(p)->Sphere::occluded(ray, minT, maxT);
+        case ShapeQuad: return static_cast<const Quad*>(p)->Quad::occluded(ray, minT, maxT);
+        case ShapeTriangle: return static_cast<const Triangle*>(p)->Triangle::occluded(ray, minT, maxT);
+        default: return p->occluded(ray, minT, maxT);
+        }
+    }
+
+    // only spheres have a vectorized test, the others loop over the lanes anyway
+    vmask hitPrimitive(int index, const RayPacket& packet, const float minT, const vmask& active,
+                       PacketHitRecord& records) const {
+        const Shape* p = mPrimitives[index];
+        if (mPrimitiveTypes[index] == ShapeSphere)
+            return static_cast<const Sphere*>(p)->Sphere::hit(packet, minT, active, records);
+        return p->hit(packet, minT, active, records);
+    }
+
+    // Builds the subtree over buildPrims[start, end), whose root is depth nodes below the
+    // root of the tree, and returns the index of its root node
+    int build(std::vector<BuildPrimitive>& buildPrims, int start, int end, int depth,
+              std::vector<const Shape*>& orderedPrims) {
+        int nodeIndex = (int)mNodes.size();
+        mNodes.push_back(LinearBVHNode());
+
+        AABB bounds, centroidBounds;
+        for (int i = start; i < end; i++) {
+            bounds.expand(buildPrims[i].bounds);
+            centroidBounds.expand(buildPrims[i].centroid);
+        }
+        mNodes[nodeIndex].bounds = bounds;
+
+        int nPrims = end - start;
+        int axis = centroidBounds.maxExtent();
+        float axisExtent = centroidBounds.extent()[axis];
+        if (nPrims == 1 || axisExtent <= 0.f) {
+            // all centroids coincide, splitting would not separate anything
+            if (nPrims <= 255) return makeLeaf(nodeIndex, buildPrims, start, end, orderedPrims);
+            int mid = (start + end) / 2;
+            return makeInterior(nodeIndex, axis, buildPrims, start, mid, end, depth, orderedPrims);
+        }
+
+        // Below half the stack size the subtree is finished with median splits, which reach
+        // leaves of at most 255 primitives within 24 levels for any primitive count. Without
+        // the limit, primitives of geometrically growing size nest the SAH splits as deep as
+        // there are primitives and the traversal stack overflows.
+        int mid;
+        if (depth >= TraversalStackSize / 2) {
+            if (nPrims <= 255) return makeLeaf(nodeIndex, buildPrims, start, end, orderedPrims);
+            mid = (start + end) / 2;
+            std::nth_element(&buildPrims[start], &buildPrims[mid], &buildPrims[end - 1] + 1,
+                [axis](const BuildPrimitive& a, const BuildPrimitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+        } else if (nPrims <= 2) {
+            mid = (start + end) / 2;
+            std::nth_element(&buildPrims[start], &buildPrims[mid], &buildPrims[end - 1] + 1,
+                [axis](const BuildPrimitive& a, const BuildPrimitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+        } else {
+            const int nBuckets = SAHBuckets;
+            Bucket buckets[nBuckets];
+            for (int i = start; i < end; i++) {
+                int b = bucketIndex(centroidBounds, buildPrims[i].centroid, axis, nBuckets);
+                buckets[b].count++;
+                buckets[b].bounds.expand(buildPrims[i].bounds);
+            }
+
+            // sweep from both sides to get the SAH cost of splitting after every bucket
+            float cost[nBuckets - 1];
+            AABB below;
+            int countBelow = 0;
+            for (int i = 0; i < nBuckets - 1; i++) {
+                below.expand(buckets[i].bounds);
+                countBelow += buckets[i].count;
+                cost[i] = countBelow * below.surfaceArea();
+            }
+            AABB above;
+            int countAbove = 0;
+            for (int i = nBuckets - 1; i >= 1; i--) {
+                above.expand(buckets[i].bounds);
+                countAbove += buckets[i].count;
+                cost[i - 1] += countAbove * above.surfaceArea();
+            }
+
+            int minBucket = 0;
+            float minCost = cost[0];
+            for (int i = 1; i < nBuckets - 1; i++) {
+                if (cost[i] < minCost) {
+                    minCost = cost[i];
+                    minBucket = i;
+                }
+            }
+
+            // relative cost of traversing a node vs intersecting a primitive
+            float leafCost = (float)nPrims;
+            minCost = SAHTraversalCost + minCost / bounds.surfaceArea();
+            if (nPrims <= mMaxPrimsInNode && leafCost <= minCost)
+                return makeLeaf(nodeIndex, buildPrims, start, end, orderedPrims);
+
+            BuildPrimitive* pmid = std::partition(&buildPrims[start], &buildPrims[end - 1] + 1,
+                [&](const BuildPrimitive& p) { return bucketIndex(centroidBounds, p.centroid, axis, nBuckets) <= minBucket; });
+            mid = (int)(pmid - &buildPrims[0]);
+            if (mid == start || mid == end) mid = (start + end) / 2;
+        }
+        return makeInterior(nodeIndex, axis, buildPrims, start, mid, end, depth, orderedPrims);
+    }
+
+    int makeLeaf(int nodeIndex, const std::vector<BuildPrimitive>& buildPrims, int start, int end,
+                 std::vector<const Shape*>& orderedPrims) {
+        LinearBVHNode& node = mNodes[nodeIndex];
+        node.primitivesOffset = (int)orderedPrims.size();
+        node.nPrimitives = (uint16_t)(end - start);
+        node.axis = 0;
+        for (int i = start; i < end; i++)
+            orderedPrims.push_back(mPrimitives[buildPrims[i].index]);
+        return nodeIndex;
+    }
+
+    int makeInterior(int nodeIndex, int axis, std::vector<BuildPrimitive>& buildPrims, int start, int mid, int end,
+                     int depth, std::vector<const Shape*>& orderedPrims) {
+        build(buildPrims, start, mid, depth + 1, orderedPrims);
+        int secondChild = build(buildPrims, mid, end, depth + 1, orderedPrims);
+        // mNodes may have been reallocated by the recursive calls
+        LinearBVHNode& node = mNodes[nodeIndex];
+        node.secondChildOffset = secondChild;
+        node.nPrimitives = 0;
+        node.axis = (uint8_t)axis;
+        return nodeIndex;
+    }
+
+    static int bucketIndex(const AABB& centroidBounds, const Vec3& centroid, int axis, int nBuckets) {
+        int b = (int)(nBuckets * centroidBounds.offset(centroid)[axis]);
+        return b < nBuckets ? b : nBuckets - 1;
+    }
+
+    int mMaxPrimsInNode;
+    std::vector<const Shape*> mPrimitives;
+    std::vector<uint8_t> mPrimitiveTypes;   // ShapeType of each primitive
+    std::vector<LinearBVHNode> mNodes;
+};
+
+#endif
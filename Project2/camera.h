@@ -3,18 +3,13 @@
 
 #pragma once
 #include "ray.h"
-#include "pcg32.h"
-
-#define M_PI 3.142f
-
-Vec3 sampleUnitDisk(pcg32& rng) {
-    Vec3 p;
-    do {
-        p = 2.f * Vec3((float)rng.nextDouble(), (float)rng.nextDouble(), 0.f) - Vec3(1.f, 1.f, 0.f);
-    } while (p.x() * p.x() + p.y() * p.y() >= 1.f);
-    return p;
-}
+#include "sampler.h"
+#include "warp.h"
 
+// Lens models the render kernels are specialized for, see KernelTraits. They select the
+// overload of Camera::generateRay that samples the lens.
+struct PinholeLens {};
+struct ThinLens {};
 
 class Camera
 {
@@ -24,11 +19,12 @@ public:
         : origin(o)
         , lowerLeftCorner(llc)
         , horizontal(h)
-        , vertical(v) {}
+        , vertical(v)
+        , lensRadius(0.f) {}
     Camera(const Vec3& eye, const Vec3& lookat, const Vec3& up, float fov, float aspectRatio,
         float aperture = 0.0f, float focusDistance = 1.0f) {
         lensRadius = aperture * 0.5f;
-        float theta = fov * M_PI / 180.f;
+        float theta = fov * Pi / 180.f;
         float halfHeight = std::tan(theta * 0.5f);
         float halfWidth = aspectRatio * halfHeight;
 
@@ -48,8 +44,19 @@ public:
         return Ray(origin, lowerLeftCorner + s * horizontal + t * vertical - origin);
     }
 
-    Ray generateRay(float s, float t, pcg32& rng) const {
-        Vec3 rd = lensRadius * sampleUnitDisk(rng);
+    Ray generateRay(float s, float t, Sampler& sampler) const {
+        return generateRay(s, t, sampler, ThinLens());
+    }
+
+    // The lens dimensions are skipped rather than drawn and scaled by a zero radius, later
+    // samples keep their dimensions and the image is the same as with ThinLens.
+    Ray generateRay(float s, float t, Sampler& sampler, PinholeLens) const {
+        sampler.skip2D();
+        return generateRay(s, t);
+    }
+
+    Ray generateRay(float s, float t, Sampler& sampler, ThinLens) const {
+        Vec3 rd = lensRadius * squareToConcentricDisk(sampler.get2D());
         Vec3 offset = u * rd.x() + v * rd.y();
         return Ray(origin + offset, lowerLeftCorner + s * horizontal + t * vertical - origin - offset);
     }
@@ -0,0 +1,29 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#pragma once
+#include "vec3.h"
+#include <cmath>
+
+// Orthonormal basis around a unit normal. Local coordinates have the normal as +z, which
+// is the frame the warps in warp.h and the BSDFs in material.h work in.
+class Frame
+{
+public:
+    Frame() {}
+    // Duff et al., "Building an Orthonormal Basis, Revisited", JCGT 2017
+    explicit Frame(const Vec3& normal) : n(normal) {
+        float sign = std::copysign(1.f, n.z());
+        float a = -1.f / (sign + n.z());
+        float b = n.x() * n.y() * a;
+        s = Vec3(1.f + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+        t = Vec3(b, sign + n.y() * n.y() * a, -n.y());
+    }
+
+    Vec3 toLocal(const Vec3& v) const { return Vec3(v.dot(s), v.dot(t), v.dot(n)); }
+    Vec3 toWorld(const Vec3& v) const { return v.x() * s + v.y() * t + v.z() * n; }
+
+    Vec3 s, t, n;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#pragma once
+#include "vec3.h"
+#include <vector>
+
+// Linear radiance values for every pixel. Row 0 is the bottom row of the image,
+// matching the (u, v) convention used by Camera::generateRay.
+class Framebuffer
+{
+public:
+    Framebuffer() : width(0), height(0) {}
+    Framebuffer(int w, int h) : width(w), height(h), pixels(w * h) {}
+    Vec3& operator() (int x, int y) { return pixels[y * width + x]; }
+    const Vec3& operator() (int x, int y) const { return pixels[y * width + x]; }
+
+    int width;
+    int height;
+    std::vector<Vec3> pixels;
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __IMAGEIO_H__
+#define __IMAGEIO_H__
+
+#pragma once
+#include "framebuffer.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes a finished framebuffer to disk. Every format converts the whole image into
+// one preallocated buffer first and hands it to the file in a single write.
+//   ppm : binary P6, 8 bit, gamma 2
+//   png : 8 bit through stb_image_write, gamma 2
+//   pfm : 32 bit float linear radiance, for HDR viewers and image comparisons
+enum ImageFormat
+{
+    ImageFormatPPM,
+    ImageFormatPNG,
+    ImageFormatPFM
+};
+
+inline bool imageFormatFromName(const std::string& name, ImageFormat& format) {
+    if (name == "ppm") format = ImageFormatPPM;
+    else if (name == "png") format = ImageFormatPNG;
+    else if (name == "pfm") format = ImageFormatPFM;
+    else return false;
+    return true;
+}
+
+// Picks the format from the file extension, defaulting to ppm
+inline ImageFormat imageFormatFromFilename(const std::string& filename) {
+    ImageFormat format = ImageFormatPPM;
+    size_t dot = filename.find_last_of('.');
+    if (dot != std::string::npos) {
+        std::string ext = filename.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)::tolower(c); });
+        imageFormatFromName(ext, format);
+    }
+    return format;
+}
+
+// 8 bit RGB, top row first, with gamma 2 applied
+inline void toLDR(const Framebuffer& framebuffer, std::vector<unsigned char>& rgb) {
+    int nx = framebuffer.width, ny = framebuffer.height;
+    rgb.resize(3 * nx * ny);
+    unsigned char* out = rgb.data();
+    for (int j = ny - 1; j >= 0; j--) {
+        for (int i = 0; i < nx; i++) {
+            const Vec3& col = framebuffer(i, j);
+            for (int c = 0; c < 3; c++) {
+                int v = int(255.99f * std::sqrt(std::max(col[c], 0.f)));
+                *out++ = (unsigned char)std::min(v, 255);
+            }
+        }
+    }
+}
+
+inline bool writePPM(const std::string& filename, const Framebuffer& framebuffer) {
+    std::vector<unsigned char> rgb;
+    toLDR(framebuffer, rgb);
+    std::ofstream file(filename, std::ios::binary);
+    file << "P6\n" << framebuffer.width << " " << framebuffer.height << "\n255\n";
+    file.write((const char*)rgb.data(), rgb.size());
+    return (bool)file;
+}
+
+inline bool writePNG(const std::string& filename, const Framebuffer& framebuffer) {
+    std::vector<unsigned char> rgb;
+    toLDR(framebuffer, rgb);
+    int nx = framebuffer.width, ny = framebuffer.height;
+    return stbi_write_png(filename.c_str(), nx, ny, 3, rgb.data(), 3 * nx) != 0;
+}
+
+// PFM stores rows bottom to top, the same order as the framebuffer. A negative scale
+// marks the data as little endian.
+inline bool writePFM(const std::string& filename, const Framebuffer& framebuffer) {
+    std::vector<float> data(3 * framebuffer.pixels.size());
+    for (size_t p = 0; p < framebuffer.pixels.size(); p++) {
+        data[3 * p + 0] = framebuffer.pixels[p].x();
+        data[3 * p + 1] = framebuffer.pixels[p].y();
+        data[3 * p + 2] = framebuffer.pixels[p].z();
+    }
+    std::ofstream file(filename, std::ios::binary);
+    file << "PF\n" << framebuffer.width << " " << framebuffer.height << "\n-1.0\n";
+    file.write((const char*)data.data(), data.size() * sizeof(float));
+    return (bool)file;
+}
+
+inline bool writeImage(const std::string& filename, const Framebuffer& framebuffer, ImageFormat format) {
+    switch (format) {
+    case ImageFormatPNG: return writePNG(filename, framebuffer);
+    case ImageFormatPFM: return writePFM(filename, framebuffer);
+    default: return writePPM(filename, framebuffer);
+    }
+}
+
+#endif
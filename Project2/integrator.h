@@ -0,0 +1,161 @@
+#ifndef __INTEGRATOR_H__
+#define __INTEGRATOR_H__
+
+#pragma once
+#include "ray.h"
+#include "shape.h"
+#include "material.h"
+#include "light.h"
+#include "kernel.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+// Balance of two sampling strategies with the power heuristic (Veach's thesis, 9.2.4)
+inline float powerHeuristic(float pdf, float otherPdf) {
+    float a = pdf * pdf, b = otherPdf * otherPdf;
+    return a > 0.f ? a / (a + b) : 0.f;
+}
+
+// Iterative path tracer. The product of the sample weights (BSDF * cos / pdf) along the
+// path is carried in a throughput accumulator instead of being multiplied in on the way
+// back up the recursion.
+// With lights, every vertex also samples one light directly (next event estimation) and
+// emission found by BSDF sampling is weighted against that strategy with multiple
+// importance sampling. Without lights no sampler dimensions are spent on it.
+// Paths end on a miss, on absorption, after maxDepth scattering events, or by Russian
+// roulette once rrDepth bounces have been made (rrDepth <= 0 disables roulette).
+// The Traits argument of the member templates selects a specialized kernel, see
+// KernelTraits; a kernel without lights must only be used when lights is empty.
+class PathIntegrator
+{
+public:
+    PathIntegrator(int maxDepth = 50, int rrDepth = 5, const std::vector<const Light*>& lights = std::vector<const Light*>())
+        : maxDepth(maxDepth), rrDepth(rrDepth), lights(lights) {}
+
+    template <typename Traits = GenericKernel>
+    Vec3 Li(const Ray& ray, const Shape& world, Sampler& sampler) const {
+        HitRecord hRec;
+        bool hit;
+        RT_STATS_ADD(primaryRays, 1);
+        {
+            RT_STATS_PHASE(PhaseIntersect);
+            hit = world.intersect(ray, 0.001f, FLT_MAX, hRec);
+        }
+        return Li<Traits>(ray, hit, hRec, world, sampler);
+    }
+
+    // Continues a path whose first intersection has already been found, e.g. by a packet trace
+    template <typename Traits = GenericKernel>
+    Vec3 Li(const Ray& ray, bool hit, const HitRecord& firstHit, const Shape& world, Sampler& sampler) const {
+        Vec3 L(0.f);
+        Vec3 throughput(1.f);
+        Ray r = ray;
+        HitRecord hRec = firstHit;
+        // the BSDF sample that led to the current vertex, camera rays count as specular
+        float bsdfPdf = 0.f;
+        bool specular = true;
+        int bounce = 0;
+        for (; ; bounce++) {
+            if (!hit) {
+                L += throughput * background(r);
+                break;
+            }
+
+            Vec3 wo = -r.d.normalized();
+            L += throughput * emitted<Traits>(hRec, wo, r.o, bsdfPdf, specular);
+            if (bounce >= maxDepth) break;
+            {
+                RT_STATS_PHASE(PhaseLights);
+                L += throughput * sampleLight<Traits>(hRec, wo, world, sampler);
+            }
+
+            BSDFSample bs;
+            {
+                RT_STATS_PHASE(PhaseBSDF);
+                bool scattered = sampleMaterial(*hRec.material, hRec, wo, sampler, bs);
+                RT_STATS_MATERIAL(hRec.material->type(), scattered);
+                if (!scattered) break;
+                throughput = throughput * bs.weight;
+
+                if (!survives(throughput, bounce + 1, sampler)) {
+                    RT_STATS_ADD(rouletteKills, 1);
+                    // the path did scatter here, count it in the depth
+                    bounce++;
+                    break;
+                }
+            }
+
+            bsdfPdf = bs.pdf;
+            specular = bs.specular;
+            r = Ray(hRec.position, bs.wi);
+            RT_STATS_ADD(secondaryRays, 1);
+            {
+                RT_STATS_PHASE(PhaseIntersect);
+                hit = world.intersect(r, 0.001f, FLT_MAX, hRec);
+            }
+        }
+        RT_STATS_PATH(bounce);
+        return L;
+    }
+
+    // Radiance emitted at a hit towards wo. origin is the previous vertex of the path, and
+    // bsdfPdf and specular describe the sample that found the hit from there.
+    template <typename Traits = GenericKernel>
+    Vec3 emitted(const HitRecord& hit, const Vec3& wo, const Vec3& origin, float bsdfPdf, bool specular) const {
+        if (hit.material->type() != MaterialEmissive) return Vec3(0.f);
+        const Emissive* emitter = static_cast<const Emissive*>(hit.material);
+        Vec3 Le = emitter->emitted(hit, wo);
+        // light sampling could not have produced a specular direction
+        if (!Traits::lights || specular || lights.empty() || !emitter->light) return Le;
+        float lightPdf = emitter->light->pdf(origin, hit) / lights.size();
+        return Le * powerHeuristic(bsdfPdf, lightPdf);
+    }
+
+    // Next event estimation. Picks a light uniformly, samples a direction towards it and
+    // traces a shadow ray; the result is weighted against BSDF sampling of that direction.
+    template <typename Traits = GenericKernel>
+    Vec3 sampleLight(const HitRecord& hit, const Vec3& wo, const Shape& world, Sampler& sampler) const {
+        if (!Traits::lights || lights.empty()) return Vec3(0.f);
+        int n = (int)lights.size();
+        int index = std::min((int)(sampler.get1D() * n), n - 1);
+        Point2f u = sampler.get2D();
+        LightSample ls;
+        if (!lights[index]->sample(hit.position, u, ls)) return Vec3(0.f);
+        // specular and emissive surfaces do not need the shadow ray
+        Vec3 f = evalMaterial(*hit.material, hit, wo, ls.wi);
+        if (f == 0.f) return Vec3(0.f);
+        RT_STATS_ADD(shadowRays, 1);
+        if (world.occluded(Ray(hit.position, ls.wi), 0.001f, ls.distance * (1.f - 1e-4f))) return Vec3(0.f);
+        float lightPdf = ls.pdf / n;
+        float weight = powerHeuristic(lightPdf, pdfMaterial(*hit.material, hit, wo, ls.wi));
+        return f * ls.radiance * (weight / lightPdf);
+    }
+
+    // Russian roulette after a path has made the given number of bounces. A surviving
+    // path has its throughput divided by the survival probability to stay unbiased.
+    bool survives(Vec3& throughput, int bounces, Sampler& sampler) const {
+        if (rrDepth <= 0 || bounces < rrDepth) return true;
+        // survive with a probability proportional to the remaining throughput
+        float survival = std::min(0.95f, std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+        if (survival <= 0.f || sampler.get1D() >= survival) return false;
+        throughput /= survival;
+        return true;
+    }
+
+    // sky gradient between white at the horizon and blue at the zenith
+    static Vec3 background(const Ray& r) {
+        Vec3 unitDirVector = r.d.normalized();
+        // get an interpolation paramter t between 0-1
+        float t = 0.5f * (unitDirVector.y() + 1.0f);
+        // interp between blue and white
+        return (1.0f - t) * Vec3(1.0f) + t * Vec3(0.5f, 0.7f, 1.0f);
+    }
+
+    int maxDepth;
+    int rrDepth;
+    std::vector<const Light*> lights;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+#pragma once
+#include "camera.h"
+
+// Configuration of a render job that is fixed before the first sample. The integrator and
+// the renderers take it as a template argument, so each combination compiles to its own
+// kernel without the per sample branches:
+//   Lens    PinholeLens skips the lens sample, ThinLens samples the aperture
+//   lights  false compiles out next event estimation and the MIS weights of emission
+// The maximum depth stays a runtime value; it is one compare per bounce. Gamma is applied
+// when the image is written and is not part of the kernel.
+template <typename LensT, bool LightsT>
+struct KernelTraits
+{
+    typedef LensT Lens;
+    static const bool lights = LightsT;
+};
+
+// Handles every job with runtime checks, used by callers that do not dispatch
+typedef KernelTraits<ThinLens, true> GenericKernel;
+
+// Calls func with a default constructed KernelTraits matching the job, usually a generic
+// lambda that forwards decltype(traits) to a renderer.
+template <typename Func>
+void dispatchKernel(const Camera& camera, bool hasLights, Func func) {
+    bool thinLens = camera.lensRadius > 0.f;
+    if (thinLens && hasLights) func(KernelTraits<ThinLens, true>());
+    else if (thinLens) func(KernelTraits<ThinLens, false>());
+    else if (hasLights) func(KernelTraits<PinholeLens, true>());
+    else func(KernelTraits<PinholeLens, false>());
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef __LIGHT_H__
+#define __LIGHT_H__
+
+#pragma once
+#include "vec3.h"
+#include "shape.h"
+#include "sampler.h"
+#include "warp.h"
+#include "frame.h"
+#include "arena.h"
+#include <algorithm>
+#include <cmath>
+
+// Direction towards a point on a light. pdf is the density of the direction per solid
+// angle at the shaded point, distance the length of the shadow ray.
+struct LightSample
+{
+    Vec3 wi;
+    float distance;
+    float pdf;
+    Vec3 radiance;
+};
+
+// Emitter that can be sampled directly. Every light also has a surface in the scene
+// (see Scene::addLight) so that paths can hit it by BSDF sampling; pdf() gives the
+// density sample() would have chosen that direction with, for multiple importance
+// sampling of the two strategies.
+class Light
+{
+public:
+    Light(const Vec3& radiance) : radiance(radiance) {}
+    virtual ~Light() {}
+    virtual bool sample(const Vec3& p, const Point2f& u, LightSample& ls) const = 0;
+    virtual float pdf(const Vec3& p, const HitRecord& lightHit) const = 0;
+    // creates the shape rays intersect, emitting through the given material
+    virtual Shape* createShape(Arena& arena, const Material* material) const = 0;
+
+    Vec3 radiance;
+};
+
+// Spherical light. Samples are drawn uniformly from the cone of directions the sphere
+// subtends, so every sample lands on the visible side.
+class SphereLight : public Light
+{
+public:
+    SphereLight(const Vec3& center, float radius, const Vec3& radiance)
+        : Light(radiance), center(center), radius(radius) {}
+
+    bool sample(const Vec3& p, const Point2f& u, LightSample& ls) const {
+        Vec3 toCenter = center - p;
+        float d2 = toCenter.dot(toCenter);
+        // points inside the light see all of it, they are lit by BSDF sampling only
+        if (d2 <= radius * radius) return false;
+        float d = std::sqrt(d2);
+        float cosMax = std::sqrt(std::max(0.f, 1.f - radius * radius / d2));
+        float cosTheta = 1.f - u.x * (1.f - cosMax);
+        float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+        float phi = 2.f * Pi * u.y;
+        Frame frame(toCenter / d);
+        ls.wi = frame.toWorld(Vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta));
+        // near intersection of the direction with the sphere
+        ls.distance = d * cosTheta - std::sqrt(std::max(0.f, radius * radius - d2 * sinTheta * sinTheta));
+        ls.pdf = conePdf(cosMax);
+        ls.radiance = radiance;
+        return true;
+    }
+    float pdf(const Vec3& p, const HitRecord&) const {
+        Vec3 toCenter = center - p;
+        float d2 = toCenter.dot(toCenter);
+        if (d2 <= radius * radius) return 0.f;
+        return conePdf(std::sqrt(std::max(0.f, 1.f - radius * radius / d2)));
+    }
+    Shape* createShape(Arena& arena, const Material* material) const { return arena.create<Sphere>(center, radius, material); }
+
+    Vec3 center;
+    float radius;
+
+private:
+    static float conePdf(float cosMax) { return 1.f / (2.f * Pi * std::max(1.f - cosMax, 1e-7f)); }
+};
+
+// One sided parallelogram light emitting to the side of edge1 x edge2. Samples are
+// uniform over the area and converted to solid angle.
+class QuadLight : public Light
+{
+public:
+    QuadLight(const Vec3& corner, const Vec3& edge1, const Vec3& edge2, const Vec3& radiance)
+        : Light(radiance), corner(corner), edge1(edge1), edge2(edge2) {
+        Vec3 n = edge1.cross(edge2);
+        area = n.length();
+        normal = n / area;
+    }
+
+    bool sample(const Vec3& p, const Point2f& u, LightSample& ls) const {
+        Vec3 d = corner + u.x * edge1 + u.y * edge2 - p;
+        float d2 = d.dot(d);
+        ls.distance = std::sqrt(d2);
+        ls.wi = d / ls.distance;
+        float cosLight = -ls.wi.dot(normal);
+        if (cosLight <= 0.f) return false;
+        ls.pdf = d2 / (cosLight * area);
+        ls.radiance = radiance;
+        return true;
+    }
+    float pdf(const Vec3& p, const HitRecord& lightHit) const {
+        Vec3 d = lightHit.position - p;
+        float d2 = d.dot(d);
+        float cosLight = -d.dot(normal) / std::sqrt(d2);
+        if (cosLight <= 0.f) return 0.f;
+        return d2 / (cosLight * area);
+    }
+    Shape* createShape(Arena& arena, const Material* material) const { return arena.create<Quad>(corner, edge1, edge2, material); }
+
+    Vec3 corner;
+    Vec3 edge1;
+    Vec3 edge2;
+    Vec3 normal;
+    float area;
+};
+
+#endif
@@ -4,15 +4,19 @@
 #pragma once
 #include "ray.h"
 #include "shape.h"
-#include "pcg32.h"
+#include "sampler.h"
+#include "warp.h"
+#include "frame.h"
+#include <algorithm>
+#include <cmath>
 
-extern Vec3 sampleUniformSphere(pcg32& rng);
+class Light;
 
-Vec3 reflect(const Vec3& n, const Vec3& v) {
+inline Vec3 reflect(const Vec3& n, const Vec3& v) {
     return v - 2 * n.dot(v) * n;
 }
 
-bool refract(const Vec3& v, const Vec3& n, float ni_over_nt, Vec3& refracted) {
+inline bool refract(const Vec3& v, const Vec3& n, float ni_over_nt, Vec3& refracted) {
     Vec3 uv = v.normalized();
     float dt = uv.dot(n);
     float discriminant = 1.0f - ni_over_nt * ni_over_nt * (1.0f - dt * dt);
@@ -24,84 +28,278 @@ bool refract(const Vec3& v, const Vec3& n, float ni_over_nt, Vec3& refracted) {
     }
 }
 
-float schlick(float cosine, float refIdx) {
+inline float schlick(float cosine, float refIdx) {
     float r0 = (1.f - refIdx) / (1.f + refIdx);
     r0 = r0 * r0;
     return r0 + (1.f - r0) * std::pow((1.f - cosine), 5);
 }
 
+// Tag of the concrete material class, lets batched renderers group hits by material
+// and lets the free functions below call the concrete class without virtual dispatch.
+enum MaterialType
+{
+    MaterialLambertian,
+    MaterialMetal,
+    MaterialDielectric,
+    MaterialEmissive,
+    MaterialOther,
+    MaterialTypeCount
+};
+
+#if defined(RT_STATS)
+static_assert(MaterialTypeCount == RenderStats::MaterialTypes, "RenderStats counts every material type");
+#endif
+
+// Direction drawn from a material. weight is eval(wi) / pdf, the factor the path
+// throughput is multiplied with. Specular samples come from a delta distribution, for
+// them eval() and pdf() are zero and only weight is meaningful.
+struct BSDFSample
+{
+    Vec3 wi;
+    Vec3 weight;
+    float pdf;
+    bool specular;
+};
+
+// Scattering model of a surface. All directions are unit vectors in world space pointing
+// away from the hit point: wo towards the previous vertex of the path, wi towards the
+// next one. eval() returns the BSDF times |cos| of wi with the shading normal and pdf()
+// the solid angle density sample() draws wi with.
+// The tag is stored rather than returned by a virtual function so reading it costs no
+// indirect call; classes outside the known set keep MaterialOther. The tagged classes are
+// final, a subclass could not override what the dispatch on the tag calls.
 class Material
 {
 public:
-    virtual bool scatter(const Ray& ray, const HitRecord& hitRecord, Vec3& attenuation, Ray& scattered, pcg32& rng) const = 0;
+    Material(MaterialType type = MaterialOther) : mType(type) {}
+    virtual ~Material() {}
+    virtual Vec3 eval(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const = 0;
+    virtual float pdf(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const = 0;
+    virtual bool sample(const HitRecord& hitRecord, const Vec3& wo, Sampler& sampler, BSDFSample& bs) const = 0;
+    MaterialType type() const { return mType; }
+
+protected:
+    MaterialType mType;
 };
 
-class Lambertian : public Material
+// normal flipped to the side of w
+inline Vec3 faceForward(const Vec3& n, const Vec3& w) { return n.dot(w) < 0.f ? -n : n; }
+
+// Ideal diffuse reflection, importance sampled with a cosine weighted hemisphere so the
+// weight of every sample is just the albedo.
+class Lambertian final : public Material
 {
 public:
-    Lambertian(const Vec3& a) : albedo(a) {}
-    bool scatter(const Ray& ray, const HitRecord& hitRecord, Vec3& attenuation, Ray& scattered, pcg32& rng) const {
-        Vec3 target = hitRecord.position + hitRecord.normal + sampleUniformSphere(rng);
-        scattered = Ray(hitRecord.position, target - hitRecord.position);
-        attenuation = albedo;
+    Lambertian(const Vec3& a) : Material(MaterialLambertian), albedo(a) {}
+
+    Vec3 eval(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const {
+        Vec3 n = faceForward(hitRecord.normal, wo);
+        return albedo * (std::max(n.dot(wi), 0.f) * InvPi);
+    }
+    float pdf(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const {
+        Vec3 n = faceForward(hitRecord.normal, wo);
+        return cosineHemispherePdf(std::max(n.dot(wi), 0.f));
+    }
+    bool sample(const HitRecord& hitRecord, const Vec3& wo, Sampler& sampler, BSDFSample& bs) const {
+        Frame frame(faceForward(hitRecord.normal, wo));
+        Vec3 local = squareToCosineHemisphere(sampler.get2D());
+        if (local.z() <= 0.f) return false;
+        bs.wi = frame.toWorld(local);
+        bs.pdf = cosineHemispherePdf(local.z());
+        bs.weight = albedo;
+        bs.specular = false;
         return true;
     }
     Vec3 albedo;
 };
 
-class Metal : public Material
+// Conductor with a GGX (Trowbridge-Reitz) microfacet distribution and a Schlick Fresnel
+// term with the albedo as reflectance at normal incidence. fuzziness is used as the GGX
+// roughness alpha; below 1e-3 the surface is treated as a perfect mirror. Directions are
+// drawn from the distribution of visible normals (Heitz 2018), which leaves only the
+// masking term of wi in the weight.
+class Metal final : public Material
 {
 public:
-    Metal(const Vec3& a, const float f = 0.f) : albedo(a) {
+    Metal(const Vec3& a, const float f = 0.f) : Material(MaterialMetal), albedo(a) {
         if (f < 1.0f) fuzziness = f;
         else fuzziness = 1.0f;
     }
-    bool scatter(const Ray& ray, const HitRecord& hitRecord, Vec3& attenuation, Ray& scattered, pcg32& rng) const {
-        Vec3 reflected = reflect(hitRecord.normal, ray.d.normalized());
-        scattered = Ray(hitRecord.position, reflected + fuzziness * sampleUniformSphere(rng));
-        attenuation = albedo;
-        return scattered.d.dot(hitRecord.normal) > 0.0f;
+
+    Vec3 eval(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const {
+        if (isSpecular()) return Vec3(0.f);
+        Frame frame(faceForward(hitRecord.normal, wo));
+        Vec3 o = frame.toLocal(wo), i = frame.toLocal(wi);
+        if (o.z() <= 0.f || i.z() <= 0.f) return Vec3(0.f);
+        Vec3 m = (o + i).normalized();
+        // D G F / (4 cos_o cos_i) times cos_i
+        return fresnel(i.dot(m)) * (D(m) * G2(o, i) / (4.f * o.z()));
+    }
+    float pdf(const HitRecord& hitRecord, const Vec3& wo, const Vec3& wi) const {
+        if (isSpecular()) return 0.f;
+        Frame frame(faceForward(hitRecord.normal, wo));
+        Vec3 o = frame.toLocal(wo), i = frame.toLocal(wi);
+        if (o.z() <= 0.f || i.z() <= 0.f) return 0.f;
+        Vec3 m = (o + i).normalized();
+        // visible normal density D_o(m) = G1(o) D(m) |o.m| / cos_o, times the reflection jacobian 1 / (4 |o.m|)
+        return G1(o) * D(m) / (4.f * o.z());
+    }
+    bool sample(const HitRecord& hitRecord, const Vec3& wo, Sampler& sampler, BSDFSample& bs) const {
+        Frame frame(faceForward(hitRecord.normal, wo));
+        Vec3 o = frame.toLocal(wo);
+        if (o.z() <= 0.f) return false;
+        if (isSpecular()) {
+            Vec3 i(-o.x(), -o.y(), o.z());
+            bs.wi = frame.toWorld(i);
+            bs.weight = fresnel(o.z());
+            bs.pdf = 0.f;
+            bs.specular = true;
+            return true;
+        }
+        Vec3 m = sampleVisibleNormal(o, sampler.get2D());
+        Vec3 i = 2.f * o.dot(m) * m - o;
+        if (i.z() <= 0.f) return false;
+        bs.wi = frame.toWorld(i);
+        bs.weight = fresnel(i.dot(m)) * (G2(o, i) / G1(o));
+        bs.pdf = G1(o) * D(m) / (4.f * o.z());
+        bs.specular = false;
+        return true;
     }
     Vec3 albedo;
     float fuzziness;
+
+private:
+    bool isSpecular() const { return fuzziness < 1e-3f; }
+
+    Vec3 fresnel(float cosine) const {
+        float c = 1.f - std::min(std::max(cosine, 0.f), 1.f);
+        float c5 = (c * c) * (c * c) * c;
+        return albedo + c5 * (Vec3(1.f) - albedo);
+    }
+
+    float D(const Vec3& m) const {
+        float a2 = fuzziness * fuzziness;
+        float d = m.z() * m.z() * (a2 - 1.f) + 1.f;
+        return a2 / (Pi * d * d);
+    }
+
+    // Smith masking, Lambda(w) = (-1 + sqrt(1 + alpha^2 tan^2 theta)) / 2
+    float lambda(const Vec3& w) const {
+        float cos2 = w.z() * w.z();
+        float tan2 = std::max(1.f - cos2, 0.f) / cos2;
+        return 0.5f * (-1.f + std::sqrt(1.f + fuzziness * fuzziness * tan2));
+    }
+    float G1(const Vec3& w) const { return 1.f / (1.f + lambda(w)); }
+    float G2(const Vec3& o, const Vec3& i) const { return 1.f / (1.f + lambda(o) + lambda(i)); }
+
+    Vec3 sampleVisibleNormal(const Vec3& o, const Point2f& u) const {
+        // stretch the view direction to the hemisphere configuration
+        Vec3 vh = Vec3(fuzziness * o.x(), fuzziness * o.y(), o.z()).normalized();
+        float lensq = vh.x() * vh.x() + vh.y() * vh.y();
+        Vec3 t1 = lensq > 0.f ? Vec3(-vh.y(), vh.x(), 0.f) / std::sqrt(lensq) : Vec3(1.f, 0.f, 0.f);
+        Vec3 t2 = vh.cross(t1);
+        // uniform point on the disk, warped towards the visible half
+        Vec3 d = squareToConcentricDisk(u);
+        float s = 0.5f * (1.f + vh.z());
+        float p1 = d.x();
+        float p2 = (1.f - s) * std::sqrt(std::max(1.f - p1 * p1, 0.f)) + s * d.y();
+        Vec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(1.f - p1 * p1 - p2 * p2, 0.f)) * vh;
+        // unstretch
+        return Vec3(fuzziness * nh.x(), fuzziness * nh.y(), std::max(nh.z(), 1e-6f)).normalized();
+    }
 };
 
-class Dielectric : public Material
+// Glass. Reflects or refracts with the probability given by the Schlick approximation of
+// the Fresnel term, both lobes are specular.
+class Dielectric final : public Material
 {
 public:
-    Dielectric(const float _eta) : eta(_eta) {}
-    virtual bool scatter(const Ray& ray, const HitRecord& hitRecord, Vec3& attenuation, Ray& scattered, pcg32& rng) const {
+    Dielectric(const float _eta) : Material(MaterialDielectric), eta(_eta) {}
+
+    Vec3 eval(const HitRecord&, const Vec3&, const Vec3&) const { return Vec3(0.f); }
+    float pdf(const HitRecord&, const Vec3&, const Vec3&) const { return 0.f; }
+    bool sample(const HitRecord& hitRecord, const Vec3& wo, Sampler& sampler, BSDFSample& bs) const {
+        Vec3 d = -wo;
         Vec3 outwardNormal;
-        Vec3 reflected = reflect(hitRecord.normal, ray.d.normalized());
+        Vec3 reflected = reflect(hitRecord.normal, d);
         float ni_over_nt;
-        attenuation = Vec3(1.f);
         Vec3 refracted;
         float reflectionProb;
         float cosine;
-        if (ray.d.dot(hitRecord.normal) > 0.f) {
+        if (d.dot(hitRecord.normal) > 0.f) {
             outwardNormal = -hitRecord.normal;
             ni_over_nt = eta;
-            cosine = eta * ray.d.dot(hitRecord.normal) / ray.d.length();
+            cosine = eta * d.dot(hitRecord.normal);
         } else {
             outwardNormal = hitRecord.normal;
             ni_over_nt = 1.0f / eta;
-            cosine = -ray.d.dot(hitRecord.normal) / ray.d.length();
+            cosine = -d.dot(hitRecord.normal);
         }
-        if (refract(ray.d, outwardNormal, ni_over_nt, refracted)) {
+        if (refract(d, outwardNormal, ni_over_nt, refracted)) {
             reflectionProb = schlick(cosine, eta);
         } else {
-            scattered = Ray(hitRecord.position, reflected);
             reflectionProb = 1.0f;
         }
 
-        if ((float)rng.nextDouble() < reflectionProb) {
-            scattered = Ray(hitRecord.position, reflected);
-        } else {
-            scattered = Ray(hitRecord.position, refracted);
-        }
+        bs.wi = sampler.get1D() < reflectionProb ? reflected : refracted.normalized();
+        bs.weight = Vec3(1.f);
+        bs.pdf = 0.f;
+        bs.specular = true;
         return true;
     }
     float eta;
 };
 
+// Surface of a light source. Emits radiance on the side its normal points to and
+// absorbs everything that arrives. light is the Light that samples this surface
+// directly, null for emitters that are only found by BSDF sampling.
+class Emissive final : public Material
+{
+public:
+    Emissive(const Vec3& radiance, const Light* light = nullptr)
+        : Material(MaterialEmissive), radiance(radiance), light(light) {}
+
+    Vec3 emitted(const HitRecord& hitRecord, const Vec3& wo) const {
+        return hitRecord.normal.dot(wo) > 0.f ? radiance : Vec3(0.f);
+    }
+    Vec3 eval(const HitRecord&, const Vec3&, const Vec3&) const { return Vec3(0.f); }
+    float pdf(const HitRecord&, const Vec3&, const Vec3&) const { return 0.f; }
+    bool sample(const HitRecord&, const Vec3&, Sampler&, BSDFSample&) const { return false; }
+    Vec3 radiance;
+    const Light* light;
+};
+
+// Closed set dispatch on the type tag. The qualified calls of the known classes are
+// resolved at compile time and can be inlined into the caller, only MaterialOther goes
+// through the vtable.
+inline bool sampleMaterial(const Material& m, const HitRecord& hit, const Vec3& wo, Sampler& sampler, BSDFSample& bs) {
+    switch (m.type()) {
+    case MaterialLambertian: return static_cast<const Lambertian&>(m).Lambertian::sample(hit, wo, sampler, bs);
+    case MaterialMetal: return static_cast<const Metal&>(m).Metal::sample(hit, wo, sampler, bs);
+    case MaterialDielectric: return static_cast<const Dielectric&>(m).Dielectric::sample(hit, wo, sampler, bs);
+    case MaterialEmissive: return static_cast<const Emissive&>(m).Emissive::sample(hit, wo, sampler, bs);
+    default: return m.sample(hit, wo, sampler, bs);
+    }
+}
+
+inline Vec3 evalMaterial(const Material& m, const HitRecord& hit, const Vec3& wo, const Vec3& wi) {
+    switch (m.type()) {
+    case MaterialLambertian: return static_cast<const Lambertian&>(m).Lambertian::eval(hit, wo, wi);
+    case MaterialMetal: return static_cast<const Metal&>(m).Metal::eval(hit, wo, wi);
+    case MaterialDielectric: return static_cast<const Dielectric&>(m).Dielectric::eval(hit, wo, wi);
+    case MaterialEmissive: return static_cast<const Emissive&>(m).Emissive::eval(hit, wo, wi);
+    default: return m.eval(hit, wo, wi);
+    }
+}
+
+inline float pdfMaterial(const Material& m, const HitRecord& hit, const Vec3& wo, const Vec3& wi) {
+    switch (m.type()) {
+    case MaterialLambertian: return static_cast<const Lambertian&>(m).Lambertian::pdf(hit, wo, wi);
+    case MaterialMetal: return static_cast<const Metal&>(m).Metal::pdf(hit, wo, wi);
+    case MaterialDielectric: return static_cast<const Dielectric&>(m).Dielectric::pdf(hit, wo, wi);
+    case MaterialEmissive: return static_cast<const Emissive&>(m).Emissive::pdf(hit, wo, wi);
+    default: return m.pdf(hit, wo, wi);
+    }
+}
+
 #endif
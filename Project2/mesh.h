@@ -0,0 +1,162 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#pragma once
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "shape.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Indexed triangle mesh. The vertex attributes are shared by all triangles that use a
+// vertex; normals and uvs are either empty or hold one entry per position.
+struct TriangleMesh
+{
+    TriangleMesh() : material(nullptr) {}
+
+    int numTriangles() const { return (int)indices.size() / 3; }
+
+    AABB bounds() const {
+        AABB box;
+        for (const Vec3& p : positions) box.expand(p);
+        return box;
+    }
+
+    // Scales uniformly and moves the mesh so that its bounds become the largest box that
+    // fits in [center - halfSize, center + halfSize] and rests on its bottom face.
+    void fitTo(const Vec3& center, float halfSize) {
+        AABB box = bounds();
+        if (box.empty()) return;
+        Vec3 extent = box.extent();
+        float scale = 2.f * halfSize / std::max(extent.x(), std::max(extent.y(), extent.z()));
+        Vec3 c = box.centroid();
+        Vec3 offset = center - Vec3(0.f, halfSize, 0.f) - scale * Vec3(c.x(), box.pMin.y(), c.z());
+        for (Vec3& p : positions) p = scale * p + offset;
+    }
+
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<Point2f> uvs;
+    std::vector<int> indices;   // three per triangle
+    const Material* material;
+};
+
+// One triangle of a TriangleMesh. The intersection is the watertight test of Woop et al.,
+// "Watertight Ray/Triangle Intersection", JCGT 2013: the triangle is translated to the
+// ray origin and sheared so the ray runs along +z, after which the edge functions are
+// evaluated in 2D. Rays through a shared edge or vertex hit at least one of the adjacent
+// triangles, so closed meshes have no cracks for light to leak through.
+class Triangle final : public Shape
+{
+public:
+    using Shape::hit;
+
+    Triangle(const TriangleMesh* mesh, int index) : mesh(mesh), index(index) {}
+
+    bool hit(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        const int* v = &mesh->indices[3 * index];
+        if (!hitBarycentric(mesh->positions[v[0]], mesh->positions[v[1]], mesh->positions[v[2]], ray, minT, maxT,
+                            record.t, record.u, record.v))
+            return false;
+        record.shape = this;
+        RT_STATS_ADD(candidateHits, 1);
+        return true;
+    }
+
+    void computeSurface(const Ray&, HitRecord& record) const {
+        const int* v = &mesh->indices[3 * index];
+        if (mesh->normals.empty()) {
+            surface(mesh->positions[v[0]], mesh->positions[v[1]], mesh->positions[v[2]], nullptr, record);
+        } else {
+            Vec3 normals[3] = { mesh->normals[v[0]], mesh->normals[v[1]], mesh->normals[v[2]] };
+            surface(mesh->positions[v[0]], mesh->positions[v[1]], mesh->positions[v[2]], normals, record);
+        }
+        record.material = mesh->material;
+    }
+
+    bool occluded(const Ray& ray, const float minT, const float maxT) const {
+        const int* v = &mesh->indices[3 * index];
+        float t, b1, b2;
+        return hitBarycentric(mesh->positions[v[0]], mesh->positions[v[1]], mesh->positions[v[2]], ray, minT, maxT,
+                              t, b1, b2);
+    }
+
+    // The intersection and surface computations work on plain vertices so that shapes
+    // storing triangles flat can share them. t and the barycentrics b1, b2 of p1 and p2
+    // are only written on a hit.
+    static bool hitBarycentric(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Ray& ray,
+                               const float minT, const float maxT, float& t, float& b1, float& b2) {
+        // permute the axes so the largest component of the direction becomes z
+        Vec3 absD(std::fabs(ray.d.x()), std::fabs(ray.d.y()), std::fabs(ray.d.z()));
+        int kz = absD.x() > absD.y() ? (absD.x() > absD.z() ? 0 : 2) : (absD.y() > absD.z() ? 1 : 2);
+        int kx = kz == 2 ? 0 : kz + 1;
+        int ky = kx == 2 ? 0 : kx + 1;
+        Vec3 d(ray.d[kx], ray.d[ky], ray.d[kz]);
+        Vec3 a = p0 - ray.o, b = p1 - ray.o, c = p2 - ray.o;
+        Vec3 p0t(a[kx], a[ky], a[kz]), p1t(b[kx], b[ky], b[kz]), p2t(c[kx], c[ky], c[kz]);
+
+        // shear in xy, z is scaled below once the hit is known to be inside
+        float sx = -d.x() / d.z(), sy = -d.y() / d.z(), sz = 1.f / d.z();
+        float x0 = p0t.x() + sx * p0t.z(), y0 = p0t.y() + sy * p0t.z();
+        float x1 = p1t.x() + sx * p1t.z(), y1 = p1t.y() + sy * p1t.z();
+        float x2 = p2t.x() + sx * p2t.z(), y2 = p2t.y() + sy * p2t.z();
+
+        float e0 = x1 * y2 - y1 * x2;
+        float e1 = x2 * y0 - y2 * x0;
+        float e2 = x0 * y1 - y0 * x1;
+        // edge functions that round to zero are evaluated again in double precision
+        if (e0 == 0.f || e1 == 0.f || e2 == 0.f) {
+            e0 = (float)((double)x1 * y2 - (double)y1 * x2);
+            e1 = (float)((double)x2 * y0 - (double)y2 * x0);
+            e2 = (float)((double)x0 * y1 - (double)y0 * x1);
+        }
+        if ((e0 < 0.f || e1 < 0.f || e2 < 0.f) && (e0 > 0.f || e1 > 0.f || e2 > 0.f)) return false;
+        float det = e0 + e1 + e2;
+        if (det == 0.f) return false;
+
+        // t times det, compared against the interval without dividing
+        float tScaled = sz * (e0 * p0t.z() + e1 * p1t.z() + e2 * p2t.z());
+        if (det < 0.f && (tScaled > minT * det || tScaled < maxT * det)) return false;
+        if (det > 0.f && (tScaled < minT * det || tScaled > maxT * det)) return false;
+
+        float invDet = 1.f / det;
+        t = tScaled * invDet;
+        b1 = e1 * invDet;
+        b2 = e2 * invDet;
+        return true;
+    }
+
+    // Position and normal at the barycentrics in record.u and record.v. The normal is
+    // interpolated from the vertex normals when there are any.
+    static void surface(const Vec3& p0, const Vec3& p1, const Vec3& p2, const Vec3* normals, HitRecord& record) {
+        float b0 = 1.f - record.u - record.v;
+        // the barycentric point is more accurate than ray(t) for grazing rays
+        record.position = b0 * p0 + record.u * p1 + record.v * p2;
+        if (normals) {
+            Vec3 n = b0 * normals[0] + record.u * normals[1] + record.v * normals[2];
+            float length = n.length();
+            if (length > 0.f) {
+                record.normal = n / length;
+                return;
+            }
+        }
+        record.normal = (p1 - p0).cross(p2 - p0).normalized();
+    }
+
+    AABB bounds() const {
+        const int* v = &mesh->indices[3 * index];
+        AABB box(mesh->positions[v[0]]);
+        box.expand(mesh->positions[v[1]]);
+        box.expand(mesh->positions[v[2]]);
+        return box;
+    }
+    ShapeType type() const { return ShapeTriangle; }
+
+    const TriangleMesh* mesh;
+    int index;
+};
+
+#endif
@@ -0,0 +1,639 @@
+#ifndef __MESHIO_H__
+#define __MESHIO_H__
+
+#pragma once
+#include "mesh.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Triangle mesh loaders. The file is read in blocks of MeshBlockSize bytes, so apart from
+// the mesh itself the memory use does not grow with the file, and the blocks are parsed
+// on a ThreadPool.
+//   obj : v, vt, vn and f records. Polygons are triangulated as fans and negative
+//         indices are resolved; groups, materials and other records are ignored.
+//   ply : binary little or big endian. Vertices with x y z and optional nx ny nz and
+//         u v (or s t), faces as lists of vertex indices of any integer type.
+// All loaders return false and describe the problem in error when the file cannot be used.
+
+static const size_t MeshBlockSize = 4 << 20;
+
+// ---------------------------------------------------------------------------------------
+// OBJ
+// ---------------------------------------------------------------------------------------
+
+// Corner of an OBJ face, 0 based indices into the v, vt and vn arrays, ObjMissing when the
+// corner has no such attribute. A relative index that resolves to -1 is out of range, not
+// missing.
+static const int ObjMissing = INT_MIN;
+
+struct ObjCorner
+{
+    int v[3];
+};
+
+// Records of one block. Negative indices refer back from the current position in the
+// file; they are stored relative to the start of the block and listed in fixups (as
+// corner * 3 + attribute) until the block's place in the file is known.
+struct ObjBlock
+{
+    std::vector<Vec3> positions;
+    std::vector<Point2f> uvs;
+    std::vector<Vec3> normals;
+    std::vector<ObjCorner> corners;     // three per triangle
+    std::vector<int> fixups;
+    std::string error;
+};
+
+inline bool objDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Decimal floats with optional exponent; the parse is done in double so the result is
+// within one unit in the last place of strtof without its locale dependence.
+inline bool objParseFloat(const char*& p, const char* end, float& value) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    double mantissa = 0.0;
+    int exponent = 0, digits = 0;
+    for (; s < end && objDigit(*s); s++, digits++) mantissa = mantissa * 10.0 + (*s - '0');
+    if (s < end && *s == '.') {
+        for (s++; s < end && objDigit(*s); s++, digits++, exponent--) mantissa = mantissa * 10.0 + (*s - '0');
+    }
+    if (digits == 0) return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char* e = s + 1;
+        bool negativeExp = false;
+        if (e < end && (*e == '-' || *e == '+')) negativeExp = *e++ == '-';
+        if (e < end && objDigit(*e)) {
+            int x = 0;
+            for (; e < end && objDigit(*e); e++) x = std::min(x * 10 + (*e - '0'), 1000);
+            exponent += negativeExp ? -x : x;
+            s = e;
+        }
+    }
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    if (exponent >= 0) mantissa *= exponent <= 22 ? powers[exponent] : std::pow(10.0, exponent);
+    else mantissa /= -exponent <= 22 ? powers[-exponent] : std::pow(10.0, -exponent);
+    value = (float)(negative ? -mantissa : mantissa);
+    p = s;
+    return true;
+}
+
+inline bool objParseInt(const char*& p, const char* end, int& value) {
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    if (s >= end || !objDigit(*s)) return false;
+    long long x = 0;
+    for (; s < end && objDigit(*s); s++) x = std::min(x * 10 + (*s - '0'), (long long)INT32_MAX);
+    value = (int)(negative ? -x : x);
+    p = s;
+    return true;
+}
+
+// Parses the complete lines in [begin, end)
+inline void objParseBlock(const char* begin, const char* end, ObjBlock& block) {
+    std::vector<ObjCorner> face;
+    std::vector<int> faceFixups;
+    const char* p = begin;
+    while (p < end) {
+        const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+        if (!lineEnd) lineEnd = end;
+        while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+        if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            float x = 0.f, y = 0.f, z = 0.f;
+            p += 2;
+            if (!objParseFloat(p, lineEnd, x) || !objParseFloat(p, lineEnd, y) || !objParseFloat(p, lineEnd, z)) {
+                block.error = "invalid vertex position";
+                return;
+            }
+            block.positions.push_back(Vec3(x, y, z));
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+            float u = 0.f, v = 0.f;
+            p += 3;
+            if (!objParseFloat(p, lineEnd, u)) {
+                block.error = "invalid texture coordinate";
+                return;
+            }
+            objParseFloat(p, lineEnd, v);
+            block.uvs.push_back(Point2f(u, v));
+        } else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+            float x = 0.f, y = 0.f, z = 0.f;
+            p += 3;
+            if (!objParseFloat(p, lineEnd, x) || !objParseFloat(p, lineEnd, y) || !objParseFloat(p, lineEnd, z)) {
+                block.error = "invalid vertex normal";
+                return;
+            }
+            block.normals.push_back(Vec3(x, y, z));
+        } else if (lineEnd - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            p += 2;
+            face.clear();
+            faceFixups.clear();
+            const int counts[3] = { (int)block.positions.size(), (int)block.uvs.size(), (int)block.normals.size() };
+            for (;;) {
+                while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+                if (p >= lineEnd) break;
+                ObjCorner corner = { { ObjMissing, ObjMissing, ObjMissing } };
+                // v, v/vt, v//vn or v/vt/vn
+                for (int attr = 0; attr < 3; attr++) {
+                    int index;
+                    if (attr > 0) {
+                        if (p >= lineEnd || *p != '/') break;
+                        p++;
+                        if (p < lineEnd && *p == '/') continue;
+                    }
+                    if (!objParseInt(p, lineEnd, index) || index == 0) {
+                        block.error = "invalid face index";
+                        return;
+                    }
+                    if (index > 0) {
+                        corner.v[attr] = index - 1;
+                    } else {
+                        corner.v[attr] = counts[attr] + index;
+                        faceFixups.push_back((int)face.size() * 3 + attr);
+                    }
+                }
+                face.push_back(corner);
+            }
+            if (face.size() < 3) {
+                block.error = "face with less than three vertices";
+                return;
+            }
+            // fan triangulation, the fixups follow their corner into every triangle
+            for (size_t k = 2; k < face.size(); k++) {
+                const size_t ids[3] = { 0, k - 1, k };
+                for (int c = 0; c < 3; c++) {
+                    for (int f : faceFixups)
+                        if (f / 3 == (int)ids[c]) block.fixups.push_back((int)block.corners.size() * 3 + f % 3);
+                    block.corners.push_back(face[ids[c]]);
+                }
+            }
+        }
+        p = lineEnd + 1;
+    }
+}
+
+struct ObjCornerHash
+{
+    size_t operator() (const ObjCorner& c) const {
+        uint64_t h = (uint64_t)(uint32_t)c.v[0] * 0x9e3779b97f4a7c15ULL;
+        h ^= ((uint64_t)(uint32_t)c.v[1] + 0x632be59bd9b4e019ULL) * 0xbf58476d1ce4e5b9ULL;
+        h ^= ((uint64_t)(uint32_t)c.v[2] + 0x8cb92ba72f3d8dd7ULL) * 0x94d049bb133111ebULL;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+struct ObjCornerEqual
+{
+    bool operator() (const ObjCorner& a, const ObjCorner& b) const {
+        return a.v[0] == b.v[0] && a.v[1] == b.v[1] && a.v[2] == b.v[2];
+    }
+};
+
+inline bool loadOBJ(const std::string& filename, TriangleMesh& mesh, ThreadPool& pool, std::string& error) {
+    std::unique_ptr<FILE, int (*)(FILE*)> file(std::fopen(filename.c_str(), "rb"), &std::fclose);
+    if (!file) {
+        error = "cannot open " + filename;
+        return false;
+    }
+
+    std::vector<Vec3> positions, normals;
+    std::vector<Point2f> uvs;
+    std::vector<ObjCorner> corners;
+
+    // a batch of blocks is read, parsed in parallel and appended in file order
+    const int batchSize = std::max(2 * pool.size(), 2);
+    std::vector<std::vector<char>> buffers(batchSize);
+    std::vector<ObjBlock> blocks(batchSize);
+    std::vector<char> carry;
+    bool eof = false;
+    while (!eof) {
+        int nBlocks = 0;
+        for (; nBlocks < batchSize && !eof; nBlocks++) {
+            std::vector<char>& buffer = buffers[nBlocks];
+            buffer.swap(carry);
+            carry.clear();
+            // read until the block holds at least one complete line
+            for (;;) {
+                size_t size = buffer.size();
+                buffer.resize(size + MeshBlockSize);
+                size_t n = std::fread(buffer.data() + size, 1, MeshBlockSize, file.get());
+                buffer.resize(size + n);
+                if (n < MeshBlockSize) {
+                    eof = true;
+                    break;
+                }
+                if (std::memchr(buffer.data() + size, '\n', n)) break;
+            }
+            if (!eof) {
+                size_t last = buffer.size();
+                while (buffer[last - 1] != '\n') last--;
+                carry.assign(buffer.begin() + last, buffer.end());
+                buffer.resize(last);
+            }
+        }
+
+        pool.parallelFor(nBlocks, [&](int b, int) {
+            ObjBlock& block = blocks[b];
+            block.positions.clear(); block.uvs.clear(); block.normals.clear();
+            block.corners.clear(); block.fixups.clear(); block.error.clear();
+            objParseBlock(buffers[b].data(), buffers[b].data() + buffers[b].size(), block);
+        });
+
+        for (int b = 0; b < nBlocks; b++) {
+            ObjBlock& block = blocks[b];
+            if (!block.error.empty()) {
+                error = filename + ": " + block.error;
+                return false;
+            }
+            const int base[3] = { (int)positions.size(), (int)uvs.size(), (int)normals.size() };
+            size_t first = corners.size();
+            corners.insert(corners.end(), block.corners.begin(), block.corners.end());
+            for (int f : block.fixups) corners[first + f / 3].v[f % 3] += base[f % 3];
+            positions.insert(positions.end(), block.positions.begin(), block.positions.end());
+            uvs.insert(uvs.end(), block.uvs.begin(), block.uvs.end());
+            normals.insert(normals.end(), block.normals.begin(), block.normals.end());
+        }
+    }
+
+    // an attribute is kept only if every corner has it
+    const int counts[3] = { (int)positions.size(), (int)uvs.size(), (int)normals.size() };
+    bool has[3] = { true, true, true };
+    bool shared = true;     // every corner uses the same index for all its attributes
+    for (const ObjCorner& c : corners) {
+        for (int attr = 0; attr < 3; attr++) {
+            if (c.v[attr] == ObjMissing) {
+                has[attr] = false;
+            } else if (c.v[attr] < 0 || c.v[attr] >= counts[attr]) {
+                error = filename + ": face index out of range";
+                return false;
+            }
+        }
+    }
+    for (const ObjCorner& c : corners)
+        if ((has[1] && c.v[1] != c.v[0]) || (has[2] && c.v[2] != c.v[0])) {
+            shared = false;
+            break;
+        }
+    if ((has[1] && counts[1] != counts[0]) || (has[2] && counts[2] != counts[0])) shared = false;
+
+    mesh.indices.resize(corners.size());
+    if (shared) {
+        for (size_t i = 0; i < corners.size(); i++) mesh.indices[i] = corners[i].v[0];
+        mesh.positions.swap(positions);
+        if (has[1]) mesh.uvs.swap(uvs); else mesh.uvs.clear();
+        if (has[2]) mesh.normals.swap(normals); else mesh.normals.clear();
+        return true;
+    }
+
+    // different indices per attribute, every distinct combination becomes a vertex
+    mesh.positions.clear(); mesh.uvs.clear(); mesh.normals.clear();
+    std::unordered_map<ObjCorner, int, ObjCornerHash, ObjCornerEqual> vertices;
+    vertices.reserve(positions.size());
+    for (size_t i = 0; i < corners.size(); i++) {
+        ObjCorner key = corners[i];
+        if (!has[1]) key.v[1] = ObjMissing;
+        if (!has[2]) key.v[2] = ObjMissing;
+        auto inserted = vertices.insert(std::make_pair(key, (int)mesh.positions.size()));
+        if (inserted.second) {
+            mesh.positions.push_back(positions[key.v[0]]);
+            if (has[1]) mesh.uvs.push_back(uvs[key.v[1]]);
+            if (has[2]) mesh.normals.push_back(normals[key.v[2]]);
+        }
+        mesh.indices[i] = inserted.first->second;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------
+// PLY
+// ---------------------------------------------------------------------------------------
+
+enum PlyType
+{
+    PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64, PlyInvalid
+};
+
+inline PlyType plyTypeFromName(const std::string& name) {
+    if (name == "char" || name == "int8") return PlyInt8;
+    if (name == "uchar" || name == "uint8") return PlyUInt8;
+    if (name == "short" || name == "int16") return PlyInt16;
+    if (name == "ushort" || name == "uint16") return PlyUInt16;
+    if (name == "int" || name == "int32") return PlyInt32;
+    if (name == "uint" || name == "uint32") return PlyUInt32;
+    if (name == "float" || name == "float32") return PlyFloat32;
+    if (name == "double" || name == "float64") return PlyFloat64;
+    return PlyInvalid;
+}
+
+inline int plyTypeSize(PlyType type) {
+    static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return sizes[type];
+}
+
+// Value at p, byte swapped first when the file's endianness differs from the host's
+inline double plyRead(const unsigned char* p, PlyType type, bool swap) {
+    unsigned char bytes[8];
+    int size = plyTypeSize(type);
+    for (int i = 0; i < size; i++) bytes[i] = swap ? p[size - 1 - i] : p[i];
+    switch (type) {
+    case PlyInt8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyUInt8: return bytes[0];
+    case PlyInt16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyUInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyInt32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyUInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyFloat32: { float v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyFloat64: { double v; std::memcpy(&v, bytes, 8); return v; }
+    default: return 0.0;
+    }
+}
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;
+    PlyType countType;  // PlyInvalid for scalar properties
+};
+
+struct PlyElement
+{
+    std::string name;
+    int64_t count;
+    std::vector<PlyProperty> properties;
+
+    // size of one record, 0 if it contains lists
+    int stride() const {
+        int size = 0;
+        for (const PlyProperty& p : properties) {
+            if (p.countType != PlyInvalid) return 0;
+            size += plyTypeSize(p.type);
+        }
+        return size;
+    }
+};
+
+// Sequential reader over a file that keeps at least the requested bytes buffered
+class PlyReader
+{
+public:
+    PlyReader(FILE* file) : mFile(file), mBuffer(MeshBlockSize), mPos(0), mEnd(0) {}
+
+    // makes n bytes available at data(), false at the end of the file. The buffer grows a
+    // block at a time while the file still delivers data, so a corrupt count runs into the
+    // end of the file instead of allocating the size it asks for.
+    bool ensure(size_t n) {
+        if (mEnd - mPos >= n) return true;
+        std::memmove(mBuffer.data(), mBuffer.data() + mPos, mEnd - mPos);
+        mEnd -= mPos;
+        mPos = 0;
+        while (mEnd < n) {
+            if (mEnd == mBuffer.size()) mBuffer.resize(std::min(n, mBuffer.size() + MeshBlockSize));
+            size_t read = std::fread(mBuffer.data() + mEnd, 1, mBuffer.size() - mEnd, mFile);
+            if (read == 0) return false;
+            mEnd += read;
+        }
+        return true;
+    }
+    const unsigned char* data() const { return mBuffer.data() + mPos; }
+    size_t available() const { return mEnd - mPos; }
+    void skip(size_t n) { mPos += n; }
+
+private:
+    FILE* mFile;
+    std::vector<unsigned char> mBuffer;
+    size_t mPos;
+    size_t mEnd;
+};
+
+inline bool loadPLY(const std::string& filename, TriangleMesh& mesh, ThreadPool& pool, std::string& error) {
+    std::unique_ptr<FILE, int (*)(FILE*)> file(std::fopen(filename.c_str(), "rb"), &std::fclose);
+    if (!file) {
+        error = "cannot open " + filename;
+        return false;
+    }
+
+    // header
+    std::vector<PlyElement> elements;
+    bool bigEndian = false;
+    char line[1024];
+    if (!std::fgets(line, sizeof(line), file.get()) || std::strncmp(line, "ply", 3) != 0) {
+        error = filename + ": not a PLY file";
+        return false;
+    }
+    for (;;) {
+        if (!std::fgets(line, sizeof(line), file.get())) {
+            error = filename + ": missing end_header";
+            return false;
+        }
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (keyword == "end_header") break;
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format == "binary_big_endian") bigEndian = true;
+            else if (format != "binary_little_endian") {
+                error = filename + ": only binary PLY files are supported";
+                return false;
+            }
+        } else if (keyword == "element") {
+            PlyElement element;
+            tokens >> element.name >> element.count;
+            if (tokens.fail() || element.count < 0) {
+                error = filename + ": invalid element count";
+                return false;
+            }
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                error = filename + ": property outside of an element";
+                return false;
+            }
+            PlyProperty property;
+            std::string type;
+            tokens >> type;
+            property.countType = PlyInvalid;
+            if (type == "list") {
+                std::string countType;
+                tokens >> countType >> type;
+                property.countType = plyTypeFromName(countType);
+                if (property.countType == PlyInvalid || property.countType == PlyFloat32 || property.countType == PlyFloat64) {
+                    error = filename + ": invalid list count type " + countType;
+                    return false;
+                }
+            }
+            property.type = plyTypeFromName(type);
+            tokens >> property.name;
+            if (property.type == PlyInvalid) {
+                error = filename + ": unknown property type " + type;
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+    uint16_t probe = 1;
+    bool hostLittleEndian = *(unsigned char*)&probe == 1;
+    bool swap = bigEndian == hostLittleEndian;
+
+    mesh.positions.clear(); mesh.normals.clear(); mesh.uvs.clear(); mesh.indices.clear();
+    PlyReader reader(file.get());
+    int64_t nVertices = -1;
+    for (const PlyElement& element : elements) {
+        int stride = element.stride();
+        if (element.name == "vertex") {
+            if (stride == 0) {
+                error = filename + ": list properties in vertices are not supported";
+                return false;
+            }
+            // byte offsets of the attributes, -1 when absent
+            int offsets[8];
+            PlyType types[8];
+            const char* names[8][2] = { { "x", "x" }, { "y", "y" }, { "z", "z" }, { "nx", "nx" }, { "ny", "ny" }, { "nz", "nz" },
+                                        { "u", "s" }, { "v", "t" } };
+            for (int a = 0; a < 8; a++) {
+                offsets[a] = -1;
+                int offset = 0;
+                for (const PlyProperty& p : element.properties) {
+                    if (p.name == names[a][0] || p.name == names[a][1] ||
+                        (a >= 6 && p.name == std::string("texture_") + names[a][0])) {
+                        offsets[a] = offset;
+                        types[a] = p.type;
+                    }
+                    offset += plyTypeSize(p.type);
+                }
+            }
+            if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0) {
+                error = filename + ": vertices without positions";
+                return false;
+            }
+            bool hasNormals = offsets[3] >= 0 && offsets[4] >= 0 && offsets[5] >= 0;
+            bool hasUVs = offsets[6] >= 0 && offsets[7] >= 0;
+            nVertices = element.count;
+            mesh.positions.resize((size_t)nVertices);
+            if (hasNormals) mesh.normals.resize((size_t)nVertices);
+            if (hasUVs) mesh.uvs.resize((size_t)nVertices);
+
+            // blocks of whole vertices, converted in parallel
+            int64_t perBlock = std::max<int64_t>(1, MeshBlockSize / stride);
+            for (int64_t first = 0; first < nVertices; first += perBlock) {
+                int64_t n = std::min(perBlock, nVertices - first);
+                if (!reader.ensure((size_t)(n * stride))) {
+                    error = filename + ": unexpected end of file in vertices";
+                    return false;
+                }
+                const unsigned char* data = reader.data();
+                int nTasks = pool.size();
+                pool.parallelFor(nTasks, [&](int task, int) {
+                    int64_t begin = n * task / nTasks, end = n * (task + 1) / nTasks;
+                    for (int64_t i = begin; i < end; i++) {
+                        const unsigned char* v = data + i * stride;
+                        size_t out = (size_t)(first + i);
+                        mesh.positions[out] = Vec3((float)plyRead(v + offsets[0], types[0], swap),
+                                                   (float)plyRead(v + offsets[1], types[1], swap),
+                                                   (float)plyRead(v + offsets[2], types[2], swap));
+                        if (hasNormals)
+                            mesh.normals[out] = Vec3((float)plyRead(v + offsets[3], types[3], swap),
+                                                     (float)plyRead(v + offsets[4], types[4], swap),
+                                                     (float)plyRead(v + offsets[5], types[5], swap));
+                        if (hasUVs)
+                            mesh.uvs[out] = Point2f((float)plyRead(v + offsets[6], types[6], swap),
+                                                    (float)plyRead(v + offsets[7], types[7], swap));
+                    }
+                });
+                reader.skip((size_t)(n * stride));
+            }
+        } else {
+            bool isFace = element.name == "face";
+            mesh.indices.reserve(isFace ? (size_t)element.count * 3 : 0);
+            std::vector<int> polygon;
+            const std::string truncated = filename + ": unexpected end of file in " + element.name;
+            for (int64_t r = 0; r < element.count; r++) {
+                if (stride > 0 && !isFace) {
+                    if (!reader.ensure(stride)) {
+                        error = truncated;
+                        return false;
+                    }
+                    reader.skip(stride);
+                    continue;
+                }
+                for (const PlyProperty& p : element.properties) {
+                    int size = plyTypeSize(p.type);
+                    if (p.countType == PlyInvalid) {
+                        if (!reader.ensure(size)) {
+                            error = truncated;
+                            return false;
+                        }
+                        reader.skip(size);
+                        continue;
+                    }
+                    int countSize = plyTypeSize(p.countType);
+                    if (!reader.ensure(countSize)) {
+                        error = truncated;
+                        return false;
+                    }
+                    double countValue = plyRead(reader.data(), p.countType, swap);
+                    reader.skip(countSize);
+                    // counts of a float type could be anything, keep the conversion defined
+                    if (!(countValue >= 0. && countValue <= (double)INT_MAX)) {
+                        error = truncated;
+                        return false;
+                    }
+                    int64_t count = (int64_t)countValue;
+                    if (!reader.ensure((size_t)(count * size))) {
+                        error = truncated;
+                        return false;
+                    }
+                    if (isFace && (p.name == "vertex_indices" || p.name == "vertex_index")) {
+                        polygon.resize((size_t)count);
+                        for (int64_t k = 0; k < count; k++) {
+                            double index = plyRead(reader.data() + k * size, p.type, swap);
+                            if (index < 0 || index >= (double)nVertices) {
+                                error = filename + ": face index out of range";
+                                return false;
+                            }
+                            polygon[k] = (int)index;
+                        }
+                        for (int64_t k = 2; k < count; k++) {
+                            mesh.indices.push_back(polygon[0]);
+                            mesh.indices.push_back(polygon[k - 1]);
+                            mesh.indices.push_back(polygon[k]);
+                        }
+                    }
+                    reader.skip((size_t)(count * size));
+                }
+            }
+        }
+    }
+    if (nVertices < 0) {
+        error = filename + ": no vertex element";
+        return false;
+    }
+    return true;
+}
+
+// Picks the loader from the file extension
+inline bool loadMesh(const std::string& filename, TriangleMesh& mesh, ThreadPool& pool, std::string& error) {
+    size_t dot = filename.find_last_of('.');
+    std::string ext = dot == std::string::npos ? "" : filename.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+    if (ext == "obj") return loadOBJ(filename, mesh, pool, error);
+    if (ext == "ply") return loadPLY(filename, mesh, pool, error);
+    error = "unknown mesh format " + filename;
+    return false;
+}
+
+#endif
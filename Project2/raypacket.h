@@ -0,0 +1,26 @@
+#ifndef __RAYPACKET_H__
+#define __RAYPACKET_H__
+
+#pragma once
+#include "ray.h"
+#include "simd.h"
+
+// RT_SIMD_WIDTH rays stored as a structure of arrays so every component of all rays
+// can be loaded into one vfloat.
+struct RayPacket
+{
+    void set(int lane, const Ray& r) {
+        ox[lane] = r.o.x(); oy[lane] = r.o.y(); oz[lane] = r.o.z();
+        dx[lane] = r.d.x(); dy[lane] = r.d.y(); dz[lane] = r.d.z();
+    }
+    Ray ray(int lane) const { return Ray(Vec3(ox[lane], oy[lane], oz[lane]), Vec3(dx[lane], dy[lane], dz[lane])); }
+
+    alignas(32) float ox[RT_SIMD_WIDTH];
+    alignas(32) float oy[RT_SIMD_WIDTH];
+    alignas(32) float oz[RT_SIMD_WIDTH];
+    alignas(32) float dx[RT_SIMD_WIDTH];
+    alignas(32) float dy[RT_SIMD_WIDTH];
+    alignas(32) float dz[RT_SIMD_WIDTH];
+};
+
+#endif
@@ -1,91 +1,66 @@
-#define _CRT_SECURE_NO_WARNINGS
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "camera.h"
 #include "shape.h"
 #include "material.h"
-#include "stb_image_write.h"
+#include "scene.h"
+#include "meshio.h"
 #include "pcg32.h"
+#include "sampler.h"
+#include "bvh.h"
+#include "spheresoa.h"
+#include "scenecache.h"
+#include "renderer.h"
+#include "integrator.h"
+#include "kernel.h"
+#include "wavefront.h"
+#include "adaptive.h"
+#include "imageio.h"
+#include "threadpool.h"
+#include "timer.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <string>
 
-Vec3 sampleUniformSphere(pcg32& rng) {
-    Vec3 p;
-    do {
-        // crude rejection sampling
-        p = 2.0f * Vec3((float)rng.nextDouble(), (float)rng.nextDouble(), (float)rng.nextDouble()) - Vec3(1.0f);
-    } while (p.sqrLength() >= 1.0f);
-    return p;
-}
-
-Vec3 color(const Ray& r, ShapeList& list, pcg32& rng, int bounce) {
-    HitRecord hRec;
-    if (list.intersect(r, 0.001f, FLT_MAX, hRec)) {
-        Ray scattered;
-        Vec3 attenuation;
-        if (bounce < 50 && hRec.material->scatter(r, hRec, attenuation, scattered, rng)) {
-            return attenuation * color(scattered, list, rng, ++bounce);
-        } else { 
-            return Vec3(0.f); 
-        }
-    }
-
-    // shade the backgroud
-    Vec3 unitDirVector = r.d.normalized();
-    // get an interpolation paramter t between 0-1
-    float t = 0.5f * (unitDirVector.y() + 1.0f);
-    // interp between blue and white
-    return (1.0f - t) * Vec3(1.0f) + t * Vec3(0.5f, 0.7f, 1.0f);
-}
-
-void writeToImageFile(const std::string& filename, std::shared_ptr<unsigned char> data, int nx, int ny) {
-    int rc = stbi_write_png(filename.c_str(), nx, ny, 8, data.get(), sizeof(unsigned char) * nx * 3);
-    if (rc == 0) {
-        std::cout << "Error writing to image : " << filename << std::endl;
+// Camera looking at one of the scenes
+static Camera sceneCamera(const std::string& sceneName, float aspectRatio, float aperture, float focusDistance) {
+    Vec3 eye(13.f, 2.f, 3.f);
+    Vec3 lookat(0.f, 0.f, 0.f);
+    float fov = 20.f;
+    if (sceneName == "cornell") {
+        eye = Vec3(0.f, 1.f, 1.45f);
+        lookat = Vec3(0.f, 0.75f, -1.f);
+        fov = 50.f;
     }
-    else {
-        std::cout << "Successfully written to image :" << filename << std::endl;
+    else if (sceneName == "mesh") {
+        eye = Vec3(3.f, 2.f, 5.f);
+        lookat = Vec3(0.f, 0.9f, 0.f);
+        fov = 30.f;
     }
+    return Camera(eye, lookat, Vec3(0.f, 1.f, 0.f), fov, aspectRatio, aperture, focusDistance);
 }
 
-void initRandomScene(pcg32& rng, ShapeList& list, int nSpheres) {
-    list.mObjects.resize(nSpheres);
-    list.mObjects[0] = std::shared_ptr<Shape>(new Sphere(Vec3(0.f, -1000.f, 0.f), 1000.f, std::shared_ptr<Material>(new Lambertian(Vec3(0.5f)))));
-    int i = 1;
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            float chooseMat = (float)rng.nextDouble();
-            Vec3 center(a + 0.9f * (float)rng.nextDouble(), 0.2f, b + 0.9f * (float)rng.nextDouble());
-            if ((center - Vec3(4.0f, 0.2f, 0.f)).length() > 0.9) {
-                if (chooseMat < 0.8f) {
-                    // diffuse spheres
-                    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(center,
-                        0.2f, std::shared_ptr<Material>(
-                            new Lambertian(Vec3((float)(rng.nextDouble() * rng.nextDouble()),
-                                                (float)(rng.nextDouble() * rng.nextDouble()),
-                                                (float)(rng.nextDouble() * rng.nextDouble())
-                            )))));
-                } else if (chooseMat < 0.95f) {
-                    // metal
-                    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(center,
-                        0.2f, std::shared_ptr<Material>(
-                            new Metal(Vec3(
-                                0.5f * (1.0f + (float)rng.nextDouble()),
-                                0.5f * (1.0f + (float)rng.nextDouble()),
-                                0.5f * (1.0f + (float)rng.nextDouble())
-                            )))));
-                } else {
-                    // glass
-                    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(center,
-                        0.2f, std::shared_ptr<Material>(
-                            new Dielectric(1.5f))));
-                }
-            }
-        }
-    }
-    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(Vec3(0.f, 1.f, 0.f), 1.f, std::shared_ptr<Material>(new Dielectric(1.5f))));
-    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(Vec3(-4.f, 1.f, 0.f), 1.f, std::shared_ptr<Material>(new Lambertian(Vec3(0.4f, 0.2f, 0.1f)))));
-    list.mObjects[i++] = std::shared_ptr<Shape>(new Sphere(Vec3(4.f, 1.f, 0.f), 1.f, std::shared_ptr<Material>(new Metal(Vec3(0.7f, 0.6f, 0.5f), 0.0f))));
+// A frame of the PGO training workload in a scene of its own, rendered by the tile
+// renderer without and with packets and by the wavefront renderer
+static void renderTrainingFrame(const std::string& name, const Scene& scene, const Camera& camera, int nx, int ny, int ns,
+    int maxDepth, int rrDepth, Sampler& sampler, ThreadPool& pool) {
+    Timer timer;
+    BVH bvh(scene.shapes);
+    PathIntegrator integrator(maxDepth, rrDepth, scene.lightList());
+    TileRenderer renderer(nx, ny, ns);
+    WavefrontRenderer wavefront(nx, ny, ns);
+    Framebuffer framebuffer(nx, ny);
+    dispatchKernel(camera, !integrator.lights.empty(), [&](auto traits) {
+        typedef decltype(traits) Traits;
+        renderer.render<Traits>(camera, bvh, integrator, sampler, pool, framebuffer);
+        renderer.setUsePackets(true);
+        renderer.render<Traits>(camera, bvh, integrator, sampler, pool, framebuffer);
+        wavefront.render<Traits>(camera, bvh, integrator, sampler, pool, framebuffer);
+    });
+    std::cout << "Training " << name << " done in " << timer.elapsedSeconds() << "s\n";
 }
 
 int main(int argc, char** argv) {
@@ -95,57 +70,317 @@ int main(int argc, char** argv) {
     int nx = 400;
     int ny = 200;
     int ns = 128;
+    int nThreads = ThreadPool::defaultThreadCount();
+    int tileSize = 16;
+    bool measureScaling = false;
+    std::string accel = "bvh";
+    bool usePackets = false;
+    bool useWavefront = false;
+    int queueSize = 1 << 17;
+    int maxDepth = 50;
+    int rrDepth = 5;
+    int nSpheres = 500;
+    std::string sceneName = "random";
+    std::string meshFile;
+    std::string cacheDir;
+    bool useAdaptive = false;
+    float noise = 0.01f;
+    int minSpp = 16;
+    int maxSpp = 0;
+    std::string samplerName = "sobol";
+    std::string outputFile = "out.ppm";
+    std::string formatName;
+    std::string statsFile;
+    bool pgoTrain = false;
+
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--width") && a + 1 < argc) nx = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--height") && a + 1 < argc) ny = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--spp") && a + 1 < argc) ns = std::atoi(argv[++a]);
+        else if ((!strcmp(argv[a], "-t") || !strcmp(argv[a], "--threads")) && a + 1 < argc) nThreads = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--tile-size") && a + 1 < argc) tileSize = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--scaling")) measureScaling = true;
+        else if (!strcmp(argv[a], "--packets")) usePackets = true;
+        else if (!strcmp(argv[a], "--wavefront")) useWavefront = true;
+        else if (!strcmp(argv[a], "--queue-size") && a + 1 < argc) queueSize = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--max-depth") && a + 1 < argc) maxDepth = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rr-depth") && a + 1 < argc) rrDepth = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--spheres") && a + 1 < argc) nSpheres = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--scene") && a + 1 < argc) {
+            sceneName = argv[++a];
+            if (sceneName != "random" && sceneName != "cornell" && sceneName != "mesh") {
+                std::cout << "Unknown scene : " << sceneName << "\n";
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "--mesh") && a + 1 < argc) meshFile = argv[++a];
+        else if (!strcmp(argv[a], "--scene-cache") && a + 1 < argc) cacheDir = argv[++a];
+        else if (!strcmp(argv[a], "--sampler") && a + 1 < argc) samplerName = argv[++a];
+        else if (!strcmp(argv[a], "--adaptive")) useAdaptive = true;
+        else if (!strcmp(argv[a], "--noise") && a + 1 < argc) noise = (float)std::atof(argv[++a]);
+        else if (!strcmp(argv[a], "--min-spp") && a + 1 < argc) minSpp = std::atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--max-spp") && a + 1 < argc) maxSpp = std::atoi(argv[++a]);
+        else if ((!strcmp(argv[a], "-o") || !strcmp(argv[a], "--output")) && a + 1 < argc) outputFile = argv[++a];
+        else if (!strcmp(argv[a], "--format") && a + 1 < argc) formatName = argv[++a];
+        else if (!strcmp(argv[a], "--stats") && a + 1 < argc) statsFile = argv[++a];
+        else if (!strcmp(argv[a], "--pgo-train")) pgoTrain = true;
+        else if (!strcmp(argv[a], "--accel") && a + 1 < argc) {
+            accel = argv[++a];
+            if (accel != "bvh" && accel != "list" && accel != "soa") {
+                std::cout << "Unknown acceleration structure : " << accel << "\n";
+                return 1;
+            }
+        }
+        else {
+            std::cout << "Usage : " << argv[0] << " [--width N] [--height N] [--spp N] [-t|--threads N] [--tile-size N] [--scaling]"
+                << " [--scene random|cornell|mesh] [--mesh FILE] [--scene-cache DIR] [--spheres N] [--accel bvh|list|soa] [--packets]"
+                << " [--max-depth N] [--rr-depth N] [--wavefront] [--queue-size N]"
+                << " [--sampler independent|stratified|sobol|bluenoise] [--adaptive] [--noise F] [--min-spp N] [--max-spp N]"
+                << " [-o|--output FILE] [--format ppm|png|pfm] [--stats FILE] [--pgo-train]\n";
+            return 1;
+        }
+    }
+    // Workload of a PGO instrumented build: the random scene at a quarter of the resolution,
+    // so training is quick and still sees the branch and call frequencies of a full frame.
+    // That frame has no lights and a pinhole camera, the lit Cornell box and a torus mesh
+    // seen through a thin lens are trained further down.
+    if (pgoTrain) {
+        sceneName = "random";
+        nx = std::max(nx / 4, 1);
+        ny = std::max(ny / 4, 1);
+    }
+    if (nx < 1 || ny < 1 || ns < 1) {
+        std::cout << "Invalid resolution or sample count\n";
+        return 1;
+    }
+    ImageFormat format = imageFormatFromFilename(outputFile);
+    if (!formatName.empty() && !imageFormatFromName(formatName, format)) {
+        std::cout << "Unknown image format : " << formatName << "\n";
+        return 1;
+    }
+    std::unique_ptr<Sampler> sampler = createSampler(samplerName, ns);
+    if (!sampler) {
+        std::cout << "Unknown sampler : " << samplerName << "\n";
+        return 1;
+    }
+    if (sceneName == "mesh" && meshFile.empty()) {
+        std::cout << "The mesh scene needs --mesh FILE\n";
+        return 1;
+    }
+    if (nThreads < 1) nThreads = 1;
+    if (tileSize < 1) tileSize = 1;
+#if !defined(RT_STATS)
+    if (!statsFile.empty()) std::cout << "Built without RT_STATS, no statistics are written\n";
+#endif
 
     pcg32 rng;
     rng.seed(42u, 64u);
 
-    // create an output file
-    std::ofstream outfile("out.ppm");
-    outfile << "P3\n" << nx << " " << ny << "\n255\n";      // header for the pfm file
-
     bool createRandomScene = true;
 
+#if defined(RT_STATS)
+    FrameTimes frameTimes;
+    Timer sceneTimer;
+#endif
+
+    // A compiled scene from an earlier run replaces creating the scene and building its BVH.
+    // The key covers every option the scene depends on.
+    const int maxPrimsInNode = BVH::DefaultMaxPrimsInNode;
+    Scene scene;
+    SceneCache cache;
+    bool cacheHit = false;
+    std::string cacheFile;
+    SceneCacheKey cacheKey;
+    if (!cacheDir.empty()) {
+        if (accel != "bvh") {
+            std::cout << "The scene cache holds a BVH, ignoring it for --accel " << accel << "\n";
+        } else {
+            cacheKey.add(sceneName).add(maxPrimsInNode);
+            if (sceneName == "random") cacheKey.add(nSpheres);
+            if (sceneName == "mesh") cacheKey.add(meshFile).addFile(meshFile);
+            cacheFile = cacheDir + "/" + cacheKey.filename();
+            std::string error;
+            Timer cacheTimer;
+            cacheHit = cache.open(cacheFile, cacheKey.value(), scene, error);
+            if (cacheHit) std::cout << "Opened scene cache " << cacheFile << " (" << cache.fileSize() / 1024 << "KB, "
+                << cache.numNodes() << " nodes) in " << cacheTimer.elapsedMilliseconds() << "ms\n";
+            else std::cout << "Scene cache miss : " << error << "\n";
+        }
+    }
+
     // create a world
-    ShapeList list;
-    if (!createRandomScene) {
-        list.mObjects.resize(4);
-        list.mObjects[0] = std::shared_ptr<Shape>(new Sphere(Vec3(0.0f, 0.0f, -1.0f), 0.5f, std::shared_ptr<Material>(new Lambertian(Vec3(0.8f, 0.3f, 0.3f)))));
-        list.mObjects[1] = std::shared_ptr<Shape>(new Sphere(Vec3(0.0f, -100.5f, -1.0f), 100.0f, std::shared_ptr<Material>(new Lambertian(Vec3(0.8f, 0.8f, 0.0f)))));
-        list.mObjects[2] = std::shared_ptr<Shape>(new Sphere(Vec3(1.0f, 0.0f, -1.0f), 0.5f, std::shared_ptr<Material>(new Metal(Vec3(0.8f, 0.6f, 0.2f), 1.0f))));
-        list.mObjects[3] = std::shared_ptr<Shape>(new Sphere(Vec3(-1.0f, 0.0f, -1.0f), 0.5f, std::shared_ptr<Material>(new Dielectric(1.5f))));
+    if (!cacheHit) {
+        if (sceneName == "cornell") {
+            initCornellScene(scene);
+        }
+        else if (sceneName == "mesh") {
+            std::unique_ptr<TriangleMesh> mesh(new TriangleMesh());
+            std::string error;
+            ThreadPool loadPool(nThreads);
+            Timer loadTimer;
+            if (!loadMesh(meshFile, *mesh, loadPool, error)) {
+                std::cout << "Error loading mesh : " << error << "\n";
+                return 1;
+            }
+            std::cout << "Loaded " << mesh->numTriangles() << " triangles, " << mesh->positions.size() << " vertices in "
+                << loadTimer.elapsedMilliseconds() << "ms\n";
+            initMeshScene(scene, mesh.release());
+        }
+        else if (!createRandomScene) {
+            scene.addShape<Sphere>(Vec3(0.0f, 0.0f, -1.0f), 0.5f, scene.addMaterial<Lambertian>(Vec3(0.8f, 0.3f, 0.3f)));
+            scene.addShape<Sphere>(Vec3(0.0f, -100.5f, -1.0f), 100.0f, scene.addMaterial<Lambertian>(Vec3(0.8f, 0.8f, 0.0f)));
+            scene.addShape<Sphere>(Vec3(1.0f, 0.0f, -1.0f), 0.5f, scene.addMaterial<Metal>(Vec3(0.8f, 0.6f, 0.2f), 1.0f));
+            scene.addShape<Sphere>(Vec3(-1.0f, 0.0f, -1.0f), 0.5f, scene.addMaterial<Dielectric>(1.5f));
+        }
+        else {
+            initRandomScene(rng, scene, nSpheres);
+        }
     }
-    else {
-        initRandomScene(rng, list, 500);
+    const ShapeList& list = scene.shapes;
+#if defined(RT_STATS)
+    frameTimes.sceneSeconds = sceneTimer.elapsedSeconds();
+    Timer accelTimer;
+#endif
+
+    // build the acceleration structure over the scene
+    std::unique_ptr<BVH> bvh;
+    SphereSoA spheres;
+    const Shape* world = &list;
+    if (cacheHit) world = &cache;
+    else if (accel == "soa") {
+        if (spheres.build(list)) world = &spheres;
+        else {
+            std::cout << "Scene contains shapes other than spheres, using a BVH instead\n";
+            accel = "bvh";
+        }
+    }
+    if (!cacheHit && accel == "bvh") {
+        Timer buildTimer;
+        bvh.reset(new BVH(list, maxPrimsInNode));
+        std::cout << "Built BVH over " << list.mObjects.size() << " objects with " << bvh->numNodes()
+            << " nodes in " << buildTimer.elapsedMilliseconds() << "ms\n";
+        world = bvh.get();
+        if (!cacheFile.empty()) {
+            std::string error;
+            Timer writeTimer;
+            if (writeSceneCache(cacheFile, cacheKey.value(), scene, *bvh, error))
+                std::cout << "Written scene cache " << cacheFile << " in " << writeTimer.elapsedMilliseconds() << "ms\n";
+            else std::cout << "Scene cache not written : " << error << "\n";
+        }
     }
 
+#if defined(RT_STATS)
+    frameTimes.accelSeconds = accelTimer.elapsedSeconds();
+#endif
+
     // Create a crude camera
-    Vec3 eye(13.f, 2.f, 3.f);
-    Vec3 lookat(0.f, 0.f, 0.f);
     float focalDistance = 10.f;
     float aperture = 0.0f;
-    Camera camera(eye, lookat, Vec3(0.f, 1.f, 0.f), 20.f, float(nx)/float(ny), aperture,  0.9f * focalDistance);
+    Camera camera = sceneCamera(sceneName, float(nx)/float(ny), aperture, 0.9f * focalDistance);
+
+    PathIntegrator integrator(maxDepth, rrDepth, scene.lightList());
+    TileRenderer renderer(nx, ny, ns, tileSize);
+    renderer.setUsePackets(usePackets);
+    WavefrontRenderer wavefront(nx, ny, ns, queueSize);
+    AdaptiveRenderer adaptive(nx, ny, ns, noise, minSpp, maxSpp);
+    Framebuffer framebuffer(nx, ny);
+    // the lens and the lights are fixed for the job, pick the kernel specialized for them
+    auto renderFrame = [&](ThreadPool& pool) {
+        dispatchKernel(camera, !integrator.lights.empty(), [&](auto traits) {
+            typedef decltype(traits) Traits;
+            if (useAdaptive) adaptive.render<Traits>(camera, *world, integrator, *sampler, pool, framebuffer);
+            else if (useWavefront) wavefront.render<Traits>(camera, *world, integrator, *sampler, pool, framebuffer);
+            else renderer.render<Traits>(camera, *world, integrator, *sampler, pool, framebuffer);
+        });
+    };
+
+    // render the same frame with 1, 2, 4 .. nThreads threads and report the speedup over one thread
+    if (measureScaling) {
+        double singleThreadTime = 0.0;
+        for (int t = 1; ; t = (t * 2 < nThreads) ? t * 2 : nThreads) {
+            ThreadPool pool(t);
+            Timer timer;
+            renderFrame(pool);
+            double elapsed = timer.elapsedSeconds();
+            if (t == 1) singleThreadTime = elapsed;
+            double speedup = singleThreadTime / elapsed;
+            std::cout << "Threads : " << t << " Time : " << elapsed << "s Speedup : " << speedup
+                << " Efficiency : " << 100.0 * speedup / t << "%\n";
+            if (t == nThreads) break;
+        }
+    }
+
+    // every renderer gets a profile, not only the one of the final frame
+    if (pgoTrain) {
+        ThreadPool pool(nThreads);
+        bool packets = usePackets, wave = useWavefront, adapt = useAdaptive;
+        const char* modes[] = { "packets", "wavefront", "adaptive" };
+        for (int m = 0; m < 3; m++) {
+            renderer.setUsePackets(m == 0);
+            useWavefront = m == 1;
+            useAdaptive = m == 2;
+            Timer timer;
+            renderFrame(pool);
+            std::cout << "Training " << modes[m] << " done in " << timer.elapsedSeconds() << "s\n";
+        }
+        renderer.setUsePackets(packets);
+        useWavefront = wave;
+        useAdaptive = adapt;
+
+        // the light sampling kernel, quads and sphere lights. No path leaves the closed box,
+        // a quarter of the samples cost about as much as the random scene.
+        Scene cornell;
+        initCornellScene(cornell);
+        renderTrainingFrame("cornell", cornell, sceneCamera("cornell", float(nx) / float(ny), 0.f, 0.9f * focalDistance),
+            nx, ny, std::max(ns / 4, 1), maxDepth, rrDepth, *sampler, pool);
+        // the thin lens kernel and triangles
+        Scene torus;
+        initMeshScene(torus, createTorusMesh(256, 128));
+        renderTrainingFrame("mesh", torus, sceneCamera("mesh", float(nx) / float(ny), 0.1f, 5.9f),
+            nx, ny, ns, maxDepth, rrDepth, *sampler, pool);
+    }
 
     // perform the actual raytracing
-    std::cout << "Tracing starting...\n";
-    for (int j = ny - 1; j >= 0; j--) {
-        for (int i = 0; i < nx; i++) {
-            Vec3 col(0.f);
-            for (int s = 0; s < ns; s++) {
-                float u = (float(i + rng.nextDouble()) / float(nx));
-                float v = (float(j + rng.nextDouble()) / float(ny));
-                Ray r = camera.generateRay(u, v, rng);
-                col += color(r, list, rng, 0);
-            }
-            // gamma correction
-            col /= float(ns);
-            col = Vec3(sqrt(col.x()), sqrt(col.y()), sqrt(col.z()));
-            int ir = int(255.99 * col.r());
-            int ig = int(255.99 * col.g());
-            int ib = int(255.99 * col.b());
-            outfile << ir << " " << ig << " " << ib << "\n";
+    if (useAdaptive) std::cout << "Adaptive tracing starting with " << nThreads << " threads, noise " << noise << "...\n";
+    else if (useWavefront) std::cout << "Wavefront tracing starting with " << nThreads << " threads...\n";
+    else std::cout << "Tracing starting with " << nThreads << " threads, " << renderer.numTiles() << " tiles...\n";
+    ThreadPool pool(nThreads);
+#if defined(RT_STATS)
+    // only the final frame, not the scaling runs
+    resetStats();
+#endif
+    Timer timer;
+    renderFrame(pool);
+    std::cout << "Tracing done in " << timer.elapsedSeconds() << "s\n";
+#if defined(RT_STATS)
+    frameTimes.renderSeconds = timer.elapsedSeconds();
+    RenderStats stats = mergeStats();
+    long long rays = stats.primaryRays + stats.secondaryRays + stats.shadowRays;
+    std::cout << "Rays : " << rays << " (" << rays / frameTimes.renderSeconds * 1e-6 << " Mrays/s) Candidate hits : "
+        << stats.candidateHits << " Surfaces computed : " << stats.surfaces << "\n";
+#endif
+    if (useAdaptive) {
+        std::cout << "Average spp : " << double(adaptive.totalSamples()) / (nx * ny) << " Converged pixels : "
+            << 100.0 * adaptive.convergedPixels() / (nx * ny) << "%\n";
+    }
+
+    Timer writeTimer;
+    if (!writeImage(outputFile, framebuffer, format)) {
+        std::cout << "Error writing to image : " << outputFile << "\n";
+        return 1;
+    }
+    std::cout << "Written " << outputFile << " in " << writeTimer.elapsedMilliseconds() << "ms\n";
+#if defined(RT_STATS)
+    frameTimes.writeSeconds = writeTimer.elapsedSeconds();
+    if (!statsFile.empty()) {
+        std::ofstream out(statsFile);
+        writeStatsJSON(out, stats, frameTimes);
+        if (!out) {
+            std::cout << "Error writing statistics : " << statsFile << "\n";
+            return 1;
         }
+        std::cout << "Written statistics to " << statsFile << "\n";
     }
-    std::cout << "Tracing done\n";
-    outfile.close();
+#endif
     return 0;
 }
\ No newline at end of file
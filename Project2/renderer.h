@@ -0,0 +1,132 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#pragma once
+#include "camera.h"
+#include "shape.h"
+#include "integrator.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include "raypacket.h"
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1)
+struct Tile
+{
+    int index;
+    int x0, y0;
+    int x1, y1;
+};
+
+// Splits the image into fixed size tiles that are rendered in parallel by a ThreadPool.
+// Every thread works with its own clone of the sampler. Samplers are addressed by pixel
+// and sample index, so the image does not depend on the number of threads or on the
+// order in which tiles are picked up.
+// With packets enabled the camera rays of RT_SIMD_WIDTH consecutive samples of a pixel
+// are traced together as one RayPacket, the secondary bounces stay scalar.
+// Traits selects the specialized kernel of the camera and integrator, see KernelTraits.
+class TileRenderer
+{
+public:
+    TileRenderer(int nx, int ny, int ns, int tileSize = 16)
+        : mWidth(nx), mHeight(ny), mSamples(ns), mTileSize(tileSize)
+        , mUsePackets(false) {
+        for (int y = 0; y < ny; y += tileSize) {
+            for (int x = 0; x < nx; x += tileSize) {
+                Tile tile;
+                tile.index = (int)mTiles.size();
+                tile.x0 = x;
+                tile.y0 = y;
+                tile.x1 = x + tileSize < nx ? x + tileSize : nx;
+                tile.y1 = y + tileSize < ny ? y + tileSize : ny;
+                mTiles.push_back(tile);
+            }
+        }
+    }
+
+    void setUsePackets(bool usePackets) { mUsePackets = usePackets; }
+
+    template <typename Traits = GenericKernel>
+    void render(const Camera& camera, const Shape& world, const PathIntegrator& integrator, const Sampler& sampler,
+                ThreadPool& pool, Framebuffer& framebuffer) const {
+        std::vector<std::unique_ptr<Sampler>> samplers(pool.size());
+        for (auto& s : samplers) s = sampler.clone();
+        pool.parallelFor((int)mTiles.size(), [&](int tileIndex, int threadId) {
+            renderTile<Traits>(mTiles[tileIndex], camera, world, integrator, *samplers[threadId], framebuffer);
+        });
+    }
+
+    template <typename Traits = GenericKernel>
+    void renderTile(const Tile& tile, const Camera& camera, const Shape& world, const PathIntegrator& integrator,
+                    Sampler& sampler, Framebuffer& framebuffer) const {
+        for (int j = tile.y1 - 1; j >= tile.y0; j--) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                if (mUsePackets) {
+                    framebuffer(i, j) = renderPixelPackets<Traits>(i, j, camera, world, integrator, sampler);
+                    continue;
+                }
+                Vec3 col(0.f);
+                for (int s = 0; s < mSamples; s++) {
+                    sampler.startPixelSample(i, j, s);
+                    Point2f p = sampler.get2D();
+                    float u = (float(i + p.x) / float(mWidth));
+                    float v = (float(j + p.y) / float(mHeight));
+                    Ray r = camera.generateRay(u, v, sampler, typename Traits::Lens());
+                    col += integrator.Li<Traits>(r, world, sampler);
+                }
+                framebuffer(i, j) = col / float(mSamples);
+            }
+        }
+    }
+
+    template <typename Traits = GenericKernel>
+    Vec3 renderPixelPackets(int i, int j, const Camera& camera, const Shape& world, const PathIntegrator& integrator,
+                            Sampler& sampler) const {
+        Vec3 col(0.f);
+        for (int s = 0; s < mSamples; s += RT_SIMD_WIDTH) {
+            int n = mSamples - s < RT_SIMD_WIDTH ? mSamples - s : RT_SIMD_WIDTH;
+            Ray rays[RT_SIMD_WIDTH];
+            int dimensions[RT_SIMD_WIDTH];
+            RayPacket packet;
+            for (int k = 0; k < RT_SIMD_WIDTH; k++) {
+                if (k < n) {
+                    sampler.startPixelSample(i, j, s + k);
+                    Point2f p = sampler.get2D();
+                    float u = (float(i + p.x) / float(mWidth));
+                    float v = (float(j + p.y) / float(mHeight));
+                    rays[k] = camera.generateRay(u, v, sampler, typename Traits::Lens());
+                    dimensions[k] = sampler.dimension();
+                } else {
+                    // inactive lanes still need a valid ray for the vector math
+                    rays[k] = rays[0];
+                }
+                packet.set(k, rays[k]);
+            }
+            PacketHitRecord hits(FLT_MAX);
+            RT_STATS_ADD(primaryRays, n);
+            vmask hitMask = world.intersect(packet, 0.001f, firstLanes(n), hits);
+            // resume every sample where its camera ray left off
+            for (int k = 0; k < n; k++) {
+                sampler.startPixelSample(i, j, s + k, dimensions[k]);
+                col += integrator.Li<Traits>(rays[k], hitMask[k], hits.records[k], world, sampler);
+            }
+        }
+        return col / float(mSamples);
+    }
+
+    int numTiles() const { return (int)mTiles.size(); }
+
+private:
+    int mWidth;
+    int mHeight;
+    int mSamples;
+    int mTileSize;
+    bool mUsePackets;
+    std::vector<Tile> mTiles;
+};
+
+#endif
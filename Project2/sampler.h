@@ -0,0 +1,375 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#pragma once
+#include "pcg32.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Point2f
+{
+    Point2f() : x(0.f), y(0.f) {}
+    Point2f(float x, float y) : x(x), y(y) {}
+    float x, y;
+};
+
+// largest float below one
+static const float OneMinusEpsilon = 0.99999994f;
+
+inline uint64_t mixBits(uint64_t v) {
+    v ^= v >> 31;
+    v *= 0x7fb5d329728ea185ULL;
+    v ^= v >> 27;
+    v *= 0x81dadef4bc2dd44dULL;
+    v ^= v >> 33;
+    return v;
+}
+
+inline uint64_t hashCombine(uint64_t a, uint64_t b) {
+    return mixBits(a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2)));
+}
+
+// [0, 1) float from the 32 bits of a fixed point fraction
+inline float uintToFloat(uint32_t v) {
+    return std::min(float(v) * 2.3283064365386963e-10f, OneMinusEpsilon);
+}
+
+inline uint32_t reverseBits(uint32_t v) {
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ffu) << 8) | ((v & 0xff00ff00u) >> 8);
+    v = ((v & 0x0f0f0f0fu) << 4) | ((v & 0xf0f0f0f0u) >> 4);
+    v = ((v & 0x33333333u) << 2) | ((v & 0xccccccccu) >> 2);
+    v = ((v & 0x55555555u) << 1) | ((v & 0xaaaaaaaau) >> 1);
+    return v;
+}
+
+// Second dimension of the Sobol sequence, the first one is reverseBits(index)
+inline uint32_t sobol1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        if (index & 1) result ^= v;
+    return result;
+}
+
+// Owen scrambling with a hash, from Burley, "Practical Hash-based Owen Scrambling", JCGT 2020
+inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Element i of a random permutation of [0, n) selected by seed, from Kensler,
+// "Correlated Multi-Jittered Sampling", 2013
+inline uint32_t permutationElement(uint32_t i, uint32_t n, uint32_t seed) {
+    uint32_t w = n - 1;
+    w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+    do {
+        i ^= seed; i *= 0xe170893du;
+        i ^= seed >> 16; i ^= (i & w) >> 4;
+        i ^= seed >> 8; i *= 0x0929eb3fu;
+        i ^= seed >> 23; i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27; i *= 0x6935fa69u;
+        i ^= (i & w) >> 11; i *= 0x74dcb303u;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + seed) % n;
+}
+
+// Source of the random numbers of one camera path. A path starts with
+// startPixelSample() and then draws its dimensions one after the other with get1D() and
+// get2D(): first the pixel position, then the lens, then the bounces. Every sampler is
+// random access, so sample `index` of a pixel is the same no matter which thread or
+// tile computes it, and a suspended path resumes by passing its saved dimension().
+// Samplers hold per path state; renderers clone() one per thread.
+class Sampler
+{
+public:
+    explicit Sampler(uint64_t seed) : mSeed(seed), mX(0), mY(0), mIndex(0), mDimension(0) {}
+    virtual ~Sampler() {}
+
+    virtual void startPixelSample(int x, int y, int index, int dimension = 0) {
+        mX = x;
+        mY = y;
+        mIndex = index;
+        mDimension = dimension;
+    }
+    virtual float get1D() = 0;
+    virtual Point2f get2D() = 0;
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    // Moves past a 2D sample without computing it, the following samples are the same as
+    // after get2D()
+    virtual void skip2D() { mDimension++; }
+
+    int dimension() const { return mDimension; }
+
+protected:
+    uint64_t pixelHash() const { return hashCombine(hashCombine(mSeed, (uint64_t)mX), (uint64_t)mY); }
+
+    uint64_t mSeed;
+    int mX, mY;
+    int mIndex;
+    int mDimension;
+};
+
+// Independent uniform random numbers, the plain Monte Carlo baseline. Every pixel sample
+// seeds its own pcg32 stream, dimension() counts the numbers drawn from it.
+class IndependentSampler : public Sampler
+{
+public:
+    explicit IndependentSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+    void startPixelSample(int x, int y, int index, int dimension = 0) {
+        Sampler::startPixelSample(x, y, index, dimension);
+        mRng.seed(hashCombine(pixelHash(), (uint64_t)index), mSeed);
+        if (dimension > 0) mRng.advance(dimension);
+    }
+    float get1D() {
+        mDimension++;
+        return mRng.nextFloat();
+    }
+    Point2f get2D() {
+        mDimension += 2;
+        float x = mRng.nextFloat();
+        return Point2f(x, mRng.nextFloat());
+    }
+    void skip2D() {
+        mDimension += 2;
+        mRng.nextUInt();
+        mRng.nextUInt();
+    }
+    std::unique_ptr<Sampler> clone() const { return std::unique_ptr<Sampler>(new IndependentSampler(*this)); }
+
+private:
+    pcg32 mRng;
+};
+
+// Jittered stratification. The samples of a pixel fall into spp strata in 1D and a
+// sqrt(spp) x spp / sqrt(spp) grid in 2D, visited in a random order per pixel and
+// dimension. Works best when the pixel is rendered with exactly spp samples.
+class StratifiedSampler : public Sampler
+{
+public:
+    StratifiedSampler(int spp, uint64_t seed = 0) : Sampler(seed) {
+        mStrata = std::max(spp, 1);
+        mStrataX = std::max((int)std::sqrt((float)mStrata), 1);
+        mStrataY = mStrata / mStrataX;
+    }
+
+    float get1D() {
+        uint64_t h = hashCombine(pixelHash(), (uint64_t)mDimension++);
+        int n = mStrata;
+        // a new permutation for every round of n samples
+        uint32_t s = permutationElement((uint32_t)(mIndex % n), (uint32_t)n, (uint32_t)hashCombine(h, mIndex / n));
+        float jitter = uintToFloat((uint32_t)hashCombine(h, mIndex));
+        return std::min((s + jitter) / n, OneMinusEpsilon);
+    }
+    Point2f get2D() {
+        uint64_t h = hashCombine(pixelHash(), (uint64_t)mDimension++);
+        int n = mStrataX * mStrataY;
+        uint32_t s = permutationElement((uint32_t)(mIndex % n), (uint32_t)n, (uint32_t)hashCombine(h, mIndex / n));
+        float jx = uintToFloat((uint32_t)hashCombine(h, mIndex));
+        float jy = uintToFloat((uint32_t)(hashCombine(h, mIndex) >> 32));
+        return Point2f(std::min((s % mStrataX + jx) / mStrataX, OneMinusEpsilon),
+                       std::min((s / mStrataX + jy) / mStrataY, OneMinusEpsilon));
+    }
+    std::unique_ptr<Sampler> clone() const { return std::unique_ptr<Sampler>(new StratifiedSampler(*this)); }
+
+private:
+    int mStrata;
+    int mStrataX, mStrataY;
+};
+
+// Owen scrambled Sobol points. Every dimension (pair) shuffles the sample index with a
+// nested uniform scramble before indexing the first two Sobol dimensions, which keeps
+// the points of each dimension well distributed while decorrelating the dimensions
+// from each other. Any prefix of a power of two samples is stratified.
+class SobolSampler : public Sampler
+{
+public:
+    explicit SobolSampler(uint64_t seed = 0) : Sampler(seed) {}
+
+    float get1D() {
+        uint64_t h = hashCombine(pixelHash(), (uint64_t)mDimension++);
+        uint32_t index = nestedUniformScramble((uint32_t)mIndex, (uint32_t)h);
+        return uintToFloat(nestedUniformScramble(reverseBits(index), (uint32_t)(h >> 32)));
+    }
+    Point2f get2D() {
+        uint64_t h = hashCombine(pixelHash(), (uint64_t)mDimension++);
+        uint32_t index = nestedUniformScramble((uint32_t)mIndex, (uint32_t)h);
+        uint64_t h2 = mixBits(h);
+        return Point2f(uintToFloat(nestedUniformScramble(reverseBits(index), (uint32_t)(h >> 32))),
+                       uintToFloat(nestedUniformScramble(sobol1(index), (uint32_t)h2)));
+    }
+    std::unique_ptr<Sampler> clone() const { return std::unique_ptr<Sampler>(new SobolSampler(*this)); }
+};
+
+// Tileable 64x64 blue noise threshold map built with Ulichney's void and cluster method.
+// Every value in [0, 1) appears once and neighbouring pixels have very different values.
+class BlueNoiseTile
+{
+public:
+    static const int Size = 64;
+
+    explicit BlueNoiseTile(uint64_t seed = 0) : mValues(Size * Size) { generate(seed); }
+
+    float operator() (int x, int y) const { return mValues[(y & (Size - 1)) * Size + (x & (Size - 1))]; }
+
+private:
+    // Gaussian energy of every pixel over the set pixels, on the torus
+    struct EnergyField
+    {
+        explicit EnergyField(const std::vector<float>& kernel) : kernel(kernel), energy(Size * Size, 0.f) {}
+        void splat(int p, float sign) {
+            int px = p % Size, py = p / Size;
+            for (int y = 0; y < Size; y++) {
+                const float* row = &kernel[((y - py) & (Size - 1)) * Size];
+                float* e = &energy[y * Size];
+                for (int x = 0; x < Size; x++)
+                    e[x] += sign * row[(x - px) & (Size - 1)];
+            }
+        }
+        // extreme energy among the pixels whose bit equals `set`
+        int find(const std::vector<char>& bits, char set, bool largest) const {
+            int best = -1;
+            for (int p = 0; p < Size * Size; p++) {
+                if (bits[p] != set) continue;
+                if (best < 0 || (largest ? energy[p] > energy[best] : energy[p] < energy[best])) best = p;
+            }
+            return best;
+        }
+        const std::vector<float>& kernel;
+        std::vector<float> energy;
+    };
+
+    void generate(uint64_t seed) {
+        const int n = Size * Size;
+        const float sigma = 1.5f;
+        std::vector<float> kernel(n);
+        for (int y = 0; y < Size; y++) {
+            for (int x = 0; x < Size; x++) {
+                int dx = std::min(x, Size - x), dy = std::min(y, Size - y);
+                kernel[y * Size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+            }
+        }
+
+        // initial binary pattern, 10% random points relaxed until the tightest cluster
+        // and the largest void coincide
+        pcg32 rng(seed, 0x5eedULL);
+        std::vector<char> initial(n, 0);
+        EnergyField field(kernel);
+        int ones = 0;
+        while (ones < n / 10) {
+            int p = (int)rng.nextUInt((uint32_t)n);
+            if (initial[p]) continue;
+            initial[p] = 1;
+            field.splat(p, 1.f);
+            ones++;
+        }
+        for (;;) {
+            int cluster = field.find(initial, 1, true);
+            initial[cluster] = 0;
+            field.splat(cluster, -1.f);
+            int gap = field.find(initial, 0, false);
+            initial[gap] = 1;
+            field.splat(gap, 1.f);
+            if (gap == cluster) break;
+        }
+
+        std::vector<int> rank(n);
+        // phase 1: remove the tightest clusters of the initial pattern, ranks ones-1 .. 0
+        {
+            std::vector<char> bits(initial);
+            EnergyField e(field);
+            for (int r = ones - 1; r >= 0; r--) {
+                int cluster = e.find(bits, 1, true);
+                bits[cluster] = 0;
+                e.splat(cluster, -1.f);
+                rank[cluster] = r;
+            }
+        }
+        // phase 2: fill the largest voids up to half of the pixels
+        std::vector<char> bits(initial);
+        int r = ones;
+        for (; r < n / 2; r++) {
+            int gap = field.find(bits, 0, false);
+            bits[gap] = 1;
+            field.splat(gap, 1.f);
+            rank[gap] = r;
+        }
+        // phase 3: the zeros are the minority now, fill their tightest clusters
+        EnergyField zeros(kernel);
+        for (int p = 0; p < n; p++)
+            if (!bits[p]) zeros.splat(p, 1.f);
+        for (; r < n; r++) {
+            int cluster = zeros.find(bits, 0, true);
+            bits[cluster] = 1;
+            zeros.splat(cluster, -1.f);
+            rank[cluster] = r;
+        }
+
+        for (int p = 0; p < n; p++) mValues[p] = (rank[p] + 0.5f) / n;
+    }
+
+    std::vector<float> mValues;
+};
+
+// Owen scrambled Sobol points that are the same for every pixel, Cranley-Patterson
+// rotated by a blue noise value that depends on the pixel. The error left at low sample
+// counts is then distributed as blue noise over the image instead of white noise. Each
+// dimension uses its own scramble and reads the tile at its own offset, both shared by
+// all pixels so neighbouring pixels keep their blue noise relationship.
+class BlueNoiseSampler : public Sampler
+{
+public:
+    explicit BlueNoiseSampler(uint64_t seed = 0)
+        : Sampler(seed), mTile(std::make_shared<BlueNoiseTile>(seed)) {}
+
+    float get1D() {
+        uint64_t h = hashCombine(mSeed, (uint64_t)mDimension++);
+        uint32_t index = nestedUniformScramble((uint32_t)mIndex, (uint32_t)h);
+        float x = uintToFloat(nestedUniformScramble(reverseBits(index), (uint32_t)(h >> 32)));
+        return wrap(x + rotation(h));
+    }
+    Point2f get2D() {
+        uint64_t h = hashCombine(mSeed, (uint64_t)mDimension++);
+        uint32_t index = nestedUniformScramble((uint32_t)mIndex, (uint32_t)h);
+        uint64_t h2 = mixBits(h);
+        float x = uintToFloat(nestedUniformScramble(reverseBits(index), (uint32_t)(h >> 32)));
+        float y = uintToFloat(nestedUniformScramble(sobol1(index), (uint32_t)h2));
+        return Point2f(wrap(x + rotation(h2)), wrap(y + rotation(mixBits(h2))));
+    }
+    std::unique_ptr<Sampler> clone() const { return std::unique_ptr<Sampler>(new BlueNoiseSampler(*this)); }
+
+private:
+    float rotation(uint64_t h) const { return (*mTile)(mX + (int)(h >> 52), mY + (int)(h >> 58)); }
+    static float wrap(float v) { return std::min(v >= 1.f ? v - 1.f : v, OneMinusEpsilon); }
+
+    std::shared_ptr<const BlueNoiseTile> mTile;
+};
+
+// Creates a sampler by name: independent, stratified, sobol or bluenoise. Returns null
+// for unknown names.
+inline std::unique_ptr<Sampler> createSampler(const std::string& name, int spp, uint64_t seed = 0) {
+    if (name == "independent") return std::unique_ptr<Sampler>(new IndependentSampler(seed));
+    if (name == "stratified") return std::unique_ptr<Sampler>(new StratifiedSampler(spp, seed));
+    if (name == "sobol") return std::unique_ptr<Sampler>(new SobolSampler(seed));
+    if (name == "bluenoise") return std::unique_ptr<Sampler>(new BlueNoiseSampler(seed));
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#pragma once
+#include "shape.h"
+#include "material.h"
+#include "light.h"
+#include "mesh.h"
+#include "pcg32.h"
+#include "arena.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Owns the materials, lights and shapes of a scene. They are created in arenas, one per
+// concrete type, so for example all spheres lie next to each other in memory instead of
+// being spread over the heap between control blocks. Shapes, hit records and the
+// integrator only refer to them through raw pointers, which stay valid for the lifetime
+// of the scene, so no reference counts are touched while rendering.
+class Scene
+{
+public:
+    Scene() {}
+    Scene(const Scene&) = delete;
+    Scene& operator= (const Scene&) = delete;
+
+    // an object owned by the scene that is not added to any of the lists
+    template <typename T, typename... Args>
+    T* create(Args&&... args) { return arena<T>().template create<T>(std::forward<Args>(args)...); }
+
+    template <typename T, typename... Args>
+    const T* addMaterial(Args&&... args) {
+        T* material = create<T>(std::forward<Args>(args)...);
+        materials.push_back(material);
+        return material;
+    }
+
+    template <typename T, typename... Args>
+    const T* addShape(Args&&... args) {
+        T* shape = create<T>(std::forward<Args>(args)...);
+        shapes.mObjects.push_back(shape);
+        return shape;
+    }
+
+    // also adds the emitting surface of the light to the shapes
+    template <typename T, typename... Args>
+    const T* addLight(Args&&... args) {
+        T* light = create<T>(std::forward<Args>(args)...);
+        lights.push_back(light);
+        shapes.mObjects.push_back(light->createShape(mLightShapes, addMaterial<Emissive>(light->radiance, light)));
+        return light;
+    }
+
+    // takes ownership of the mesh and adds one shape per triangle
+    const TriangleMesh* addMesh(TriangleMesh* mesh, const Material* material) {
+        meshes.push_back(std::unique_ptr<TriangleMesh>(mesh));
+        mesh->material = material;
+        shapes.mObjects.reserve(shapes.mObjects.size() + mesh->numTriangles());
+        for (int i = 0; i < mesh->numTriangles(); i++) addShape<Triangle>(mesh, i);
+        return mesh;
+    }
+
+    // the lights for PathIntegrator
+    const std::vector<const Light*>& lightList() const { return lights; }
+
+    // bytes taken by the objects in the arenas
+    size_t arenaBytes() const {
+        size_t bytes = mLightShapes.bytesUsed();
+        for (auto& a : mArenas)
+            if (a) bytes += a->bytesUsed();
+        return bytes;
+    }
+
+    ShapeList shapes;
+    std::vector<const Material*> materials;
+    std::vector<const Light*> lights;
+    std::vector<std::unique_ptr<TriangleMesh>> meshes;
+
+private:
+    // small dense ids for the types that have an arena
+    static int nextTypeId() {
+        static std::atomic<int> next(0);
+        return next++;
+    }
+    template <typename T>
+    static int typeId() {
+        static const int id = nextTypeId();
+        return id;
+    }
+
+    template <typename T>
+    Arena& arena() {
+        int id = typeId<T>();
+        if (id >= (int)mArenas.size()) mArenas.resize(id + 1);
+        if (!mArenas[id]) mArenas[id].reset(new Arena());
+        return *mArenas[id];
+    }
+
+    std::vector<std::unique_ptr<Arena>> mArenas;
+    Arena mLightShapes;
+};
+
+// Bump when a scene below changes, cached scenes are keyed on it
+static const uint32_t SceneGeneratorVersion = 1;
+
+inline void initRandomScene(pcg32& rng, Scene& scene, int nSpheres) {
+    // the small spheres are placed on a grid that grows with the requested sphere count
+    int gridHalf = std::max(11, (int)(std::sqrt((float)nSpheres) * 0.5f));
+    scene.shapes.mObjects.reserve(4 * gridHalf * gridHalf + 4);
+    scene.materials.reserve(4 * gridHalf * gridHalf + 4);
+    scene.addShape<Sphere>(Vec3(0.f, -1000.f, 0.f), 1000.f, scene.addMaterial<Lambertian>(Vec3(0.5f)));
+    for (int a = -gridHalf; a < gridHalf; a++) {
+        for (int b = -gridHalf; b < gridHalf; b++) {
+            float chooseMat = (float)rng.nextDouble();
+            Vec3 center(a + 0.9f * (float)rng.nextDouble(), 0.2f, b + 0.9f * (float)rng.nextDouble());
+            if ((center - Vec3(4.0f, 0.2f, 0.f)).length() > 0.9) {
+                if (chooseMat < 0.8f) {
+                    // diffuse spheres
+                    scene.addShape<Sphere>(center,
+                        0.2f, scene.addMaterial<Lambertian>(
+                            Vec3((float)(rng.nextDouble() * rng.nextDouble()),
+                                 (float)(rng.nextDouble() * rng.nextDouble()),
+                                 (float)(rng.nextDouble() * rng.nextDouble())
+                            )));
+                } else if (chooseMat < 0.95f) {
+                    // metal
+                    scene.addShape<Sphere>(center,
+                        0.2f, scene.addMaterial<Metal>(
+                            Vec3(
+                                0.5f * (1.0f + (float)rng.nextDouble()),
+                                0.5f * (1.0f + (float)rng.nextDouble()),
+                                0.5f * (1.0f + (float)rng.nextDouble())
+                            )));
+                } else {
+                    // glass
+                    scene.addShape<Sphere>(center,
+                        0.2f, scene.addMaterial<Dielectric>(1.5f));
+                }
+            }
+        }
+    }
+    scene.addShape<Sphere>(Vec3(0.f, 1.f, 0.f), 1.f, scene.addMaterial<Dielectric>(1.5f));
+    scene.addShape<Sphere>(Vec3(-4.f, 1.f, 0.f), 1.f, scene.addMaterial<Lambertian>(Vec3(0.4f, 0.2f, 0.1f)));
+    scene.addShape<Sphere>(Vec3(4.f, 1.f, 0.f), 1.f, scene.addMaterial<Metal>(Vec3(0.7f, 0.6f, 0.5f), 0.0f));
+}
+
+// Closed box lit by a quad light under the ceiling and a small sphere light. The camera
+// sits inside the box in front of the front wall, so no path ever sees the sky.
+inline void initCornellScene(Scene& scene) {
+    const Material* white = scene.addMaterial<Lambertian>(Vec3(0.73f));
+    const Material* red = scene.addMaterial<Lambertian>(Vec3(0.65f, 0.05f, 0.05f));
+    const Material* green = scene.addMaterial<Lambertian>(Vec3(0.12f, 0.45f, 0.15f));
+    // the box spans [-1, 1] x [0, 2] x [-1, 1.5]
+    scene.addShape<Quad>(Vec3(-1.f, 0.f, -1.f), Vec3(2.f, 0.f, 0.f), Vec3(0.f, 0.f, 2.5f), white);   // floor
+    scene.addShape<Quad>(Vec3(-1.f, 2.f, -1.f), Vec3(2.f, 0.f, 0.f), Vec3(0.f, 0.f, 2.5f), white);   // ceiling
+    scene.addShape<Quad>(Vec3(-1.f, 0.f, -1.f), Vec3(2.f, 0.f, 0.f), Vec3(0.f, 2.f, 0.f), white);    // back
+    scene.addShape<Quad>(Vec3(-1.f, 0.f, 1.5f), Vec3(2.f, 0.f, 0.f), Vec3(0.f, 2.f, 0.f), white);    // front
+    scene.addShape<Quad>(Vec3(-1.f, 0.f, -1.f), Vec3(0.f, 2.f, 0.f), Vec3(0.f, 0.f, 2.5f), red);     // left
+    scene.addShape<Quad>(Vec3(1.f, 0.f, -1.f), Vec3(0.f, 2.f, 0.f), Vec3(0.f, 0.f, 2.5f), green);    // right
+    scene.addShape<Sphere>(Vec3(-0.4f, 0.35f, -0.3f), 0.35f, white);
+    scene.addShape<Sphere>(Vec3(0.45f, 0.35f, 0.1f), 0.35f, scene.addMaterial<Metal>(Vec3(0.9f, 0.8f, 0.6f), 0.2f));
+    scene.addShape<Sphere>(Vec3(0.f, 0.3f, 0.6f), 0.3f, scene.addMaterial<Dielectric>(1.5f));
+    // the edges run so that the quad emits downwards
+    scene.addLight<QuadLight>(Vec3(-0.25f, 1.99f, -0.5f), Vec3(0.5f, 0.f, 0.f), Vec3(0.f, 0.f, 0.5f), Vec3(12.f));
+    scene.addLight<SphereLight>(Vec3(-0.7f, 1.2f, -0.7f), 0.05f, Vec3(40.f, 30.f, 15.f));
+}
+
+// A loaded mesh standing on a large diffuse sphere under the sky, scaled to fit in a
+// box of size 2 around the origin.
+inline void initMeshScene(Scene& scene, TriangleMesh* mesh) {
+    scene.addShape<Sphere>(Vec3(0.f, -1000.f, 0.f), 1000.f, scene.addMaterial<Lambertian>(Vec3(0.5f)));
+    mesh->fitTo(Vec3(0.f, 1.f, 0.f), 1.f);
+    scene.addMesh(mesh, scene.addMaterial<Lambertian>(Vec3(0.7f, 0.6f, 0.5f)));
+}
+
+// Torus around the y axis with radii 1 and 0.4 and vertex normals, two triangles for each
+// of rings x sides quads. Stands in for a loaded mesh where no file is at hand.
+inline TriangleMesh* createTorusMesh(int rings, int sides) {
+    TriangleMesh* mesh = new TriangleMesh();
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            float u = 2.f * Pi * i / rings, v = 2.f * Pi * j / sides;
+            float c = 1.f + 0.4f * std::cos(v);
+            mesh->positions.push_back(Vec3(c * std::cos(u), 0.4f * std::sin(v), c * std::sin(u)));
+            mesh->normals.push_back(Vec3(std::cos(v) * std::cos(u), std::sin(v), std::cos(v) * std::sin(u)));
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            int q[4] = { i * sides + j, i * sides + (j + 1) % sides, (i + 1) % rings * sides + (j + 1) % sides,
+                         (i + 1) % rings * sides + j };
+            mesh->indices.insert(mesh->indices.end(), { q[0], q[1], q[2], q[0], q[2], q[3] });
+        }
+    }
+    return mesh;
+}
+
+#endif
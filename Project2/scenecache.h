@@ -0,0 +1,709 @@
+#ifndef __SCENECACHE_H__
+#define __SCENECACHE_H__
+
+#pragma once
+#include "shape.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "material.h"
+#include "light.h"
+#include "scene.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Compiled scene file. Materials, lights, the flattened geometry and the BVH nodes are
+// stored as arrays of plain records at offsets from the start of the file, so a read only
+// mapping of the file is traversed in place: opening a cached scene costs a validation
+// pass instead of parsing the scene and building the hierarchy again.
+//
+// The layout is native to the machine and build that wrote it. The key stored in the
+// header covers the file format, the node layout, the BVH builder, the scene generators
+// and whatever the caller adds to SceneCacheKey; a file whose key does not match is rebuilt.
+
+static const uint32_t SceneCacheVersion = 1;
+static const uint64_t SceneCacheAlignment = 64;
+// entries of the traversal stack, a cached tree with deeper interior nodes is rejected
+static const int SceneCacheStackSize = BVH::TraversalStackSize;
+
+enum SceneCacheSectionId
+{
+    SectionMaterials, SectionLights, SectionSpheres, SectionQuads, SectionTriangles,
+    SectionPositions, SectionNormals, SectionNodes, SectionPrimitives, SceneCacheSectionCount
+};
+
+struct SceneCacheSection
+{
+    uint64_t offset;    // from the start of the file, a multiple of SceneCacheAlignment
+    uint64_t count;
+};
+
+struct SceneCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;
+    uint64_t key;
+    uint64_t fileSize;
+    SceneCacheSection sections[SceneCacheSectionCount];
+};
+
+// Parameters of one material. color is the albedo or emitted radiance, param the metal
+// fuzziness or the index of refraction; light is the light an emitter belongs to or -1.
+struct CachedMaterial
+{
+    int32_t type;       // MaterialType
+    int32_t light;
+    float color[3];
+    float param;
+};
+
+enum CachedLightType
+{
+    CachedSphereLight, CachedQuadLight
+};
+
+// data holds center and radius of sphere lights, corner, edge1 and edge2 of quad lights
+struct CachedLight
+{
+    int32_t type;
+    float radiance[3];
+    float data[9];
+};
+
+struct CachedSphere
+{
+    float center[3];
+    float radius;
+    int32_t material;
+};
+
+struct CachedQuad
+{
+    float corner[3];
+    float edge1[3];
+    float edge2[3];
+    float normal[3];
+    float w[3];
+    int32_t material;
+};
+
+// Vertex indices into the positions and normals sections, which have the same length.
+// Meshes without normals are padded with zero normals and flagged here.
+struct CachedTriangle
+{
+    int32_t v[3];
+    int32_t material;
+    int32_t hasNormals;
+};
+
+struct CachedVector
+{
+    float v[3];
+};
+
+// BVH leaves refer to primitives through 32 bit references, the type in the top two bits
+// and the index into the section of that type below
+enum CachedPrimitiveType
+{
+    CachedSpherePrimitive, CachedQuadPrimitive, CachedTrianglePrimitive
+};
+
+inline uint32_t cachedPrimitive(CachedPrimitiveType type, size_t index) { return ((uint32_t)type << 30) | (uint32_t)index; }
+
+// 64 bit FNV-1a hash of the inputs that determine a scene
+class SceneCacheKey
+{
+public:
+    SceneCacheKey() : mHash(14695981039346656037ULL) {
+        add(SceneCacheVersion);
+        add((uint32_t)sizeof(LinearBVHNode));
+        add((int32_t)BVH::BuildVersion).add((int32_t)BVH::SAHBuckets).add((float)BVH::SAHTraversalCost);
+        add(SceneGeneratorVersion);
+    }
+
+    template <typename T>
+    SceneCacheKey& add(const T& value) { return addBytes(&value, sizeof(T)); }
+    SceneCacheKey& add(const std::string& s) {
+        add((uint64_t)s.size());
+        return addBytes(s.data(), s.size());
+    }
+    SceneCacheKey& add(const char* s) { return add(std::string(s)); }
+
+    // size and modification time of a file, so that editing the file changes the key
+    SceneCacheKey& addFile(const std::string& filename) {
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0) return add((int64_t)-1);
+        add((int64_t)info.st_size);
+        return add((int64_t)info.st_mtime);
+    }
+
+    uint64_t value() const { return mHash; }
+
+    // file name for the key, scene-<16 hex digits>.rtscene
+    std::string filename() const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "scene-%016llx.rtscene", (unsigned long long)mHash);
+        return name;
+    }
+
+private:
+    SceneCacheKey& addBytes(const void* data, size_t size) {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; i++) mHash = (mHash ^ bytes[i]) * 1099511628211ULL;
+        return *this;
+    }
+
+    uint64_t mHash;
+};
+
+// Read only mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : mData(nullptr), mSize(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr) return false;
+        mData = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (mData == nullptr) return false;
+        mSize = (size_t)size.QuadPart;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+            data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+        mData = (const unsigned char*)data;
+        mSize = (size_t)info.st_size;
+#endif
+        return true;
+    }
+
+    void close() {
+        if (mData == nullptr) return;
+#if defined(_WIN32)
+        UnmapViewOfFile(mData);
+#else
+        munmap((void*)mData, mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    const unsigned char* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    const unsigned char* mData;
+    size_t mSize;
+};
+
+// Writes the scene and a BVH built over its shapes. Fails for shapes and materials that
+// have no record type.
+inline bool writeSceneCache(const std::string& filename, uint64_t key, const Scene& scene, const BVH& bvh, std::string& error) {
+    std::unordered_map<const Light*, int> lightIndices;
+    std::vector<CachedLight> lights;
+    for (const Light* l : scene.lights) {
+        CachedLight record;
+        std::memset(&record, 0, sizeof(record));
+        for (int c = 0; c < 3; c++) record.radiance[c] = l->radiance[c];
+        if (const SphereLight* sphere = dynamic_cast<const SphereLight*>(l)) {
+            record.type = CachedSphereLight;
+            for (int c = 0; c < 3; c++) record.data[c] = sphere->center[c];
+            record.data[3] = sphere->radius;
+        } else if (const QuadLight* quad = dynamic_cast<const QuadLight*>(l)) {
+            record.type = CachedQuadLight;
+            for (int c = 0; c < 3; c++) {
+                record.data[c] = quad->corner[c];
+                record.data[3 + c] = quad->edge1[c];
+                record.data[6 + c] = quad->edge2[c];
+            }
+        } else {
+            error = "light type cannot be cached";
+            return false;
+        }
+        lightIndices[l] = (int)lights.size();
+        lights.push_back(record);
+    }
+
+    std::unordered_map<const Material*, int> materialIndices;
+    std::vector<CachedMaterial> materials;
+    for (const Material* m : scene.materials) {
+        CachedMaterial record;
+        std::memset(&record, 0, sizeof(record));
+        record.type = m->type();
+        record.light = -1;
+        const Vec3* color = nullptr;
+        switch (m->type()) {
+        case MaterialLambertian:
+            color = &static_cast<const Lambertian*>(m)->albedo;
+            break;
+        case MaterialMetal:
+            color = &static_cast<const Metal*>(m)->albedo;
+            record.param = static_cast<const Metal*>(m)->fuzziness;
+            break;
+        case MaterialDielectric:
+            record.param = static_cast<const Dielectric*>(m)->eta;
+            break;
+        case MaterialEmissive: {
+            const Emissive* emissive = static_cast<const Emissive*>(m);
+            color = &emissive->radiance;
+            if (emissive->light) {
+                auto it = lightIndices.find(emissive->light);
+                if (it == lightIndices.end()) {
+                    error = "emissive material refers to a light outside the scene";
+                    return false;
+                }
+                record.light = it->second;
+            }
+            break;
+        }
+        default:
+            error = "material type cannot be cached";
+            return false;
+        }
+        if (color)
+            for (int c = 0; c < 3; c++) record.color[c] = (*color)[c];
+        materialIndices[m] = (int)materials.size();
+        materials.push_back(record);
+    }
+    auto materialIndex = [&](const Material* material, int& index) {
+        auto it = materialIndices.find(material);
+        if (it == materialIndices.end()) return false;
+        index = it->second;
+        return true;
+    };
+
+    // primitives in BVH leaf order, so the nodes can be stored unchanged
+    std::vector<CachedSphere> spheres;
+    std::vector<CachedQuad> quads;
+    std::vector<CachedTriangle> triangles;
+    std::vector<CachedVector> positions, normals;
+    std::vector<uint32_t> primitives;
+    std::unordered_map<const TriangleMesh*, int> meshBases;
+    for (const Shape* shape : bvh.primitives()) {
+        int material = -1;
+        if (shape->type() == ShapeSphere) {
+            const Sphere* sphere = static_cast<const Sphere*>(shape);
+            CachedSphere record;
+            for (int c = 0; c < 3; c++) record.center[c] = sphere->center[c];
+            record.radius = sphere->radius;
+            if (!materialIndex(sphere->material, material)) break;
+            record.material = material;
+            primitives.push_back(cachedPrimitive(CachedSpherePrimitive, spheres.size()));
+            spheres.push_back(record);
+        } else if (shape->type() == ShapeQuad) {
+            const Quad* quad = static_cast<const Quad*>(shape);
+            CachedQuad record;
+            for (int c = 0; c < 3; c++) {
+                record.corner[c] = quad->corner[c];
+                record.edge1[c] = quad->edge1[c];
+                record.edge2[c] = quad->edge2[c];
+                record.normal[c] = quad->normal[c];
+                record.w[c] = quad->w[c];
+            }
+            if (!materialIndex(quad->material, material)) break;
+            record.material = material;
+            primitives.push_back(cachedPrimitive(CachedQuadPrimitive, quads.size()));
+            quads.push_back(record);
+        } else if (shape->type() == ShapeTriangle) {
+            const Triangle* triangle = static_cast<const Triangle*>(shape);
+            const TriangleMesh* mesh = triangle->mesh;
+            auto base = meshBases.find(mesh);
+            if (base == meshBases.end()) {
+                base = meshBases.insert(std::make_pair(mesh, (int)positions.size())).first;
+                for (size_t i = 0; i < mesh->positions.size(); i++) {
+                    CachedVector p = { { mesh->positions[i].x(), mesh->positions[i].y(), mesh->positions[i].z() } };
+                    CachedVector n = { { 0.f, 0.f, 0.f } };
+                    if (!mesh->normals.empty()) n = { { mesh->normals[i].x(), mesh->normals[i].y(), mesh->normals[i].z() } };
+                    positions.push_back(p);
+                    normals.push_back(n);
+                }
+            }
+            CachedTriangle record;
+            for (int k = 0; k < 3; k++) record.v[k] = base->second + mesh->indices[3 * triangle->index + k];
+            if (!materialIndex(mesh->material, material)) break;
+            record.material = material;
+            record.hasNormals = !mesh->normals.empty();
+            primitives.push_back(cachedPrimitive(CachedTrianglePrimitive, triangles.size()));
+            triangles.push_back(record);
+        } else {
+            error = "shape type cannot be cached";
+            return false;
+        }
+    }
+    if (primitives.size() != bvh.primitives().size()) {
+        error = "shape with a material outside the scene";
+        return false;
+    }
+    if (spheres.size() >= (1u << 30) || quads.size() >= (1u << 30) || triangles.size() >= (1u << 30)) {
+        error = "too many primitives";
+        return false;
+    }
+
+    // header followed by the sections, each starting at an aligned offset
+    SceneCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "RTSCENE", 8);
+    header.version = SceneCacheVersion;
+    header.nodeSize = (uint32_t)sizeof(LinearBVHNode);
+    header.key = key;
+    const void* data[SceneCacheSectionCount] = { materials.data(), lights.data(), spheres.data(), quads.data(),
+        triangles.data(), positions.data(), normals.data(), bvh.nodes().data(), primitives.data() };
+    const size_t counts[SceneCacheSectionCount] = { materials.size(), lights.size(), spheres.size(), quads.size(),
+        triangles.size(), positions.size(), normals.size(), bvh.nodes().size(), primitives.size() };
+    const size_t sizes[SceneCacheSectionCount] = { sizeof(CachedMaterial), sizeof(CachedLight), sizeof(CachedSphere),
+        sizeof(CachedQuad), sizeof(CachedTriangle), sizeof(CachedVector), sizeof(CachedVector), sizeof(LinearBVHNode),
+        sizeof(uint32_t) };
+    uint64_t offset = sizeof(SceneCacheHeader);
+    for (int s = 0; s < SceneCacheSectionCount; s++) {
+        offset = (offset + SceneCacheAlignment - 1) / SceneCacheAlignment * SceneCacheAlignment;
+        header.sections[s].offset = offset;
+        header.sections[s].count = counts[s];
+        offset += counts[s] * sizes[s];
+    }
+    header.fileSize = offset;
+
+    // written under a temporary name and renamed, a reader never sees a partial file. The
+    // name is unique to the process, renderers filling the same cache do not share it.
+#if defined(_WIN32)
+    std::string temporary = filename + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+#else
+    std::string temporary = filename + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file) {
+        error = "cannot write " + temporary;
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t position = sizeof(header);
+    const char zeros[SceneCacheAlignment] = {};
+    for (int s = 0; s < SceneCacheSectionCount && ok; s++) {
+        ok = std::fwrite(zeros, 1, (size_t)(header.sections[s].offset - position), file) == header.sections[s].offset - position;
+        if (ok && counts[s] > 0) ok = std::fwrite(data[s], sizes[s], counts[s], file) == counts[s];
+        position = header.sections[s].offset + counts[s] * sizes[s];
+    }
+    ok = std::fclose(file) == 0 && ok;
+#if defined(_WIN32)
+    // rename does not replace an existing file on Windows, elsewhere it does so atomically
+    if (ok) std::remove(filename.c_str());
+#endif
+    if (!ok || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        error = "cannot write " + filename;
+        return false;
+    }
+    return true;
+}
+
+// Scene read from a compiled scene file. Geometry and BVH nodes stay in the mapped file,
+// only the few materials and lights are created as objects and handed to a Scene, whose
+// lightList() then serves the integrator as usual.
+class SceneCache : public Shape
+{
+public:
+    using Shape::hit;
+
+    SceneCache() : mNodes(nullptr), mNumNodes(0), mPrimitives(nullptr), mSpheres(nullptr), mQuads(nullptr),
+        mTriangles(nullptr), mPositions(nullptr), mNormals(nullptr) {}
+
+    // Maps the file and checks that it was written with the given key and that every index
+    // in it is in range. Nothing is added to the scene unless the file can be used.
+    bool open(const std::string& filename, uint64_t key, Scene& scene, std::string& error) {
+        if (!mFile.open(filename)) {
+            error = "cannot open " + filename;
+            return false;
+        }
+        const unsigned char* base = mFile.data();
+        SceneCacheHeader header;
+        if (mFile.size() < sizeof(header)) return fail(filename + " is truncated", error);
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, "RTSCENE", 8) != 0 || header.version != SceneCacheVersion ||
+            header.nodeSize != sizeof(LinearBVHNode))
+            return fail(filename + " is not a compatible scene cache", error);
+        if (header.key != key) return fail(filename + " was written for a different scene", error);
+        if (header.fileSize != mFile.size()) return fail(filename + " is truncated", error);
+        const size_t sizes[SceneCacheSectionCount] = { sizeof(CachedMaterial), sizeof(CachedLight), sizeof(CachedSphere),
+            sizeof(CachedQuad), sizeof(CachedTriangle), sizeof(CachedVector), sizeof(CachedVector), sizeof(LinearBVHNode),
+            sizeof(uint32_t) };
+        for (int s = 0; s < SceneCacheSectionCount; s++) {
+            const SceneCacheSection& section = header.sections[s];
+            if (section.offset % SceneCacheAlignment != 0 || section.offset > header.fileSize ||
+                section.count > (header.fileSize - section.offset) / sizes[s] || section.count >= (1u << 30))
+                return fail(filename + " has an invalid section", error);
+        }
+        auto section = [&](int s) { return base + header.sections[s].offset; };
+        auto count = [&](int s) { return (int)header.sections[s].count; };
+
+        const CachedMaterial* materials = (const CachedMaterial*)section(SectionMaterials);
+        const CachedLight* lights = (const CachedLight*)section(SectionLights);
+        mSpheres = (const CachedSphere*)section(SectionSpheres);
+        mQuads = (const CachedQuad*)section(SectionQuads);
+        mTriangles = (const CachedTriangle*)section(SectionTriangles);
+        mPositions = (const CachedVector*)section(SectionPositions);
+        mNormals = (const CachedVector*)section(SectionNormals);
+        mNodes = (const LinearBVHNode*)section(SectionNodes);
+        mPrimitives = (const uint32_t*)section(SectionPrimitives);
+        mNumNodes = count(SectionNodes);
+        int nMaterials = count(SectionMaterials), nLights = count(SectionLights);
+
+        // every index the traversal and shading follow
+        bool valid = count(SectionNormals) == count(SectionPositions);
+        for (int i = 0; i < nLights && valid; i++) valid = lights[i].type == CachedSphereLight || lights[i].type == CachedQuadLight;
+        for (int i = 0; i < nMaterials && valid; i++)
+            valid = materials[i].type >= 0 && materials[i].type < MaterialOther && materials[i].light >= -1 && materials[i].light < nLights;
+        for (int i = 0; i < count(SectionSpheres) && valid; i++) valid = validMaterial(mSpheres[i].material, nMaterials);
+        for (int i = 0; i < count(SectionQuads) && valid; i++) valid = validMaterial(mQuads[i].material, nMaterials);
+        for (int i = 0; i < count(SectionTriangles) && valid; i++) {
+            const CachedTriangle& t = mTriangles[i];
+            valid = validMaterial(t.material, nMaterials);
+            for (int k = 0; k < 3; k++) valid = valid && t.v[k] >= 0 && t.v[k] < count(SectionPositions);
+        }
+        const int primitiveCounts[3] = { count(SectionSpheres), count(SectionQuads), count(SectionTriangles) };
+        for (int i = 0; i < count(SectionPrimitives) && valid; i++) {
+            uint32_t type = mPrimitives[i] >> 30;
+            valid = type < 3 && (int)(mPrimitives[i] & 0x3fffffff) < primitiveCounts[type];
+        }
+        // children follow their parent, so traversal always moves forward and the depths are
+        // known before the children are reached. Descending into an interior node pushes one
+        // entry on the traversal stack.
+        std::vector<int> depth(valid ? mNumNodes : 0, 0);
+        for (int i = 0; i < mNumNodes && valid; i++) {
+            const LinearBVHNode& node = mNodes[i];
+            if (node.nPrimitives > 0)
+                valid = node.primitivesOffset >= 0 && node.primitivesOffset + node.nPrimitives <= count(SectionPrimitives);
+            else
+                valid = i + 1 < mNumNodes && node.secondChildOffset > i + 1 && node.secondChildOffset < mNumNodes && node.axis < 3 &&
+                    depth[i] < SceneCacheStackSize;
+            if (valid && node.nPrimitives <= 0) {
+                depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+                depth[node.secondChildOffset] = std::max(depth[node.secondChildOffset], depth[i] + 1);
+            }
+        }
+        if (!valid) return fail(filename + " contains invalid indices", error);
+
+        std::vector<const Light*> lightPointers;
+        for (int i = 0; i < nLights; i++) {
+            const CachedLight& l = lights[i];
+            Vec3 radiance(l.radiance[0], l.radiance[1], l.radiance[2]);
+            Vec3 a(l.data[0], l.data[1], l.data[2]), b(l.data[3], l.data[4], l.data[5]), c(l.data[6], l.data[7], l.data[8]);
+            const Light* light = l.type == CachedSphereLight ? (const Light*)scene.create<SphereLight>(a, l.data[3], radiance)
+                                                             : (const Light*)scene.create<QuadLight>(a, b, c, radiance);
+            scene.lights.push_back(light);
+            lightPointers.push_back(light);
+        }
+        mMaterials.clear();
+        for (int i = 0; i < nMaterials; i++) {
+            const CachedMaterial& m = materials[i];
+            Vec3 color(m.color[0], m.color[1], m.color[2]);
+            const Material* material;
+            switch (m.type) {
+            case MaterialLambertian: material = scene.addMaterial<Lambertian>(color); break;
+            case MaterialMetal: material = scene.addMaterial<Metal>(color, m.param); break;
+            case MaterialDielectric: material = scene.addMaterial<Dielectric>(m.param); break;
+            default: material = scene.addMaterial<Emissive>(color, m.light >= 0 ? lightPointers[m.light] : nullptr); break;
+            }
+            mMaterials.push_back(material);
+        }
+        return true;
+    }
+
+    bool hit(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        if (mNumNodes == 0) return false;
+        Vec3 invDir(1.f / ray.d.x(), 1.f / ray.d.y(), 1.f / ray.d.z());
+        int dirIsNeg[3] = { invDir.x() < 0.f, invDir.y() < 0.f, invDir.z() < 0.f };
+        float closest = maxT;
+        bool hitAnything = false;
+        int toVisit[SceneCacheStackSize];
+        int toVisitOffset = 0;
+        int current = 0;
+        for (;;) {
+            const LinearBVHNode& node = mNodes[current];
+            RT_STATS_ADD(nodeTests, 1);
+            if (node.bounds.intersect(ray, invDir, dirIsNeg, minT, closest)) {
+                if (node.nPrimitives > 0) {
+                    RT_STATS_ADD(primitiveTests, node.nPrimitives);
+                    for (int i = 0; i < node.nPrimitives; i++) {
+                        if (hitPrimitive(mPrimitives[node.primitivesOffset + i], ray, minT, closest, record)) {
+                            RT_STATS_ADD(candidateHits, 1);
+                            closest = record.t;
+                            hitAnything = true;
+                        }
+                    }
+                    if (toVisitOffset == 0) break;
+                    current = toVisit[--toVisitOffset];
+                } else {
+                    if (dirIsNeg[node.axis]) {
+                        toVisit[toVisitOffset++] = current + 1;
+                        current = node.secondChildOffset;
+                    } else {
+                        toVisit[toVisitOffset++] = node.secondChildOffset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return hitAnything;
+    }
+
+    bool occluded(const Ray& ray, const float minT, const float maxT) const {
+        if (mNumNodes == 0) return false;
+        Vec3 invDir(1.f / ray.d.x(), 1.f / ray.d.y(), 1.f / ray.d.z());
+        int dirIsNeg[3] = { invDir.x() < 0.f, invDir.y() < 0.f, invDir.z() < 0.f };
+        HitRecord record;
+        int toVisit[SceneCacheStackSize];
+        int toVisitOffset = 0;
+        int current = 0;
+        for (;;) {
+            const LinearBVHNode& node = mNodes[current];
+            RT_STATS_ADD(nodeTests, 1);
+            if (node.bounds.intersect(ray, invDir, dirIsNeg, minT, maxT)) {
+                if (node.nPrimitives > 0) {
+                    RT_STATS_ADD(primitiveTests, node.nPrimitives);
+                    for (int i = 0; i < node.nPrimitives; i++)
+                        if (hitPrimitive(mPrimitives[node.primitivesOffset + i], ray, minT, maxT, record)) return true;
+                    if (toVisitOffset == 0) break;
+                    current = toVisit[--toVisitOffset];
+                } else {
+                    if (dirIsNeg[node.axis]) {
+                        toVisit[toVisitOffset++] = current + 1;
+                        current = node.secondChildOffset;
+                    } else {
+                        toVisit[toVisitOffset++] = node.secondChildOffset;
+                        current = current + 1;
+                    }
+                }
+            } else {
+                if (toVisitOffset == 0) break;
+                current = toVisit[--toVisitOffset];
+            }
+        }
+        return false;
+    }
+
+    void computeSurface(const Ray& ray, HitRecord& record) const {
+        uint32_t index = (uint32_t)record.primitive & 0x3fffffff;
+        switch ((uint32_t)record.primitive >> 30) {
+        case CachedSpherePrimitive: {
+            const CachedSphere& s = mSpheres[index];
+            record.position = ray(record.t);
+            record.normal = (record.position - vec(s.center)).normalized();
+            record.material = mMaterials[s.material];
+            break;
+        }
+        case CachedQuadPrimitive:
+            record.position = ray(record.t);
+            record.normal = vec(mQuads[index].normal);
+            record.material = mMaterials[mQuads[index].material];
+            break;
+        default: {
+            const CachedTriangle& t = mTriangles[index];
+            Vec3 p0 = vec(mPositions[t.v[0]].v), p1 = vec(mPositions[t.v[1]].v), p2 = vec(mPositions[t.v[2]].v);
+            if (t.hasNormals) {
+                Vec3 normals[3] = { vec(mNormals[t.v[0]].v), vec(mNormals[t.v[1]].v), vec(mNormals[t.v[2]].v) };
+                Triangle::surface(p0, p1, p2, normals, record);
+            } else {
+                Triangle::surface(p0, p1, p2, nullptr, record);
+            }
+            record.material = mMaterials[t.material];
+            break;
+        }
+        }
+    }
+
+    AABB bounds() const { return mNumNodes == 0 ? AABB() : mNodes[0].bounds; }
+
+    int numNodes() const { return mNumNodes; }
+    size_t fileSize() const { return mFile.size(); }
+
+private:
+    static Vec3 vec(const float* v) { return Vec3(v[0], v[1], v[2]); }
+    static bool validMaterial(int index, int nMaterials) { return index >= 0 && index < nMaterials; }
+
+    bool fail(const std::string& message, std::string& error) {
+        error = message;
+        mFile.close();
+        mNumNodes = 0;
+        return false;
+    }
+
+    bool hitPrimitive(uint32_t primitive, const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        uint32_t index = primitive & 0x3fffffff;
+        switch (primitive >> 30) {
+        case CachedSpherePrimitive:
+            if (!Sphere::hitDistance(vec(mSpheres[index].center), mSpheres[index].radius, ray, minT, maxT, record.t)) return false;
+            break;
+        case CachedQuadPrimitive: {
+            const CachedQuad& q = mQuads[index];
+            float t;
+            if (!Quad::planeHit(vec(q.corner), vec(q.edge1), vec(q.edge2), vec(q.normal), vec(q.w), ray, minT, maxT, t)) return false;
+            record.t = t;
+            break;
+        }
+        default: {
+            const CachedTriangle& t = mTriangles[index];
+            if (!Triangle::hitBarycentric(vec(mPositions[t.v[0]].v), vec(mPositions[t.v[1]].v), vec(mPositions[t.v[2]].v),
+                                          ray, minT, maxT, record.t, record.u, record.v))
+                return false;
+            break;
+        }
+        }
+        record.shape = this;
+        record.primitive = (int)primitive;
+        return true;
+    }
+
+    MappedFile mFile;
+    const LinearBVHNode* mNodes;
+    int mNumNodes;
+    const uint32_t* mPrimitives;
+    const CachedSphere* mSpheres;
+    const CachedQuad* mQuads;
+    const CachedTriangle* mTriangles;
+    const CachedVector* mPositions;
+    const CachedVector* mNormals;
+    std::vector<const Material*> mMaterials;
+};
+
+#endif
@@ -4,81 +4,301 @@
 #pragma once
 #include "vec3.h"
 #include "ray.h"
+#include "aabb.h"
+#include "raypacket.h"
+#include "stats.h"
 #include <vector>
 #include <memory>
 
 class Material;
+class Shape;
 
+// The closest hit search only sets t, shape and primitive; position, normal and material
+// are filled in afterwards by shape->computeSurface().
 struct HitRecord
 {
     float t;
     Vec3 position;
     Vec3 normal;
-    std::shared_ptr<Material> material;
+    const Material* material;
+    const Shape* shape;
+    int primitive;  // index within shapes that hold many primitives
+    float u, v;     // hit coordinates on the primitive, barycentrics for triangles
 };
 
-// Abstract base class for all intersectable shapes
+// Closest hits of a RayPacket. t holds the current maximum distance of every lane and
+// records the hit of every lane whose bit is set in the returned masks.
+struct PacketHitRecord
+{
+    PacketHitRecord(float maxT) { for (int i = 0; i < RT_SIMD_WIDTH; i++) t[i] = maxT; }
+    alignas(32) float t[RT_SIMD_WIDTH];
+    HitRecord records[RT_SIMD_WIDTH];
+};
+
+// Tag of the concrete shape class. Aggregates read it once when they are built and keep
+// it next to their primitives, so the traversal can call the known classes directly.
+// The tagged classes are final so that a tag always names the exact class.
+enum ShapeType
+{
+    ShapeSphere,
+    ShapeQuad,
+    ShapeTriangle,
+    ShapeOther
+};
+
+// Abstract base class for all intersectable shapes. Intersection runs in two phases:
+// hit() finds the closest hit and records only its distance and the primitive that
+// produced it, then computeSurface() of that primitive fills in the shading data once.
+// Aggregates only implement hit(), so candidates that a closer hit replaces during the
+// search are never shaded.
 class Shape
 {
 public:
-    virtual bool intersect(const Ray& r, const float minT, const float maxT, HitRecord& record) const = 0;
+    virtual bool hit(const Ray& r, const float minT, const float maxT, HitRecord& record) const = 0;
+    virtual AABB bounds() const = 0;
+    virtual ShapeType type() const { return ShapeOther; }
+
+    // Fills position, normal and material of a hit this shape recorded. Aggregates never
+    // record themselves as the hit shape and keep the empty default.
+    virtual void computeSurface(const Ray&, HitRecord&) const {}
+
+    // Closest hit with its surface interaction
+    bool intersect(const Ray& r, const float minT, const float maxT, HitRecord& record) const {
+        if (!hit(r, minT, maxT, record)) return false;
+        record.shape->computeSurface(r, record);
+        RT_STATS_ADD(surfaces, 1);
+        return true;
+    }
+
+    // Any hit query for shadow rays: true if something lies between minT and maxT. Can stop
+    // at the first hit found and does not fill a hit record.
+    virtual bool occluded(const Ray& r, const float minT, const float maxT) const {
+        HitRecord record;
+        return hit(r, minT, maxT, record);
+    }
+
+    // Closest hits of the active lanes of a packet, returns the lanes that found a closer
+    // hit. Shapes without a vectorized version fall back to the scalar test per lane.
+    virtual vmask hit(const RayPacket& packet, const float minT, const vmask& active, PacketHitRecord& records) const {
+        int bits = active.bits();
+        int hitBits = 0;
+        for (int i = 0; i < RT_SIMD_WIDTH; i++) {
+            if (((bits >> i) & 1) && hit(packet.ray(i), minT, records.t[i], records.records[i])) {
+                records.t[i] = records.records[i].t;
+                hitBits |= 1 << i;
+            }
+        }
+        return maskFromBits(hitBits);
+    }
+
+    vmask intersect(const RayPacket& packet, const float minT, const vmask& active, PacketHitRecord& records) const {
+        vmask hits = hit(packet, minT, active, records);
+        int bits = hits.bits();
+        for (int i = 0; i < RT_SIMD_WIDTH; i++) {
+            if ((bits >> i) & 1) {
+                records.records[i].shape->computeSurface(packet.ray(i), records.records[i]);
+                RT_STATS_ADD(surfaces, 1);
+            }
+        }
+        return hits;
+    }
 };
 
-class Sphere : public Shape
+class Sphere final : public Shape
 {
 public:
-    Sphere() : radius(0.f) {}
-    Sphere(const Vec3& c, float r) : center(c), radius(r) {}
-    Sphere(const Vec3& c, float r, std::shared_ptr<Material> mat) : center(c), radius(r), material(mat) {}
-    bool intersect(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+    Sphere() : radius(0.f), material(nullptr) {}
+    Sphere(const Vec3& c, float r) : center(c), radius(r), material(nullptr) {}
+    Sphere(const Vec3& c, float r, const Material* mat) : center(c), radius(r), material(mat) {}
+    bool hit(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        if (!hitDistance(center, radius, ray, minT, maxT, record.t)) return false;
+        record.shape = this;
+        RT_STATS_ADD(candidateHits, 1);
+        return true;
+    }
+    // Nearest intersection distance in [minT, maxT], shared with shapes that store spheres flat
+    static bool hitDistance(const Vec3& center, float radius, const Ray& ray, const float minT, const float maxT, float& t) {
         Vec3 oc = ray.o - center;
         float a = ray.d.dot(ray.d);
         float b = 2.0f * ray.d.dot(oc);
         float c = oc.dot(oc) - radius * radius;
         float discriminant = b * b - 4 * a * c;
         if (discriminant < 0.0f) return false;
-        else {
-            float t1 = (-b - std::sqrt(discriminant)) / (2.0f * a);
-            if (t1 >= 0.0f && t1 >= minT && t1 <= maxT) { record.t = t1; }
-            else {
-                float t2 = (-b + std::sqrt(discriminant)) / (2.0f * a);
-                if(t2 >= 0.0f && t2 >= minT && t2 <= maxT)
-                    record.t = t2;
-                else return false;
+        float t1 = (-b - std::sqrt(discriminant)) / (2.0f * a);
+        if (t1 >= 0.0f && t1 >= minT && t1 <= maxT) { t = t1; return true; }
+        float t2 = (-b + std::sqrt(discriminant)) / (2.0f * a);
+        if (t2 >= 0.0f && t2 >= minT && t2 <= maxT) { t = t2; return true; }
+        return false;
+    }
+    void computeSurface(const Ray& ray, HitRecord& record) const {
+        record.position = ray(record.t);
+        record.normal = (record.position - center).normalized();
+        record.material = material;
+    }
+    bool occluded(const Ray& ray, const float minT, const float maxT) const {
+        Vec3 oc = ray.o - center;
+        float a = ray.d.dot(ray.d);
+        float b = 2.0f * ray.d.dot(oc);
+        float c = oc.dot(oc) - radius * radius;
+        float discriminant = b * b - 4 * a * c;
+        if (discriminant < 0.0f) return false;
+        float root = std::sqrt(discriminant);
+        float t1 = (-b - root) / (2.0f * a);
+        float t2 = (-b + root) / (2.0f * a);
+        return (t1 >= minT && t1 <= maxT) || (t2 >= minT && t2 <= maxT);
+    }
+    vmask hit(const RayPacket& packet, const float minT, const vmask& active, PacketHitRecord& records) const {
+        vfloat dx = vfloat::load(packet.dx), dy = vfloat::load(packet.dy), dz = vfloat::load(packet.dz);
+        vfloat ocx = vfloat::load(packet.ox) - vfloat(center.x());
+        vfloat ocy = vfloat::load(packet.oy) - vfloat(center.y());
+        vfloat ocz = vfloat::load(packet.oz) - vfloat(center.z());
+        vfloat a = dx * dx + dy * dy + dz * dz;
+        vfloat b = 2.0f * (dx * ocx + dy * ocy + dz * ocz);
+        vfloat c = ocx * ocx + ocy * ocy + ocz * ocz - vfloat(radius * radius);
+        vfloat discriminant = b * b - 4.0f * a * c;
+        vmask mask = active & (discriminant >= vfloat(0.0f));
+        if (!mask.any()) return mask;
+
+        vfloat maxT = vfloat::load(records.t);
+        vfloat root = vsqrt(vmax(discriminant, vfloat(0.0f)));
+        vfloat twoA = 2.0f * a;
+        vfloat t1 = (-b - root) / twoA;
+        vfloat t2 = (-b + root) / twoA;
+        vfloat lowT(minT > 0.0f ? minT : 0.0f);
+        vmask valid1 = (t1 >= lowT) & (t1 <= maxT);
+        vmask valid2 = (t2 >= lowT) & (t2 <= maxT);
+        vmask hit = mask & (valid1 | valid2);
+        int hitBits = hit.bits();
+        if (hitBits == 0) return hit;
+
+        vfloat t = select(valid1, t1, t2);
+        select(hit, t, maxT).store(records.t);
+        for (int i = 0; i < RT_SIMD_WIDTH; i++) {
+            if ((hitBits >> i) & 1) {
+                records.records[i].t = records.t[i];
+                records.records[i].shape = this;
+                RT_STATS_ADD(candidateHits, 1);
             }
-            record.position = ray(record.t);
-            record.normal = (record.position - center).normalized();
-            record.material = material;
-            return true;
         }
+        return hit;
     }
+    AABB bounds() const { return AABB(center - Vec3(radius), center + Vec3(radius)); }
+    ShapeType type() const { return ShapeSphere; }
     Vec3 center;
     float radius;
-    std::shared_ptr<Material> material;
+    const Material* material;
+};
+
+// Parallelogram spanned by two edges from a corner. The normal is edge1 x edge2.
+class Quad final : public Shape
+{
+public:
+    Quad(const Vec3& corner, const Vec3& edge1, const Vec3& edge2, const Material* mat)
+        : corner(corner), edge1(edge1), edge2(edge2), material(mat) {
+        Vec3 n = edge1.cross(edge2);
+        normal = n.normalized();
+        // scaled normal that turns a point of the plane into edge coordinates
+        w = n / n.dot(n);
+    }
+    using Shape::hit;
+
+    bool hit(const Ray& ray, const float minT, const float maxT, HitRecord& record) const {
+        float t;
+        if (!planeHit(ray, minT, maxT, t)) return false;
+        record.t = t;
+        record.shape = this;
+        RT_STATS_ADD(candidateHits, 1);
+        return true;
+    }
+    void computeSurface(const Ray& ray, HitRecord& record) const {
+        record.position = ray(record.t);
+        record.normal = normal;
+        record.material = material;
+    }
+    bool occluded(const Ray& ray, const float minT, const float maxT) const {
+        float t;
+        return planeHit(ray, minT, maxT, t);
+    }
+    AABB bounds() const {
+        AABB box(corner);
+        box.expand(corner + edge1);
+        box.expand(corner + edge2);
+        box.expand(corner + edge1 + edge2);
+        // pad axis aligned quads so the box is not flat
+        return AABB(box.pMin - Vec3(1e-4f), box.pMax + Vec3(1e-4f));
+    }
+    ShapeType type() const { return ShapeQuad; }
+    Vec3 corner;
+    Vec3 edge1;
+    Vec3 edge2;
+    Vec3 normal;
+    Vec3 w;
+    const Material* material;
+
+    // Intersection with the quad given by its fields, shared with shapes that store quads flat
+    static bool planeHit(const Vec3& corner, const Vec3& edge1, const Vec3& edge2, const Vec3& normal, const Vec3& w,
+                         const Ray& ray, const float minT, const float maxT, float& t) {
+        float denom = normal.dot(ray.d);
+        if (std::fabs(denom) < 1e-8f) return false;
+        t = normal.dot(corner - ray.o) / denom;
+        if (t < minT || t > maxT) return false;
+        Vec3 p = ray(t) - corner;
+        float alpha = w.dot(p.cross(edge2));
+        float beta = w.dot(edge1.cross(p));
+        return alpha >= 0.f && alpha <= 1.f && beta >= 0.f && beta <= 1.f;
+    }
+
+private:
+    bool planeHit(const Ray& ray, const float minT, const float maxT, float& t) const {
+        return planeHit(corner, edge1, edge2, normal, w, ray, minT, maxT, t);
+    }
 };
 
+// Shapes tested one after the other. The list does not own them, they usually live in
+// the arenas of a Scene.
 class ShapeList : public Shape
 {
 public:
     ShapeList() {}
-    ShapeList(const std::vector<std::shared_ptr<Shape>>& objects) {
+    ShapeList(const std::vector<const Shape*>& objects) {
         mObjects = objects;
     }
-    bool intersect(const Ray& r, const float minT, const float maxT, HitRecord& record) const {
-        HitRecord tempRec;
+    bool hit(const Ray& r, const float minT, const float maxT, HitRecord& record) const {
         float minDistance = maxT;
         bool hitAnything = false;
+        // children only write the record when they find a closer hit
         for(auto& o : mObjects)
             if (o != nullptr) {
-                if (o->intersect(r, minT, minDistance, tempRec)) {
-                    minDistance = tempRec.t;
+                RT_STATS_ADD(primitiveTests, 1);
+                if (o->hit(r, minT, minDistance, record)) {
+                    minDistance = record.t;
                     hitAnything = true;
-                    record = tempRec;
                 }
             }
         return hitAnything;
     }
-    std::vector<std::shared_ptr<Shape>> mObjects;
+    bool occluded(const Ray& r, const float minT, const float maxT) const {
+        for (auto& o : mObjects) {
+            if (o == nullptr) continue;
+            RT_STATS_ADD(primitiveTests, 1);
+            if (o->occluded(r, minT, maxT)) return true;
+        }
+        return false;
+    }
+    vmask hit(const RayPacket& packet, const float minT, const vmask& active, PacketHitRecord& records) const {
+        vmask hitAnything(false);
+        for (auto& o : mObjects)
+            if (o != nullptr)
+                hitAnything = hitAnything | o->hit(packet, minT, active, records);
+        return hitAnything;
+    }
+    AABB bounds() const {
+        AABB box;
+        for (auto& o : mObjects)
+            if (o != nullptr) box.expand(o->bounds());
+        return box;
+    }
+    std::vector<const Shape*> mObjects;
 };
 
 #endif
@@ -0,0 +1,180 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#pragma once
+#include <cmath>
+
+// Thin wrappers over the widest float vector unit available at compile time:
+// 8 lanes with AVX, 4 lanes with SSE2 and a 4 lane scalar fallback otherwise.
+// vfloat holds one float per lane and vmask holds one boolean per lane.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RT_SIMD_WIDTH 8
+#define RT_SIMD_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_SIMD_WIDTH 4
+#define RT_SIMD_SSE 1
+#else
+#define RT_SIMD_WIDTH 4
+#endif
+
+#if defined(RT_SIMD_AVX)
+
+struct vmask
+{
+    vmask() {}
+    explicit vmask(__m256 v) : m(v) {}
+    explicit vmask(bool b) : m(_mm256_castsi256_ps(_mm256_set1_epi32(b ? -1 : 0))) {}
+    vmask operator& (const vmask& o) const { return vmask(_mm256_and_ps(m, o.m)); }
+    vmask operator| (const vmask& o) const { return vmask(_mm256_or_ps(m, o.m)); }
+    vmask andNot(const vmask& o) const { return vmask(_mm256_andnot_ps(o.m, m)); }   // this & ~o
+    int bits() const { return _mm256_movemask_ps(m); }
+    bool any() const { return bits() != 0; }
+    bool all() const { return bits() == 0xff; }
+    bool operator[] (int i) const { return (bits() >> i) & 1; }
+    __m256 m;
+};
+
+struct vfloat
+{
+    vfloat() {}
+    explicit vfloat(__m256 v) : m(v) {}
+    vfloat(float f) : m(_mm256_set1_ps(f)) {}
+    static vfloat load(const float* p) { return vfloat(_mm256_loadu_ps(p)); }
+    void store(float* p) const { _mm256_storeu_ps(p, m); }
+    vfloat operator+ (const vfloat& o) const { return vfloat(_mm256_add_ps(m, o.m)); }
+    vfloat operator- (const vfloat& o) const { return vfloat(_mm256_sub_ps(m, o.m)); }
+    vfloat operator* (const vfloat& o) const { return vfloat(_mm256_mul_ps(m, o.m)); }
+    vfloat operator/ (const vfloat& o) const { return vfloat(_mm256_div_ps(m, o.m)); }
+    vfloat operator- () const { return vfloat(_mm256_xor_ps(m, _mm256_set1_ps(-0.f))); }
+    vmask operator< (const vfloat& o) const { return vmask(_mm256_cmp_ps(m, o.m, _CMP_LT_OQ)); }
+    vmask operator<= (const vfloat& o) const { return vmask(_mm256_cmp_ps(m, o.m, _CMP_LE_OQ)); }
+    vmask operator> (const vfloat& o) const { return vmask(_mm256_cmp_ps(m, o.m, _CMP_GT_OQ)); }
+    vmask operator>= (const vfloat& o) const { return vmask(_mm256_cmp_ps(m, o.m, _CMP_GE_OQ)); }
+    float operator[] (int i) const { float f[8]; store(f); return f[i]; }
+    __m256 m;
+};
+
+inline vfloat vmin(const vfloat& a, const vfloat& b) { return vfloat(_mm256_min_ps(a.m, b.m)); }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { return vfloat(_mm256_max_ps(a.m, b.m)); }
+inline vfloat vsqrt(const vfloat& a) { return vfloat(_mm256_sqrt_ps(a.m)); }
+inline vfloat vfloor(const vfloat& a) { return vfloat(_mm256_floor_ps(a.m)); }
+// lanes of a where mask is set, lanes of b elsewhere
+inline vfloat select(const vmask& mask, const vfloat& a, const vfloat& b) { return vfloat(_mm256_blendv_ps(b.m, a.m, mask.m)); }
+
+#elif defined(RT_SIMD_SSE)
+
+struct vmask
+{
+    vmask() {}
+    explicit vmask(__m128 v) : m(v) {}
+    explicit vmask(bool b) : m(_mm_castsi128_ps(_mm_set1_epi32(b ? -1 : 0))) {}
+    vmask operator& (const vmask& o) const { return vmask(_mm_and_ps(m, o.m)); }
+    vmask operator| (const vmask& o) const { return vmask(_mm_or_ps(m, o.m)); }
+    vmask andNot(const vmask& o) const { return vmask(_mm_andnot_ps(o.m, m)); }   // this & ~o
+    int bits() const { return _mm_movemask_ps(m); }
+    bool any() const { return bits() != 0; }
+    bool all() const { return bits() == 0xf; }
+    bool operator[] (int i) const { return (bits() >> i) & 1; }
+    __m128 m;
+};
+
+struct vfloat
+{
+    vfloat() {}
+    explicit vfloat(__m128 v) : m(v) {}
+    vfloat(float f) : m(_mm_set1_ps(f)) {}
+    static vfloat load(const float* p) { return vfloat(_mm_loadu_ps(p)); }
+    void store(float* p) const { _mm_storeu_ps(p, m); }
+    vfloat operator+ (const vfloat& o) const { return vfloat(_mm_add_ps(m, o.m)); }
+    vfloat operator- (const vfloat& o) const { return vfloat(_mm_sub_ps(m, o.m)); }
+    vfloat operator* (const vfloat& o) const { return vfloat(_mm_mul_ps(m, o.m)); }
+    vfloat operator/ (const vfloat& o) const { return vfloat(_mm_div_ps(m, o.m)); }
+    vfloat operator- () const { return vfloat(_mm_xor_ps(m, _mm_set1_ps(-0.f))); }
+    vmask operator< (const vfloat& o) const { return vmask(_mm_cmplt_ps(m, o.m)); }
+    vmask operator<= (const vfloat& o) const { return vmask(_mm_cmple_ps(m, o.m)); }
+    vmask operator> (const vfloat& o) const { return vmask(_mm_cmpgt_ps(m, o.m)); }
+    vmask operator>= (const vfloat& o) const { return vmask(_mm_cmpge_ps(m, o.m)); }
+    float operator[] (int i) const { float f[4]; store(f); return f[i]; }
+    __m128 m;
+};
+
+inline vfloat vmin(const vfloat& a, const vfloat& b) { return vfloat(_mm_min_ps(a.m, b.m)); }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { return vfloat(_mm_max_ps(a.m, b.m)); }
+inline vfloat vsqrt(const vfloat& a) { return vfloat(_mm_sqrt_ps(a.m)); }
+inline vfloat vfloor(const vfloat& a) {
+    // truncate, then step down where truncation rounded a negative value up
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m));
+    return vfloat(_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.m), _mm_set1_ps(1.f))));
+}
+// lanes of a where mask is set, lanes of b elsewhere
+inline vfloat select(const vmask& mask, const vfloat& a, const vfloat& b) {
+    return vfloat(_mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)));
+}
+
+#else
+
+struct vmask
+{
+    vmask() {}
+    explicit vmask(bool b) { for (int i = 0; i < 4; i++) m[i] = b; }
+    vmask operator& (const vmask& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] && o.m[i]; return r; }
+    vmask operator| (const vmask& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] || o.m[i]; return r; }
+    vmask andNot(const vmask& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] && !o.m[i]; return r; }
+    int bits() const { int b = 0; for (int i = 0; i < 4; i++) b |= m[i] ? (1 << i) : 0; return b; }
+    bool any() const { return bits() != 0; }
+    bool all() const { return bits() == 0xf; }
+    bool operator[] (int i) const { return m[i]; }
+    bool m[4];
+};
+
+struct vfloat
+{
+    vfloat() {}
+    vfloat(float f) { for (int i = 0; i < 4; i++) m[i] = f; }
+    static vfloat load(const float* p) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = p[i]; return r; }
+    void store(float* p) const { for (int i = 0; i < 4; i++) p[i] = m[i]; }
+    vfloat operator+ (const vfloat& o) const { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = m[i] + o.m[i]; return r; }
+    vfloat operator- (const vfloat& o) const { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = m[i] - o.m[i]; return r; }
+    vfloat operator* (const vfloat& o) const { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = m[i] * o.m[i]; return r; }
+    vfloat operator/ (const vfloat& o) const { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = m[i] / o.m[i]; return r; }
+    vfloat operator- () const { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = -m[i]; return r; }
+    vmask operator< (const vfloat& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] < o.m[i]; return r; }
+    vmask operator<= (const vfloat& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] <= o.m[i]; return r; }
+    vmask operator> (const vfloat& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] > o.m[i]; return r; }
+    vmask operator>= (const vfloat& o) const { vmask r; for (int i = 0; i < 4; i++) r.m[i] = m[i] >= o.m[i]; return r; }
+    float operator[] (int i) const { return m[i]; }
+    float m[4];
+};
+
+inline vfloat vmin(const vfloat& a, const vfloat& b) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] < b.m[i] ? a.m[i] : b.m[i]; return r; }
+inline vfloat vmax(const vfloat& a, const vfloat& b) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = a.m[i] > b.m[i] ? a.m[i] : b.m[i]; return r; }
+inline vfloat vsqrt(const vfloat& a) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = std::sqrt(a.m[i]); return r; }
+inline vfloat vfloor(const vfloat& a) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = std::floor(a.m[i]); return r; }
+// lanes of a where mask is set, lanes of b elsewhere
+inline vfloat select(const vmask& mask, const vfloat& a, const vfloat& b) { vfloat r; for (int i = 0; i < 4; i++) r.m[i] = mask.m[i] ? a.m[i] : b.m[i]; return r; }
+
+#endif
+
+inline vfloat operator+ (float a, const vfloat& b) { return vfloat(a) + b; }
+inline vfloat operator- (float a, const vfloat& b) { return vfloat(a) - b; }
+inline vfloat operator* (float a, const vfloat& b) { return vfloat(a) * b; }
+inline vfloat operator/ (float a, const vfloat& b) { return vfloat(a) / b; }
+
+// mask with the first n lanes set
+inline vmask firstLanes(int n) {
+    float f[RT_SIMD_WIDTH];
+    for (int i = 0; i < RT_SIMD_WIDTH; i++) f[i] = (float)i;
+    return vfloat::load(f) < vfloat((float)n);
+}
+
+// mask with lane i set when bit i of bits is set
+inline vmask maskFromBits(int bits) {
+    float f[RT_SIMD_WIDTH];
+    for (int i = 0; i < RT_SIMD_WIDTH; i++) f[i] = (bits >> i) & 1 ? 1.f : 0.f;
+    return vfloat::load(f) > vfloat(0.f);
+}
+
+#endif
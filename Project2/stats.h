@@ -0,0 +1,240 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#pragma once
+#if defined(RT_STATS)
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#endif
+
+// Render statistics, compiled in with RT_STATS. Every thread counts into its own
+// RenderStats block, so the counters are plain integers that no other thread writes.
+// mergeStats() adds up the blocks of all threads once the frame is done and the pool is
+// idle. Without RT_STATS the RT_STATS_* macros expand to nothing.
+
+// Phases of a path that are timed inside the render loop
+enum StatsPhase
+{
+    PhaseIntersect,     // closest hit of the path ray
+    PhaseLights,        // next event estimation including its shadow ray
+    PhaseBSDF,          // material sampling and Russian roulette
+    PhaseCount
+};
+
+#if defined(RT_STATS)
+
+struct RenderStats
+{
+    // paths of MaxDepthBins - 1 or more bounces share the last bin
+    static const int MaxDepthBins = 64;
+    // one slot per MaterialType, checked in material.h
+    static const int MaterialTypes = 5;
+    // phases are timed every TimerPeriod-th time and the time is scaled up, reading the
+    // clock on every bounce would cost more than some of the phases themselves
+    static const int TimerPeriod = 64;
+
+    RenderStats() { clear(); }
+    void clear() { std::memset(this, 0, sizeof(*this)); }
+
+    void merge(const RenderStats& o) {
+        primaryRays += o.primaryRays;
+        secondaryRays += o.secondaryRays;
+        shadowRays += o.shadowRays;
+        nodeTests += o.nodeTests;
+        primitiveTests += o.primitiveTests;
+        candidateHits += o.candidateHits;
+        surfaces += o.surfaces;
+        rouletteKills += o.rouletteKills;
+        for (int i = 0; i < MaxDepthBins; i++) pathDepth[i] += o.pathDepth[i];
+        for (int i = 0; i < MaterialTypes; i++) {
+            scattered[i] += o.scattered[i];
+            absorbed[i] += o.absorbed[i];
+        }
+        for (int i = 0; i < PhaseCount; i++) {
+            phaseCalls[i] += o.phaseCalls[i];
+            phaseSeconds[i] += o.phaseSeconds[i];
+        }
+    }
+
+    void addPath(int bounces) { pathDepth[bounces < MaxDepthBins ? bounces : MaxDepthBins - 1]++; }
+
+    long long primaryRays;
+    long long secondaryRays;
+    long long shadowRays;
+    long long nodeTests;        // bounding boxes tested during traversal
+    long long primitiveTests;   // primitives tested, spheres of a SphereSoA block count one each
+    long long candidateHits;    // closer hits found by primitives during closest hit searches
+    long long surfaces;         // surface interactions computed for final hits
+    long long rouletteKills;
+    long long pathDepth[MaxDepthBins];
+    long long scattered[MaterialTypes];
+    long long absorbed[MaterialTypes];
+    long long phaseCalls[PhaseCount];
+    double phaseSeconds[PhaseCount];
+};
+
+// Owns the blocks of the live threads and keeps the counts of threads that have exited
+class StatsRegistry
+{
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    void add(RenderStats* stats) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreads.push_back(stats);
+    }
+
+    void remove(RenderStats* stats) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRetired.merge(*stats);
+        for (size_t i = 0; i < mThreads.size(); i++) {
+            if (mThreads[i] == stats) {
+                mThreads[i] = mThreads.back();
+                mThreads.pop_back();
+                break;
+            }
+        }
+    }
+
+    // Sum over all threads since the last reset. Must not run while threads are counting.
+    RenderStats merged() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        RenderStats total = mRetired;
+        for (RenderStats* s : mThreads) total.merge(*s);
+        return total;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRetired.clear();
+        for (RenderStats* s : mThreads) s->clear();
+    }
+
+private:
+    std::mutex mMutex;
+    std::vector<RenderStats*> mThreads;
+    RenderStats mRetired;
+};
+
+struct ThreadStats
+{
+    ThreadStats() { StatsRegistry::instance().add(&stats); }
+    ~ThreadStats() { StatsRegistry::instance().remove(&stats); }
+    RenderStats stats;
+};
+
+inline RenderStats& threadStats() {
+    thread_local ThreadStats block;
+    return block.stats;
+}
+
+inline RenderStats mergeStats() { return StatsRegistry::instance().merged(); }
+inline void resetStats() { StatsRegistry::instance().reset(); }
+
+// Times one in RenderStats::TimerPeriod scopes of a phase. The cost of reading the clock
+// is subtracted, otherwise it would be scaled up along with the time of short phases.
+class StatsPhaseTimer
+{
+public:
+    static double clockOverhead() {
+        static const double overhead = [] {
+            double best = 1.0;
+            for (int i = 0; i < 1000; i++) {
+                auto start = std::chrono::steady_clock::now();
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best = std::min(best, elapsed.count());
+            }
+            return best;
+        }();
+        return overhead;
+    }
+
+    explicit StatsPhaseTimer(StatsPhase phase) : mStats(threadStats()), mPhase(phase) {
+        mTimed = mStats.phaseCalls[phase]++ % RenderStats::TimerPeriod == 0;
+        if (mTimed) mStart = std::chrono::steady_clock::now();
+    }
+    ~StatsPhaseTimer() {
+        if (!mTimed) return;
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - mStart;
+        mStats.phaseSeconds[mPhase] += std::max(elapsed.count() - clockOverhead(), 0.0) * RenderStats::TimerPeriod;
+    }
+
+private:
+    RenderStats& mStats;
+    StatsPhase mPhase;
+    bool mTimed;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+// Wall time of the stages of a run, measured once by the caller
+struct FrameTimes
+{
+    FrameTimes() : sceneSeconds(0.0), accelSeconds(0.0), renderSeconds(0.0), writeSeconds(0.0) {}
+    double sceneSeconds;
+    double accelSeconds;
+    double renderSeconds;
+    double writeSeconds;
+};
+
+inline void writeStatsJSON(std::ostream& out, const RenderStats& s, const FrameTimes& frame) {
+    static const char* materialNames[RenderStats::MaterialTypes] = { "lambertian", "metal", "dielectric", "emissive", "other" };
+    static const char* phaseNames[PhaseCount] = { "intersect", "lights", "bsdf" };
+    long long rays = s.primaryRays + s.secondaryRays + s.shadowRays;
+    int lastBin = 0;
+    for (int i = 0; i < RenderStats::MaxDepthBins; i++) if (s.pathDepth[i] > 0) lastBin = i;
+
+    out << "{\n";
+    out << "  \"frame_seconds\": { \"scene\": " << frame.sceneSeconds << ", \"accel\": " << frame.accelSeconds
+        << ", \"render\": " << frame.renderSeconds << ", \"write\": " << frame.writeSeconds << " },\n";
+    out << "  \"rays\": { \"primary\": " << s.primaryRays << ", \"secondary\": " << s.secondaryRays
+        << ", \"shadow\": " << s.shadowRays << ", \"per_second\": "
+        << (frame.renderSeconds > 0.0 ? rays / frame.renderSeconds : 0.0) << " },\n";
+    out << "  \"tests\": { \"nodes\": " << s.nodeTests << ", \"primitives\": " << s.primitiveTests
+        << ", \"candidate_hits\": " << s.candidateHits << ", \"surfaces\": " << s.surfaces << " },\n";
+    out << "  \"path_depth\": [";
+    for (int i = 0; i <= lastBin; i++) out << (i > 0 ? ", " : "") << s.pathDepth[i];
+    out << "],\n";
+    out << "  \"roulette_kills\": " << s.rouletteKills << ",\n";
+    out << "  \"materials\": {";
+    for (int i = 0; i < RenderStats::MaterialTypes; i++) {
+        long long total = s.scattered[i] + s.absorbed[i];
+        out << (i > 0 ? "," : "") << "\n    \"" << materialNames[i] << "\": { \"scattered\": " << s.scattered[i]
+            << ", \"absorbed\": " << s.absorbed[i] << ", \"absorb_ratio\": "
+            << (total > 0 ? double(s.absorbed[i]) / total : 0.0) << " }";
+    }
+    out << "\n  },\n";
+    out << "  \"phase_seconds\": {";
+    for (int i = 0; i < PhaseCount; i++)
+        out << (i > 0 ? "," : "") << " \"" << phaseNames[i] << "\": " << s.phaseSeconds[i];
+    out << " }\n";
+    out << "}\n";
+}
+
+inline int countBits(int bits) {
+    int n = 0;
+    for (; bits != 0; bits &= bits - 1) n++;
+    return n;
+}
+
+#define RT_STATS_ADD(counter, n) (threadStats().counter += (n))
+#define RT_STATS_PATH(bounces) threadStats().addPath(bounces)
+#define RT_STATS_MATERIAL(type, scattered) \
+    ((scattered) ? threadStats().scattered[type]++ : threadStats().absorbed[type]++)
+#define RT_STATS_PHASE_CONCAT(a, b) a##b
+#define RT_STATS_PHASE_NAME(line) RT_STATS_PHASE_CONCAT(rtStatsPhase, line)
+#define RT_STATS_PHASE(phase) StatsPhaseTimer RT_STATS_PHASE_NAME(__LINE__)(phase)
+#else
+#define RT_STATS_ADD(counter, n)
+#define RT_STATS_PATH(bounces)
+#define RT_STATS_MATERIAL(type, scattered)
+#define RT_STATS_PHASE(phase)
+#endif
+
+#endif
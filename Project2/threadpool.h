@@ -0,0 +1,102 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads. Work is handed out through parallelFor, where
+// every index in [0, count) is executed exactly once. The calling thread takes part
+// in the work as thread 0, the pool workers are numbered 1..size()-1.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int numThreads = 0) {
+        if (numThreads <= 0) numThreads = defaultThreadCount();
+        mNumThreads = numThreads;
+        for (int t = 1; t < numThreads; t++)
+            mWorkers.emplace_back(&ThreadPool::workerLoop, this, t);
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mShutdown = true;
+        }
+        mWake.notify_all();
+        for (auto& w : mWorkers) w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    static int defaultThreadCount() {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : (int)n;
+    }
+
+    int size() const { return mNumThreads; }
+
+    // Runs func(index, threadId) for every index in [0, count) and blocks until all are done.
+    void parallelFor(int count, const std::function<void(int, int)>& func) {
+        if (count <= 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJob = &func;
+            mJobCount = count;
+            mNextIndex = 0;
+            mBusyWorkers = (int)mWorkers.size();
+            mGeneration++;
+        }
+        mWake.notify_all();
+        runJob(0);
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this] { return mBusyWorkers == 0; });
+        mJob = nullptr;
+    }
+
+private:
+    void runJob(int threadId) {
+        for (;;) {
+            int index = mNextIndex.fetch_add(1);
+            if (index >= mJobCount) break;
+            (*mJob)(index, threadId);
+        }
+    }
+
+    void workerLoop(int threadId) {
+        uint64_t seenGeneration = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [&] { return mShutdown || mGeneration != seenGeneration; });
+                if (mShutdown) return;
+                seenGeneration = mGeneration;
+            }
+            runJob(threadId);
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (--mBusyWorkers == 0) mDone.notify_one();
+            }
+        }
+    }
+
+    int mNumThreads;
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    const std::function<void(int, int)>* mJob = nullptr;
+    int mJobCount = 0;
+    std::atomic<int> mNextIndex{ 0 };
+    int mBusyWorkers = 0;
+    uint64_t mGeneration = 0;
+    bool mShutdown = false;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#pragma once
+#include <chrono>
+
+// Simple wall clock timer used to report render and benchmark timings
+class Timer
+{
+public:
+    Timer() { reset(); }
+    void reset() { start = std::chrono::high_resolution_clock::now(); }
+    double elapsedSeconds() const {
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        return elapsed.count();
+    }
+    double elapsedMilliseconds() const { return elapsedSeconds() * 1000.0; }
+
+private:
+    std::chrono::high_resolution_clock::time_point start;
+};
+
+#endif
@@ -6,14 +6,16 @@
 #include <cassert>
 #include <iostream>
 
-class Vec3
+// Plain scalar implementation. Defining RT_VEC3_SSE switches Vec3 over to the
+// SSE backed Vec3SSE in vec3sse.h, which has identical semantics.
+class Vec3Scalar
 {
 public:
     // Constructors
-    Vec3() { v[0] = 0.f; v[1] = 0.f; v[2] = 0.f; }
-    Vec3(float val) { v[0] = val; v[1] = val; v[2] = val; }
-    Vec3(float x, float y, float z) { v[0] = x; v[1] = y; v[2] = z; }
-    Vec3(const Vec3& V) { v[0] = V.v[0]; v[1] = V.v[1]; v[2] = V.v[2]; }
+    Vec3Scalar() { v[0] = 0.f; v[1] = 0.f; v[2] = 0.f; }
+    Vec3Scalar(float val) { v[0] = val; v[1] = val; v[2] = val; }
+    Vec3Scalar(float x, float y, float z) { v[0] = x; v[1] = y; v[2] = z; }
+    Vec3Scalar(const Vec3Scalar& V) { v[0] = V.v[0]; v[1] = V.v[1]; v[2] = V.v[2]; }
 
     // access operators
     float x() const { return v[0]; }
@@ -25,34 +27,34 @@ public:
     float operator[] (int i) const { assert(i >= 0 && i <= 2); return v[i]; }
 
     // unary operators
-    Vec3 operator- () const { return Vec3(-v[0], -v[1], -v[2]); }
-    Vec3 operator+ (const Vec3& V) const { return Vec3(v[0] + V.v[0], v[1] + V.v[1], v[2] + V.v[2]); }
-    Vec3 operator- (const Vec3& V) const { return Vec3(v[0] - V.v[0], v[1] - V.v[1], v[2] - V.v[2]); }
-    Vec3 operator* (const float k) const { return Vec3(v[0] * k, v[1] * k, v[2] * k); }
-    Vec3 operator* (const Vec3& V) const { return Vec3(v[0] * V.v[0], v[1] * V.v[1], v[2] * V.v[2]); }
-    Vec3 operator/ (const float k) const { assert(k != 0.f); float invK = 1.f / k; return *this * invK; }
-    friend Vec3 operator* (const float t, const Vec3& V) { return V * t; }
+    Vec3Scalar operator- () const { return Vec3Scalar(-v[0], -v[1], -v[2]); }
+    Vec3Scalar operator+ (const Vec3Scalar& V) const { return Vec3Scalar(v[0] + V.v[0], v[1] + V.v[1], v[2] + V.v[2]); }
+    Vec3Scalar operator- (const Vec3Scalar& V) const { return Vec3Scalar(v[0] - V.v[0], v[1] - V.v[1], v[2] - V.v[2]); }
+    Vec3Scalar operator* (const float k) const { return Vec3Scalar(v[0] * k, v[1] * k, v[2] * k); }
+    Vec3Scalar operator* (const Vec3Scalar& V) const { return Vec3Scalar(v[0] * V.v[0], v[1] * V.v[1], v[2] * V.v[2]); }
+    Vec3Scalar operator/ (const float k) const { assert(k != 0.f); float invK = 1.f / k; return *this * invK; }
+    friend Vec3Scalar operator* (const float t, const Vec3Scalar& V) { return V * t; }
 
     // binary operators
-    Vec3& operator+= (const Vec3& V) { v[0] += V.v[0]; v[1] += V.v[1]; v[2] += V.v[2]; return *this; }
-    Vec3& operator-= (const Vec3& V) { v[0] -= V.v[0]; v[1] -= V.v[1]; v[2] -= V.v[2]; return *this; }
-    Vec3& operator*= (const float k) { v[0] *= k; v[1] *= k; v[2] *= k; return *this; }
-    Vec3& operator/= (const float k) { assert(k != 0.f); float invK = 1.0f / k; v[0] *= invK; v[1] *= invK; v[2] *= invK; return *this; }
-    bool operator== (const Vec3& V) const { return v[0] == V.v[0] && v[1] == V.v[1] && v[2] == V.v[2]; }
+    Vec3Scalar& operator+= (const Vec3Scalar& V) { v[0] += V.v[0]; v[1] += V.v[1]; v[2] += V.v[2]; return *this; }
+    Vec3Scalar& operator-= (const Vec3Scalar& V) { v[0] -= V.v[0]; v[1] -= V.v[1]; v[2] -= V.v[2]; return *this; }
+    Vec3Scalar& operator*= (const float k) { v[0] *= k; v[1] *= k; v[2] *= k; return *this; }
+    Vec3Scalar& operator/= (const float k) { assert(k != 0.f); float invK = 1.0f / k; v[0] *= invK; v[1] *= invK; v[2] *= invK; return *this; }
+    bool operator== (const Vec3Scalar& V) const { return v[0] == V.v[0] && v[1] == V.v[1] && v[2] == V.v[2]; }
     bool operator== (const float k) const { return v[0] == k && v[1] == k && v[2] == k; }
 
     // common operations
-    float length() const { return std::sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); }
-    float sqrLength() const { return v[0] * v[0] + v[1] + v[1] + v[2] * v[2]; }
-    float dot(const Vec3& V) const { return v[0] * V.v[0] + v[1] * V.v[1] + v[2] * V.v[2]; }
-    Vec3 cross(const Vec3& V) const { return Vec3(v[1] * V.v[2] - v[2] * V.v[1], 
-                                                  v[2] * V.v[0] - v[0] * V.v[2], 
-                                                  v[0] * V.v[1] - v[1] * V.v[0]); }
-    Vec3 normalized() const { return *this / this->length(); }
-    Vec3& normalize() { *this /= length(); return *this; }
+    float length() const { return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]); }
+    float sqrLength() const { return v[0] * v[0] + v[1] * v[1] + v[2] * v[2]; }
+    float dot(const Vec3Scalar& V) const { return v[0] * V.v[0] + v[1] * V.v[1] + v[2] * V.v[2]; }
+    Vec3Scalar cross(const Vec3Scalar& V) const { return Vec3Scalar(v[1] * V.v[2] - v[2] * V.v[1], 
+                                                              v[2] * V.v[0] - v[0] * V.v[2], 
+                                                              v[0] * V.v[1] - v[1] * V.v[0]); }
+    Vec3Scalar normalized() const { return *this / this->length(); }
+    Vec3Scalar& normalize() { *this /= length(); return *this; }
 
     // output operators
-    friend std::ostream& operator >> (std::ostream& out, const Vec3& V) {
+    friend std::ostream& operator >> (std::ostream& out, const Vec3Scalar& V) {
         out << "[" << V.v[0] << "," << V.v[1] << "," << V.v[2] << "]\n";
         return out;
     }
@@ -60,5 +62,12 @@ public:
     float v[3];
 };
 
+#if defined(RT_VEC3_SSE)
+#include "vec3sse.h"
+typedef Vec3SSE Vec3;
+#else
+typedef Vec3Scalar Vec3;
+#endif
+
 
 #endif
@@ -0,0 +1,88 @@
+#ifndef __VEC3SSE_H__
+#define __VEC3SSE_H__
+
+#pragma once
+#include <cmath>
+#include <cassert>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_HAS_SSE 1
+#include <emmintrin.h>
+
+// SSE backed 3 component vector padded to 16 bytes. The fourth lane is kept at zero.
+// Every operation evaluates in the same order as Vec3Scalar, so both produce bit
+// identical results and can be swapped without touching call sites. There is no
+// 8 wide AVX variant since a single vector only ever fills 3 lanes.
+class alignas(16) Vec3SSE
+{
+public:
+    // Constructors
+    Vec3SSE() : m(_mm_setzero_ps()) {}
+    Vec3SSE(float val) : m(_mm_set_ps(0.f, val, val, val)) {}
+    Vec3SSE(float x, float y, float z) : m(_mm_set_ps(0.f, z, y, x)) {}
+    explicit Vec3SSE(__m128 vm) : m(vm) {}
+
+    // access operators
+    float x() const { return _mm_cvtss_f32(m); }
+    float y() const { return v[1]; }
+    float z() const { return v[2]; }
+    float r() const { return x(); }
+    float g() const { return v[1]; }
+    float b() const { return v[2]; }
+    float operator[] (int i) const { assert(i >= 0 && i <= 2); return v[i]; }
+
+    // unary operators
+    Vec3SSE operator- () const { return Vec3SSE(_mm_xor_ps(m, _mm_set_ps(0.f, -0.f, -0.f, -0.f))); }
+    Vec3SSE operator+ (const Vec3SSE& V) const { return Vec3SSE(_mm_add_ps(m, V.m)); }
+    Vec3SSE operator- (const Vec3SSE& V) const { return Vec3SSE(_mm_sub_ps(m, V.m)); }
+    Vec3SSE operator* (const float k) const { return Vec3SSE(_mm_mul_ps(m, _mm_set1_ps(k))); }
+    Vec3SSE operator* (const Vec3SSE& V) const { return Vec3SSE(_mm_mul_ps(m, V.m)); }
+    Vec3SSE operator/ (const float k) const { assert(k != 0.f); float invK = 1.f / k; return *this * invK; }
+    friend Vec3SSE operator* (const float t, const Vec3SSE& V) { return V * t; }
+
+    // binary operators
+    Vec3SSE& operator+= (const Vec3SSE& V) { m = _mm_add_ps(m, V.m); return *this; }
+    Vec3SSE& operator-= (const Vec3SSE& V) { m = _mm_sub_ps(m, V.m); return *this; }
+    Vec3SSE& operator*= (const float k) { m = _mm_mul_ps(m, _mm_set1_ps(k)); return *this; }
+    Vec3SSE& operator/= (const float k) { assert(k != 0.f); float invK = 1.0f / k; return *this *= invK; }
+    bool operator== (const Vec3SSE& V) const { return (_mm_movemask_ps(_mm_cmpeq_ps(m, V.m)) & 7) == 7; }
+    bool operator== (const float k) const { return (_mm_movemask_ps(_mm_cmpeq_ps(m, _mm_set1_ps(k))) & 7) == 7; }
+
+    // common operations
+    float length() const { return std::sqrt(dot(*this)); }
+    float sqrLength() const { return dot(*this); }
+    float dot(const Vec3SSE& V) const {
+        // (x + y) + z, the same summation order as the scalar version
+        __m128 p = _mm_mul_ps(m, V.m);
+        __m128 s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 2, 1, 1)));
+        s = _mm_add_ss(s, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 2, 1, 2)));
+        return _mm_cvtss_f32(s);
+    }
+    Vec3SSE cross(const Vec3SSE& V) const {
+        __m128 a_yzx = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 a_zxy = _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 1, 0, 2));
+        __m128 b_yzx = _mm_shuffle_ps(V.m, V.m, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_zxy = _mm_shuffle_ps(V.m, V.m, _MM_SHUFFLE(3, 1, 0, 2));
+        return Vec3SSE(_mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx)));
+    }
+    Vec3SSE normalized() const { return *this / this->length(); }
+    Vec3SSE& normalize() { *this /= length(); return *this; }
+
+    // output operators
+    friend std::ostream& operator >> (std::ostream& out, const Vec3SSE& V) {
+        out << "[" << V.v[0] << "," << V.v[1] << "," << V.v[2] << "]\n";
+        return out;
+    }
+
+    union {
+        __m128 m;
+        float v[4];
+    };
+};
+
+#elif defined(RT_VEC3_SSE)
+#error "RT_VEC3_SSE requires a target with SSE2 support"
+#endif
+
+#endif
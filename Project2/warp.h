@@ -0,0 +1,150 @@
+#ifndef __WARP_H__
+#define __WARP_H__
+
+#pragma once
+#include "vec3.h"
+#include "sampler.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+// Closed form mappings of uniform points in [0, 1)^2 to other domains. Unlike rejection
+// sampling every call uses exactly one 2D sample, so low discrepancy points keep their
+// stratification after the mapping and the cost does not depend on the input. The
+// batch versions map arrays of points RT_SIMD_WIDTH at a time.
+
+static const float Pi = 3.14159265358979323846f;
+static const float InvPi = 0.31830988618379067154f;
+
+// Shirley and Chiu's concentric mapping, squares around the center go to rings of the
+// unit disk. Returned in the xy plane.
+inline Vec3 squareToConcentricDisk(const Point2f& u) {
+    float a = 2.f * u.x - 1.f;
+    float b = 2.f * u.y - 1.f;
+    bool horizontal = std::fabs(a) > std::fabs(b);
+    // at the center a = b = 0, r is 0 and phi does not matter
+    float r = horizontal ? a : b;
+    float phi = horizontal ? (Pi / 4.f) * (b / a) : (b != 0.f ? (Pi / 2.f) - (Pi / 4.f) * (a / b) : 0.f);
+    return Vec3(r * std::cos(phi), r * std::sin(phi), 0.f);
+}
+
+// Uniform direction on the unit sphere
+inline Vec3 squareToUniformSphere(const Point2f& u) {
+    float z = 1.f - 2.f * u.x;
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = 2.f * Pi * u.y;
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Uniform point inside the unit ball, a uniform direction scaled by the cube root of w
+inline Vec3 squareToUniformBall(const Point2f& u, float w) {
+    return std::cbrt(w) * squareToUniformSphere(u);
+}
+
+// Cosine weighted direction on the hemisphere around +z, Malley's method: a uniform
+// point of the disk projected up onto the hemisphere
+inline Vec3 squareToCosineHemisphere(const Point2f& u) {
+    Vec3 d = squareToConcentricDisk(u);
+    float z = std::sqrt(std::max(0.f, 1.f - d.x() * d.x() - d.y() * d.y()));
+    return Vec3(d.x(), d.y(), z);
+}
+
+inline float cosineHemispherePdf(float cosTheta) { return cosTheta * InvPi; }
+
+// sin and cos of angles of any sign. The angle is reduced to [-pi/4, pi/4] around the
+// nearest quarter turn, evaluated with Taylor polynomials (error below 4e-7) and
+// rotated back into its quadrant.
+inline void vsincos(const vfloat& angle, vfloat& s, vfloat& c) {
+    vfloat turns = angle * vfloat(0.5f * InvPi);
+    vfloat q = vfloor(turns * 4.f + 0.5f);
+    vfloat a = (turns - q * 0.25f) * vfloat(2.f * Pi);
+    vfloat a2 = a * a;
+    vfloat sa = a * (1.f + a2 * (-1.f / 6.f + a2 * (1.f / 120.f + a2 * (-1.f / 5040.f))));
+    vfloat ca = 1.f + a2 * (-0.5f + a2 * (1.f / 24.f + a2 * (-1.f / 720.f + a2 * (1.f / 40320.f))));
+    // quadrant 0..3, then sin(a + q pi/2) and cos(a + q pi/2)
+    vfloat quadrant = q - vfloor(q * 0.25f) * 4.f;
+    vmask odd = ((quadrant > 0.5f) & (quadrant < 1.5f)) | (quadrant > 2.5f);
+    vmask negateSin = quadrant > 1.5f;
+    vmask negateCos = (quadrant > 0.5f) & (quadrant < 2.5f);
+    vfloat sr = select(odd, ca, sa);
+    vfloat cr = select(odd, sa, ca);
+    s = select(negateSin, -sr, sr);
+    c = select(negateCos, -cr, cr);
+}
+
+inline void squareToConcentricDisk(const vfloat& ux, const vfloat& uy, vfloat& x, vfloat& y) {
+    vfloat a = 2.f * ux - 1.f;
+    vfloat b = 2.f * uy - 1.f;
+    vfloat absA = vmax(a, -a), absB = vmax(b, -b);
+    vmask horizontal = absA > absB;
+    vmask zero = (absA <= 0.f) & (absB <= 0.f);
+    // the division of the unused branch may be 0 / 0, replaced below
+    vfloat r = select(horizontal, a, b);
+    vfloat phi = select(horizontal, (Pi / 4.f) * (b / a), (Pi / 2.f) - (Pi / 4.f) * (a / b));
+    phi = select(zero, vfloat(0.f), phi);
+    vfloat s, c;
+    vsincos(phi, s, c);
+    x = r * c;
+    y = r * s;
+}
+
+inline void squareToUniformSphere(const vfloat& ux, const vfloat& uy, vfloat& x, vfloat& y, vfloat& z) {
+    z = 1.f - 2.f * ux;
+    vfloat r = vsqrt(vmax(vfloat(0.f), 1.f - z * z));
+    vfloat s, c;
+    vsincos((2.f * Pi) * uy, s, c);
+    x = r * c;
+    y = r * s;
+}
+
+inline void squareToCosineHemisphere(const vfloat& ux, const vfloat& uy, vfloat& x, vfloat& y, vfloat& z) {
+    squareToConcentricDisk(ux, uy, x, y);
+    z = vsqrt(vmax(vfloat(0.f), 1.f - x * x - y * y));
+}
+
+// Batch versions over arrays of n points. The tail that does not fill a whole vector is
+// padded with zeros and only the valid lanes are written back.
+template <typename Warp>
+inline void warpBatch(const float* ux, const float* uy, int n, float* x, float* y, float* z, Warp warp) {
+    int i = 0;
+    for (; i + RT_SIMD_WIDTH <= n; i += RT_SIMD_WIDTH) {
+        vfloat vx, vy, vz(0.f);
+        warp(vfloat::load(ux + i), vfloat::load(uy + i), vx, vy, vz);
+        vx.store(x + i);
+        vy.store(y + i);
+        if (z) vz.store(z + i);
+    }
+    if (i < n) {
+        alignas(32) float tx[RT_SIMD_WIDTH] = {}, ty[RT_SIMD_WIDTH] = {};
+        alignas(32) float rx[RT_SIMD_WIDTH], ry[RT_SIMD_WIDTH], rz[RT_SIMD_WIDTH];
+        for (int k = 0; k < RT_SIMD_WIDTH && i + k < n; k++) { tx[k] = ux[i + k]; ty[k] = uy[i + k]; }
+        vfloat vx, vy, vz(0.f);
+        warp(vfloat::load(tx), vfloat::load(ty), vx, vy, vz);
+        vx.store(rx); vy.store(ry); vz.store(rz);
+        for (int k = 0; k < RT_SIMD_WIDTH && i + k < n; k++) {
+            x[i + k] = rx[k];
+            y[i + k] = ry[k];
+            if (z) z[i + k] = rz[k];
+        }
+    }
+}
+
+inline void squareToConcentricDisk(const float* ux, const float* uy, int n, float* x, float* y) {
+    warpBatch(ux, uy, n, x, y, nullptr, [](const vfloat& u, const vfloat& v, vfloat& wx, vfloat& wy, vfloat&) {
+        squareToConcentricDisk(u, v, wx, wy);
+    });
+}
+
+inline void squareToUniformSphere(const float* ux, const float* uy, int n, float* x, float* y, float* z) {
+    warpBatch(ux, uy, n, x, y, z, [](const vfloat& u, const vfloat& v, vfloat& wx, vfloat& wy, vfloat& wz) {
+        squareToUniformSphere(u, v, wx, wy, wz);
+    });
+}
+
+inline void squareToCosineHemisphere(const float* ux, const float* uy, int n, float* x, float* y, float* z) {
+    warpBatch(ux, uy, n, x, y, z, [](const vfloat& u, const vfloat& v, vfloat& wx, vfloat& wy, vfloat& wz) {
+        squareToCosineHemisphere(u, v, wx, wy, wz);
+    });
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef __WAVEFRONT_H__
+#define __WAVEFRONT_H__
+
+#pragma once
+#include "camera.h"
+#include "shape.h"
+#include "material.h"
+#include "integrator.h"
+#include "framebuffer.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Breadth first path tracer. Instead of following one path to its end, a large queue of
+// paths is advanced one bounce at a time in separate stages:
+//   1. refill the queue with new camera paths
+//   2. intersect every path in the queue
+//   3. terminate misses with the sky, add emission and sort the hits by material type
+//   4. sample a light and the BSDF of each material type as its own batch, calling the
+//      concrete class directly so the loop body is homogeneous and free of virtual dispatch
+//   5. compact the queue, adding finished paths to their pixels
+// A path keeps its pixel, sample index and sampler dimension between the stages and
+// resumes the sampler with them, so every sample traces the same path whatever the queue
+// size or the number of threads. Finished paths are added to their pixels in the order
+// they finish, which depends on the queue size, so the image is only bit for bit the same
+// across thread counts. Traits selects the specialized kernel, see KernelTraits.
+class WavefrontRenderer
+{
+public:
+    WavefrontRenderer(int nx, int ny, int ns, int queueSize = 1 << 17)
+        : mWidth(nx), mHeight(ny), mSamples(ns), mQueueSize(std::max(queueSize, 1)) {}
+
+    template <typename Traits = GenericKernel>
+    void render(const Camera& camera, const Shape& world, const PathIntegrator& integrator, const Sampler& sampler,
+                ThreadPool& pool, Framebuffer& framebuffer) const {
+        std::vector<std::unique_ptr<Sampler>> samplers(pool.size());
+        for (auto& s : samplers) s = sampler.clone();
+        const int64_t totalSamples = (int64_t)mWidth * mHeight * mSamples;
+        int64_t nextSample = 0;
+        std::vector<PathState> paths;
+        paths.reserve(mQueueSize);
+        std::vector<HitRecord> hits(mQueueSize);
+        std::vector<char> hitFlags(mQueueSize);
+        std::vector<int> queues[MaterialTypeCount];
+        std::vector<Vec3> accum(mWidth * mHeight, Vec3(0.f));
+
+        for (;;) {
+            // 1. refill
+            int start = (int)paths.size();
+            int fresh = (int)std::min<int64_t>(mQueueSize - start, totalSamples - nextSample);
+            paths.resize(start + fresh);
+            forChunks(pool, fresh, [&](int begin, int end, int threadId) {
+                for (int k = begin; k < end; k++)
+                    startPath<Traits>(paths[start + k], nextSample + k, camera, *samplers[threadId]);
+            });
+            nextSample += fresh;
+            if (paths.empty()) break;
+
+            // 2. intersect
+            int n = (int)paths.size();
+            forChunks(pool, n, [&](int begin, int end, int) {
+                for (int i = begin; i < end; i++) {
+                    RT_STATS_ADD(primaryRays, paths[i].bounce == 0);
+                    RT_STATS_ADD(secondaryRays, paths[i].bounce != 0);
+                    RT_STATS_PHASE(PhaseIntersect);
+                    hitFlags[i] = world.intersect(paths[i].ray, 0.001f, FLT_MAX, hits[i]);
+                }
+            });
+
+            // 3. shade misses and emitters, sort hits by material
+            for (int t = 0; t < MaterialTypeCount; t++) queues[t].clear();
+            for (int i = 0; i < n; i++) {
+                PathState& path = paths[i];
+                if (!hitFlags[i]) {
+                    path.L += path.throughput * PathIntegrator::background(path.ray);
+                    path.alive = false;
+                    continue;
+                }
+                path.L += path.throughput * integrator.emitted<Traits>(hits[i], -path.ray.d.normalized(), path.ray.o,
+                                                               path.bsdfPdf, path.specular);
+                if (path.bounce >= integrator.maxDepth) {
+                    path.alive = false;
+                } else {
+                    queues[hits[i].material->type()].push_back(i);
+                }
+            }
+
+            // 4. scatter, one homogeneous batch per material type
+            scatterBatch<Traits, Lambertian>(pool, queues[MaterialLambertian], paths, hits, world, integrator, samplers);
+            scatterBatch<Traits, Metal>(pool, queues[MaterialMetal], paths, hits, world, integrator, samplers);
+            scatterBatch<Traits, Dielectric>(pool, queues[MaterialDielectric], paths, hits, world, integrator, samplers);
+            scatterBatch<Traits, Emissive>(pool, queues[MaterialEmissive], paths, hits, world, integrator, samplers);
+            scatterBatch<Traits, Material>(pool, queues[MaterialOther], paths, hits, world, integrator, samplers);
+
+            // 5. compact
+            int alive = 0;
+            for (int i = 0; i < n; i++) {
+                if (paths[i].alive) {
+                    paths[alive++] = paths[i];
+                } else {
+                    accum[paths[i].pixel] += paths[i].L;
+                    RT_STATS_PATH(paths[i].bounce);
+                }
+            }
+            paths.resize(alive);
+        }
+
+        for (int p = 0; p < mWidth * mHeight; p++)
+            framebuffer.pixels[p] = accum[p] / float(mSamples);
+    }
+
+private:
+    struct PathState
+    {
+        Ray ray;
+        Vec3 throughput;
+        Vec3 L;
+        // the BSDF sample that led to the next hit, for the MIS weight of its emission
+        float bsdfPdf;
+        bool specular;
+        int pixel;
+        int sampleIndex;
+        int dimension;
+        int bounce;
+        bool alive;
+    };
+
+    static const int ChunkSize = 1024;
+
+    template <typename Func>
+    static void forChunks(ThreadPool& pool, int count, Func func) {
+        int nChunks = (count + ChunkSize - 1) / ChunkSize;
+        pool.parallelFor(nChunks, [&](int chunk, int threadId) {
+            func(chunk * ChunkSize, std::min(count, (chunk + 1) * ChunkSize), threadId);
+        });
+    }
+
+    template <typename Traits>
+    void startPath(PathState& path, int64_t sample, const Camera& camera, Sampler& sampler) const {
+        path.pixel = (int)(sample / mSamples);
+        path.sampleIndex = (int)(sample % mSamples);
+        int i = path.pixel % mWidth;
+        int j = path.pixel / mWidth;
+        sampler.startPixelSample(i, j, path.sampleIndex);
+        Point2f p = sampler.get2D();
+        float u = (float(i + p.x) / float(mWidth));
+        float v = (float(j + p.y) / float(mHeight));
+        path.ray = camera.generateRay(u, v, sampler, typename Traits::Lens());
+        path.dimension = sampler.dimension();
+        path.throughput = Vec3(1.f);
+        path.L = Vec3(0.f);
+        path.bsdfPdf = 0.f;
+        path.specular = true;
+        path.bounce = 0;
+        path.alive = true;
+    }
+
+    // qualified call, resolved at compile time for the concrete material classes
+    template <typename M>
+    static bool sample(const M* m, const HitRecord& hit, const Vec3& wo, Sampler& sampler, BSDFSample& bs) {
+        return m->M::sample(hit, wo, sampler, bs);
+    }
+
+    // materials outside the known set go through the virtual call
+    static bool sample(const Material* m, const HitRecord& hit, const Vec3& wo, Sampler& sampler, BSDFSample& bs) {
+        return m->sample(hit, wo, sampler, bs);
+    }
+
+    template <typename Traits, typename M>
+    void scatterBatch(ThreadPool& pool, const std::vector<int>& queue, std::vector<PathState>& paths,
+                      const std::vector<HitRecord>& hits, const Shape& world, const PathIntegrator& integrator,
+                      const std::vector<std::unique_ptr<Sampler>>& samplers) const {
+        forChunks(pool, (int)queue.size(), [&](int begin, int end, int threadId) {
+            Sampler& sampler = *samplers[threadId];
+            for (int k = begin; k < end; k++) {
+                int i = queue[k];
+                PathState& path = paths[i];
+                sampler.startPixelSample(path.pixel % mWidth, path.pixel / mWidth, path.sampleIndex, path.dimension);
+                Vec3 wo = -path.ray.d.normalized();
+                {
+                    RT_STATS_PHASE(PhaseLights);
+                    path.L += path.throughput * integrator.sampleLight<Traits>(hits[i], wo, world, sampler);
+                }
+                RT_STATS_PHASE(PhaseBSDF);
+                BSDFSample bs;
+                bool scattered = sample(static_cast<const M*>(hits[i].material), hits[i], wo, sampler, bs);
+                RT_STATS_MATERIAL(hits[i].material->type(), scattered);
+                if (!scattered) {
+                    path.alive = false;
+                    continue;
+                }
+                path.throughput = path.throughput * bs.weight;
+                path.bounce++;
+                if (!integrator.survives(path.throughput, path.bounce, sampler)) {
+                    RT_STATS_ADD(rouletteKills, 1);
+                    path.alive = false;
+                    continue;
+                }
+                path.bsdfPdf = bs.pdf;
+                path.specular = bs.specular;
+                path.ray = Ray(hits[i].position, bs.wi);
+                path.dimension = sampler.dimension();
+            }
+        });
+    }
+
+    int mWidth;
+    int mHeight;
+    int mSamples;
+    int mQueueSize;
+};
+
+#endif
@@ -0,0 +1,1174 @@
+//
+// benchmark.cpp
+// Micro benchmarks for the raytracer kernels. Pass a substring as the first argument
+// to only run the benchmarks whose name contains it.
+//
+
+#include "../Project2/vec3.h"
+#include "../Project2/vec3sse.h"
+#include "../Project2/pcg32.h"
+#include "../Project2/sampler.h"
+#include "../Project2/warp.h"
+#include "../Project2/timer.h"
+#include "../Project2/camera.h"
+#include "../Project2/shape.h"
+#include "../Project2/bvh.h"
+#include "../Project2/spheresoa.h"
+#include "../Project2/material.h"
+#include "../Project2/scene.h"
+#include "../Project2/meshio.h"
+#include "../Project2/scenecache.h"
+#include "../Project2/integrator.h"
+#include "../Project2/threadpool.h"
+#include "../Project2/framebuffer.h"
+#include "../Project2/renderer.h"
+#include "../Project2/wavefront.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// keeps the optimizer from discarding benchmark results
+static volatile float gSink;
+
+static bool shouldRun(const std::string& filter, const std::string& name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+static void report(const std::string& name, double seconds, double operations) {
+    std::printf("%-40s %10.3f ms %10.3f ns/op %10.2f Mops/s\n", name.c_str(), seconds * 1000.0,
+        seconds * 1e9 / operations, operations / seconds * 1e-6);
+}
+
+// Runs func(iterations) until at least minSeconds have elapsed and returns seconds per iteration
+template <typename Func>
+static double measure(Func func, double minSeconds = 0.2) {
+    func(1);
+    long long iterations = 1;
+    for (;;) {
+        Timer timer;
+        func(iterations);
+        double elapsed = timer.elapsedSeconds();
+        if (elapsed >= minSeconds) return elapsed / iterations;
+        iterations *= 2;
+    }
+}
+
+// Alternates two measurements and keeps the best time of each, for differences that are
+// small against the noise of the machine
+template <typename FuncA, typename FuncB>
+static void measurePair(FuncA funcA, FuncB funcB, double& secondsA, double& secondsB, int rounds = 5) {
+    secondsA = secondsB = 1e30;
+    for (int round = 0; round < rounds; round++) {
+        secondsA = std::min(secondsA, measure(funcA, 0.3));
+        secondsB = std::min(secondsB, measure(funcB, 0.3));
+    }
+}
+
+// Pixels that are not bit identical between two images
+static int differingPixels(const Framebuffer& a, const Framebuffer& b) {
+    int n = 0;
+    for (size_t p = 0; p < a.pixels.size(); p++) n += a.pixels[p] == b.pixels[p] ? 0 : 1;
+    return n;
+}
+
+// ---------------------------------------------------------------------------------------
+// Vec3 scalar vs SSE
+// ---------------------------------------------------------------------------------------
+
+template <typename V>
+static std::vector<V> randomVectors(int n) {
+    pcg32 rng;
+    rng.seed(1u, 1u);
+    std::vector<V> vectors;
+    vectors.reserve(n);
+    for (int i = 0; i < n; i++)
+        vectors.push_back(V(rng.nextFloat() + 0.1f, rng.nextFloat() + 0.1f, rng.nextFloat() + 0.1f));
+    return vectors;
+}
+
+template <typename V>
+static void benchVec3Ops(const std::string& filter, const std::string& prefix, double results[5]) {
+    const int n = 4096;
+    std::vector<V> a = randomVectors<V>(n);
+    std::vector<V> b = randomVectors<V>(n);
+    std::vector<V> out(n);
+
+    if (shouldRun(filter, prefix + "/add_mul")) {
+        results[0] = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++)
+                for (int i = 0; i < n; i++) out[i] = (a[i] + b[i]) * 0.5f - a[i] * b[i];
+            gSink = out[n - 1].x();
+        });
+        report(prefix + "/add_mul", results[0], n);
+    }
+    if (shouldRun(filter, prefix + "/dot")) {
+        results[1] = measure([&](long long iterations) {
+            float sum = 0.f;
+            for (long long it = 0; it < iterations; it++)
+                for (int i = 0; i < n; i++) sum += a[i].dot(b[i]);
+            gSink = sum;
+        });
+        report(prefix + "/dot", results[1], n);
+    }
+    if (shouldRun(filter, prefix + "/cross")) {
+        results[2] = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++)
+                for (int i = 0; i < n; i++) out[i] = a[i].cross(b[i]);
+            gSink = out[n - 1].x();
+        });
+        report(prefix + "/cross", results[2], n);
+    }
+    if (shouldRun(filter, prefix + "/length")) {
+        results[3] = measure([&](long long iterations) {
+            float sum = 0.f;
+            for (long long it = 0; it < iterations; it++)
+                for (int i = 0; i < n; i++) sum += a[i].length();
+            gSink = sum;
+        });
+        report(prefix + "/length", results[3], n);
+    }
+    if (shouldRun(filter, prefix + "/normalized")) {
+        results[4] = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++)
+                for (int i = 0; i < n; i++) out[i] = a[i].normalized();
+            gSink = out[n - 1].x();
+        });
+        report(prefix + "/normalized", results[4], n);
+    }
+}
+
+static void benchVec3(const std::string& filter) {
+    static const char* ops[5] = { "add_mul", "dot", "cross", "length", "normalized" };
+    double scalar[5] = { 0.0 }, sse[5] = { 0.0 };
+    benchVec3Ops<Vec3Scalar>(filter, "vec3/scalar", scalar);
+#if defined(RT_HAS_SSE)
+    benchVec3Ops<Vec3SSE>(filter, "vec3/sse", sse);
+    for (int i = 0; i < 5; i++)
+        if (scalar[i] > 0.0 && sse[i] > 0.0)
+            std::printf("vec3/%-35s SSE speedup %.2fx\n", ops[i], scalar[i] / sse[i]);
+#endif
+}
+
+// ---------------------------------------------------------------------------------------
+// Scenes
+// ---------------------------------------------------------------------------------------
+
+// The scene of the renderer, initRandomScene with its default seed
+static void buildSphereScene(Scene& scene, int nSpheres) {
+    pcg32 rng;
+    rng.seed(42u, 64u);
+    initRandomScene(rng, scene, nSpheres);
+}
+
+static Camera benchmarkCamera(int nx, int ny) {
+    return Camera(Vec3(13.f, 2.f, 3.f), Vec3(0.f), Vec3(0.f, 1.f, 0.f), 20.f, float(nx) / float(ny), 0.f, 9.f);
+}
+
+// ---------------------------------------------------------------------------------------
+// Camera rays, scalar vs packets
+// ---------------------------------------------------------------------------------------
+
+// Traces RT_SIMD_WIDTH jittered camera rays per pixel of a small frame, either one by one
+// or as a single packet, and reports primary rays per second.
+static void benchPrimaryRays(const std::string& filter, const std::string& name, const Shape& world) {
+    const int nx = 100, ny = 50;
+    Camera camera = benchmarkCamera(nx, ny);
+    std::vector<Ray> rays;
+    pcg32 rng;
+    rng.seed(3u, 5u);
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+            for (int k = 0; k < RT_SIMD_WIDTH; k++)
+                rays.push_back(camera.generateRay((i + rng.nextFloat()) / nx, (j + rng.nextFloat()) / ny));
+    const double nRays = (double)rays.size();
+
+    double scalar = 0.0, packet = 0.0;
+    if (shouldRun(filter, "primary/scalar/" + name)) {
+        scalar = measure([&](long long iterations) {
+            int hits = 0;
+            for (long long it = 0; it < iterations; it++) {
+                for (size_t r = 0; r < rays.size(); r++) {
+                    HitRecord record;
+                    hits += world.intersect(rays[r], 0.001f, FLT_MAX, record);
+                }
+            }
+            gSink = (float)hits;
+        });
+        report("primary/scalar/" + name, scalar, nRays);
+    }
+    if (shouldRun(filter, "primary/packet/" + name)) {
+        vmask active(true);
+        packet = measure([&](long long iterations) {
+            int hits = 0;
+            for (long long it = 0; it < iterations; it++) {
+                for (size_t r = 0; r < rays.size(); r += RT_SIMD_WIDTH) {
+                    RayPacket p;
+                    for (int k = 0; k < RT_SIMD_WIDTH; k++) p.set(k, rays[r + k]);
+                    PacketHitRecord records(FLT_MAX);
+                    hits += world.intersect(p, 0.001f, active, records).bits();
+                }
+            }
+            gSink = (float)hits;
+        });
+        report("primary/packet/" + name, packet, nRays);
+    }
+    if (scalar > 0.0 && packet > 0.0)
+        std::printf("primary/%-34s packet speedup %.2fx (%d lanes)\n", name.c_str(), scalar / packet, RT_SIMD_WIDTH);
+}
+
+static void benchPackets(const std::string& filter) {
+    Scene scene;
+    buildSphereScene(scene, 500);
+    const ShapeList& list = scene.shapes;
+    BVH bvh(list);
+    benchPrimaryRays(filter, "list", list);
+    benchPrimaryRays(filter, "bvh", bvh);
+}
+
+// ---------------------------------------------------------------------------------------
+// ShapeList vs SphereSoA
+// ---------------------------------------------------------------------------------------
+
+static double benchClosestHit(const std::string& name, const Shape& world, const std::vector<Ray>& rays) {
+    double seconds = measure([&](long long iterations) {
+        int hits = 0;
+        for (long long it = 0; it < iterations; it++) {
+            for (size_t r = 0; r < rays.size(); r++) {
+                HitRecord record;
+                hits += world.intersect(rays[r], 0.001f, FLT_MAX, record);
+            }
+        }
+        gSink = (float)hits;
+    });
+    report(name, seconds, (double)rays.size());
+    return seconds;
+}
+
+static void benchSphereSoA(const std::string& filter) {
+    const int sizes[2] = { 500, 5000 };
+    for (int s = 0; s < 2; s++) {
+        std::string suffix = "/" + std::to_string(sizes[s]);
+        if (!shouldRun(filter, "closesthit/soa" + suffix) && !shouldRun(filter, "closesthit/list" + suffix)) continue;
+        Scene scene;
+        buildSphereScene(scene, sizes[s]);
+        const ShapeList& list = scene.shapes;
+        SphereSoA soa;
+        soa.build(list);
+
+        const int nx = 40, ny = 20;
+        Camera camera = benchmarkCamera(nx, ny);
+        std::vector<Ray> rays;
+        for (int j = 0; j < ny; j++)
+            for (int i = 0; i < nx; i++)
+                rays.push_back(camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny));
+
+        double listTime = benchClosestHit("closesthit/list" + suffix, list, rays);
+        double soaTime = benchClosestHit("closesthit/soa" + suffix, soa, rays);
+        std::printf("closesthit/soa%-29s speedup %.2fx (%d spheres per iteration)\n", suffix.c_str(),
+            listTime / soaTime, SphereSoA::BlockSize);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Eager vs deferred hit shading
+// ---------------------------------------------------------------------------------------
+
+// The Sphere::intersect and ShapeList::intersect the renderer used before hits were
+// shaded once at the end: every candidate computes its position, normal and material
+// and the whole record is copied when it is closer.
+static bool eagerSphereIntersect(const Sphere& sphere, const Ray& ray, float minT, float maxT, HitRecord& record) {
+    Vec3 oc = ray.o - sphere.center;
+    float a = ray.d.dot(ray.d);
+    float b = 2.0f * ray.d.dot(oc);
+    float c = oc.dot(oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - 4 * a * c;
+    if (discriminant < 0.0f) return false;
+    float t1 = (-b - std::sqrt(discriminant)) / (2.0f * a);
+    if (t1 >= 0.0f && t1 >= minT && t1 <= maxT) record.t = t1;
+    else {
+        float t2 = (-b + std::sqrt(discriminant)) / (2.0f * a);
+        if (t2 >= 0.0f && t2 >= minT && t2 <= maxT) record.t = t2;
+        else return false;
+    }
+    record.position = ray(record.t);
+    record.normal = (record.position - sphere.center).normalized();
+    record.material = sphere.material;
+    return true;
+}
+
+static bool eagerListIntersect(const std::vector<const Sphere*>& spheres, const Ray& r, HitRecord& record, long long& shaded) {
+    HitRecord tempRec;
+    float minDistance = FLT_MAX;
+    bool hitAnything = false;
+    for (const Sphere* s : spheres) {
+        if (eagerSphereIntersect(*s, r, 0.001f, minDistance, tempRec)) {
+            minDistance = tempRec.t;
+            hitAnything = true;
+            record = tempRec;
+            shaded++;
+        }
+    }
+    return hitAnything;
+}
+
+// The same loop with the current two phase Sphere, shading once at the end. Both loops
+// call the spheres directly so only the shading work differs.
+static bool deferredListIntersect(const std::vector<const Sphere*>& spheres, const Ray& r, HitRecord& record) {
+    float minDistance = FLT_MAX;
+    bool hitAnything = false;
+    for (const Sphere* s : spheres) {
+        if (s->Sphere::hit(r, 0.001f, minDistance, record)) {
+            minDistance = record.t;
+            hitAnything = true;
+        }
+    }
+    if (hitAnything) static_cast<const Sphere*>(record.shape)->Sphere::computeSurface(r, record);
+    return hitAnything;
+}
+
+// Closest hits through a list of spheres, shading every candidate against shading only
+// the final hit.
+static void benchDeferredShading(const std::string& filter) {
+    const int sizes[2] = { 500, 5000 };
+    for (int s = 0; s < 2; s++) {
+        std::string name = "deferred/list/" + std::to_string(sizes[s]);
+        if (!shouldRun(filter, name)) continue;
+        Scene scene;
+        buildSphereScene(scene, sizes[s]);
+        const ShapeList& list = scene.shapes;
+        std::vector<const Sphere*> spheres;
+        for (auto& o : list.mObjects) spheres.push_back(static_cast<const Sphere*>(o));
+
+        // camera rays and, for every primary hit, a diffuse bounce
+        const int nx = 40, ny = 20;
+        Camera camera = benchmarkCamera(nx, ny);
+        pcg32 rng;
+        rng.seed(13u, 13u);
+        std::vector<Ray> rays;
+        for (int j = 0; j < ny; j++)
+            for (int i = 0; i < nx; i++) {
+                Ray r = camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny);
+                rays.push_back(r);
+                HitRecord record;
+                if (list.intersect(r, 0.001f, FLT_MAX, record))
+                    rays.push_back(Ray(record.position, record.normal + squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat()))));
+            }
+
+        long long shaded = 0, hits = 0;
+        for (const Ray& r : rays) {
+            HitRecord record;
+            eagerListIntersect(spheres, r, record, shaded);
+            hits += list.intersect(r, 0.001f, FLT_MAX, record);
+        }
+
+        double eager = measure([&](long long iterations) {
+            long long count = 0;
+            for (long long it = 0; it < iterations; it++)
+                for (const Ray& r : rays) {
+                    HitRecord record;
+                    eagerListIntersect(spheres, r, record, count);
+                }
+            gSink = (float)count;
+        });
+        report(name + "/eager", eager, (double)rays.size());
+        double deferred = measure([&](long long iterations) {
+            int count = 0;
+            for (long long it = 0; it < iterations; it++)
+                for (const Ray& r : rays) {
+                    HitRecord record;
+                    count += deferredListIntersect(spheres, r, record);
+                }
+            gSink = (float)count;
+        });
+        report(name + "/deferred", deferred, (double)rays.size());
+        std::printf("%-40s speedup %.2fx (%lld of %lld surface computations avoided)\n", name.c_str(), eager / deferred,
+            shaded - hits, shaded);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Shadow rays, closest hit vs any hit
+// ---------------------------------------------------------------------------------------
+
+struct ShadowRay
+{
+    Ray ray;
+    float distance;
+};
+
+// Shadow rays from the primary hits of a small frame towards random points of an area
+// light above the scene, the workload next event estimation generates at every vertex.
+static std::vector<ShadowRay> shadowRays(const Shape& world, int nx, int ny) {
+    Camera camera = benchmarkCamera(nx, ny);
+    pcg32 rng;
+    rng.seed(11u, 11u);
+    std::vector<ShadowRay> rays;
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++) {
+            HitRecord record;
+            if (!world.intersect(camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny), 0.001f, FLT_MAX, record)) continue;
+            Vec3 target(-4.f + 8.f * rng.nextFloat(), 8.f, -4.f + 8.f * rng.nextFloat());
+            Vec3 d = target - record.position;
+            ShadowRay shadow;
+            shadow.distance = d.length();
+            shadow.ray = Ray(record.position, d / shadow.distance);
+            rays.push_back(shadow);
+        }
+    return rays;
+}
+
+static double benchShadowQuery(const std::string& name, const Shape& world, const std::vector<ShadowRay>& rays, bool anyHit) {
+    double seconds = measure([&](long long iterations) {
+        int blocked = 0;
+        for (long long it = 0; it < iterations; it++) {
+            for (size_t r = 0; r < rays.size(); r++) {
+                if (anyHit) {
+                    blocked += world.occluded(rays[r].ray, 0.001f, rays[r].distance);
+                } else {
+                    HitRecord record;
+                    blocked += world.intersect(rays[r].ray, 0.001f, rays[r].distance, record);
+                }
+            }
+        }
+        gSink = (float)blocked;
+    });
+    report(name, seconds, (double)rays.size());
+    return seconds;
+}
+
+static void benchShadowRays(const std::string& filter) {
+    const int sizes[2] = { 500, 5000 };
+    for (int s = 0; s < 2; s++) {
+        std::string suffix = "/" + std::to_string(sizes[s]);
+        if (!shouldRun(filter, "shadow/")) continue;
+        Scene scene;
+        buildSphereScene(scene, sizes[s]);
+        const ShapeList& list = scene.shapes;
+        SphereSoA soa;
+        soa.build(list);
+        BVH bvh(list);
+        std::vector<ShadowRay> rays = shadowRays(bvh, 40, 20);
+        int blocked = 0;
+        for (auto& r : rays) blocked += bvh.occluded(r.ray, 0.001f, r.distance);
+
+        const Shape* worlds[3] = { &list, &soa, &bvh };
+        const char* names[3] = { "list", "soa", "bvh" };
+        for (int w = 0; w < 3; w++) {
+            std::string name = std::string("shadow/") + names[w] + suffix;
+            if (!shouldRun(filter, name)) continue;
+            double closest = benchShadowQuery(name + "/closesthit", *worlds[w], rays, false);
+            double any = benchShadowQuery(name + "/occluded", *worlds[w], rays, true);
+            std::printf("%-40s speedup %.2fx (%.0f%% of the rays blocked)\n", name.c_str(), closest / any,
+                100.0 * blocked / rays.size());
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Triangle meshes, load time and traversal
+// ---------------------------------------------------------------------------------------
+
+// Writes a torus of 2 * rings * sides triangles as an OBJ with v//vn corners and as a
+// little endian PLY with the same vertices and quad faces
+static void writeTorus(const std::string& objFile, const std::string& plyFile, int rings, int sides) {
+    std::vector<float> vertices;
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            float u = 2.f * Pi * i / rings, v = 2.f * Pi * j / sides;
+            float c = 1.f + 0.4f * std::cos(v);
+            float data[6] = { c * std::cos(u), 0.4f * std::sin(v), c * std::sin(u),
+                              std::cos(v) * std::cos(u), std::sin(v), std::cos(v) * std::sin(u) };
+            vertices.insert(vertices.end(), data, data + 6);
+        }
+    }
+    auto quad = [&](int i, int j, int q[4]) {
+        q[0] = i * sides + j;
+        q[1] = i * sides + (j + 1) % sides;
+        q[2] = (i + 1) % rings * sides + (j + 1) % sides;
+        q[3] = (i + 1) % rings * sides + j;
+    };
+    FILE* obj = std::fopen(objFile.c_str(), "w");
+    for (size_t v = 0; v < vertices.size(); v += 6) std::fprintf(obj, "v %.6f %.6f %.6f\n", vertices[v], vertices[v + 1], vertices[v + 2]);
+    for (size_t v = 0; v < vertices.size(); v += 6) std::fprintf(obj, "vn %.6f %.6f %.6f\n", vertices[v + 3], vertices[v + 4], vertices[v + 5]);
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            int q[4];
+            quad(i, j, q);
+            std::fprintf(obj, "f %d//%d %d//%d %d//%d %d//%d\n", q[0] + 1, q[0] + 1, q[1] + 1, q[1] + 1, q[2] + 1, q[2] + 1, q[3] + 1, q[3] + 1);
+        }
+    }
+    std::fclose(obj);
+
+    FILE* ply = std::fopen(plyFile.c_str(), "wb");
+    std::fprintf(ply, "ply\nformat binary_little_endian 1.0\nelement vertex %d\nproperty float x\nproperty float y\nproperty float z\n"
+        "property float nx\nproperty float ny\nproperty float nz\nelement face %d\nproperty list uchar int vertex_indices\nend_header\n",
+        rings * sides, rings * sides);
+    std::fwrite(vertices.data(), sizeof(float), vertices.size(), ply);
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            int q[4];
+            quad(i, j, q);
+            unsigned char count = 4;
+            std::fwrite(&count, 1, 1, ply);
+            std::fwrite(q, sizeof(int), 4, ply);
+        }
+    }
+    std::fclose(ply);
+}
+
+// Loads a torus of about a million triangles from OBJ and binary PLY with one thread and
+// with all of them, then traces camera rays through a BVH over the loaded mesh.
+static void benchMesh(const std::string& filter) {
+    if (!shouldRun(filter, "mesh/")) return;
+    const std::string objFile = "benchmark_mesh.obj", plyFile = "benchmark_mesh.ply";
+    writeTorus(objFile, plyFile, 1024, 512);
+    const int nThreads = ThreadPool::defaultThreadCount();
+    const char* formats[2] = { "obj", "ply" };
+    const std::string files[2] = { objFile, plyFile };
+    for (int f = 0; f < 2; f++) {
+        double single = 0.0;
+        for (int threads = 1; ; threads = nThreads) {
+            std::string name = std::string("mesh/load/") + formats[f] + "/" + std::to_string(threads);
+            if (shouldRun(filter, name)) {
+                ThreadPool pool(threads);
+                TriangleMesh mesh;
+                std::string error;
+                int triangles = 0;
+                double seconds = measure([&](long long iterations) {
+                    for (long long it = 0; it < iterations; it++) {
+                        if (!loadMesh(files[f], mesh, pool, error)) std::printf("%s\n", error.c_str());
+                        triangles = mesh.numTriangles();
+                    }
+                }, 1.0);
+                report(name, seconds, triangles);
+                if (threads == 1) single = seconds;
+                else if (single > 0.0) std::printf("%-40s speedup %.2fx with %d threads\n", name.c_str(), single / seconds, threads);
+            }
+            if (threads == nThreads) break;
+        }
+    }
+
+    if (shouldRun(filter, "mesh/rays/bvh")) {
+        ThreadPool pool(nThreads);
+        std::unique_ptr<TriangleMesh> mesh(new TriangleMesh());
+        std::string error;
+        if (loadMesh(plyFile, *mesh, pool, error)) {
+            Scene scene;
+            initMeshScene(scene, mesh.release());
+            Timer buildTimer;
+            BVH bvh(scene.shapes);
+            std::printf("%-40s %10.3f ms for %d triangles\n", "mesh/bvh/build", buildTimer.elapsedMilliseconds(),
+                scene.meshes[0]->numTriangles());
+            const int nx = 200, ny = 100;
+            Camera camera(Vec3(3.f, 2.f, 5.f), Vec3(0.f, 0.9f, 0.f), Vec3(0.f, 1.f, 0.f), 30.f, float(nx) / float(ny), 0.f, 9.f);
+            std::vector<Ray> rays;
+            for (int j = 0; j < ny; j++)
+                for (int i = 0; i < nx; i++)
+                    rays.push_back(camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny));
+            double built = benchClosestHit("mesh/rays/bvh", bvh, rays);
+
+            // the same scene compiled to a scene cache, opened and traced in place
+            const std::string cacheFile = "benchmark_mesh.rtscene";
+            Timer writeTimer;
+            if (writeSceneCache(cacheFile, 1, scene, bvh, error)) {
+                std::printf("%-40s %10.3f ms\n", "mesh/cache/write", writeTimer.elapsedMilliseconds());
+                double open = measure([&](long long iterations) {
+                    for (long long it = 0; it < iterations; it++) {
+                        Scene cachedScene;
+                        SceneCache cache;
+                        if (!cache.open(cacheFile, 1, cachedScene, error)) std::printf("%s\n", error.c_str());
+                    }
+                });
+                std::printf("%-40s %10.3f ms\n", "mesh/cache/open", open * 1000.0);
+                Scene cachedScene;
+                SceneCache cache;
+                cache.open(cacheFile, 1, cachedScene, error);
+                double cached = benchClosestHit("mesh/rays/cache", cache, rays);
+                std::printf("%-40s %.2fx of the BVH\n", "mesh/rays/cache", built / cached);
+                std::remove(cacheFile.c_str());
+            }
+        }
+    }
+    std::remove(objFile.c_str());
+    std::remove(plyFile.c_str());
+}
+
+// ---------------------------------------------------------------------------------------
+// Hit records holding shared_ptr<Material> vs raw material pointers
+// ---------------------------------------------------------------------------------------
+
+// The hit record layout used before materials moved into the Scene
+struct SharedMaterialHitRecord
+{
+    float t;
+    Vec3 position;
+    Vec3 normal;
+    std::shared_ptr<Material> material;
+};
+
+// Replays the closest hit loop of ShapeList: every candidate hit assigns the sphere's
+// material into a temporary record, which is then copied into the result.
+template <typename Record, typename MaterialRef>
+static float replayHits(const std::vector<MaterialRef>& sphereMaterials, int nRays, int hitsPerRay) {
+    float sum = 0.f;
+    Record record, tempRec;
+    size_t m = 0;
+    for (int r = 0; r < nRays; r++) {
+        for (int h = 0; h < hitsPerRay; h++) {
+            tempRec.t = (float)h;
+            tempRec.material = sphereMaterials[m];
+            m = m + 1 < sphereMaterials.size() ? m + 1 : 0;
+            record = tempRec;
+        }
+        sum += record.t + (record.material == nullptr ? 1.f : 0.f);
+    }
+    return sum;
+}
+
+static void benchHitRecordMaterials(const std::string& filter) {
+    const int nMaterials = 64, nRays = 10000, hitsPerRay = 4;
+    std::vector<std::shared_ptr<Material>> shared;
+    std::vector<const Material*> raw;
+    for (int i = 0; i < nMaterials; i++) {
+        shared.push_back(std::shared_ptr<Material>(new Lambertian(Vec3(0.5f))));
+        raw.push_back(shared.back().get());
+    }
+
+    int threadCounts[2] = { 1, ThreadPool::defaultThreadCount() };
+    for (int c = 0; c < (threadCounts[1] > 1 ? 2 : 1); c++) {
+        int nThreads = threadCounts[c];
+        std::string suffix = "/threads:" + std::to_string(nThreads);
+        if (!shouldRun(filter, "hitrecord/shared_ptr" + suffix) && !shouldRun(filter, "hitrecord/raw" + suffix)) continue;
+        ThreadPool pool(nThreads);
+        double sharedTime = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++)
+                pool.parallelFor(nThreads, [&](int, int) {
+                    gSink = replayHits<SharedMaterialHitRecord>(shared, nRays, hitsPerRay);
+                });
+        });
+        report("hitrecord/shared_ptr" + suffix, sharedTime, (double)nRays * nThreads);
+        double rawTime = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++)
+                pool.parallelFor(nThreads, [&](int, int) {
+                    gSink = replayHits<HitRecord>(raw, nRays, hitsPerRay);
+                });
+        });
+        report("hitrecord/raw" + suffix, rawTime, (double)nRays * nThreads);
+        std::printf("hitrecord%-34s raw pointer speedup %.2fx\n", suffix.c_str(), sharedTime / rawTime);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Scene arenas vs one heap allocation per object
+// ---------------------------------------------------------------------------------------
+
+static Material* cloneMaterial(const Material* m) {
+    switch (m->type()) {
+    case MaterialLambertian: return new Lambertian(*static_cast<const Lambertian*>(m));
+    case MaterialMetal: return new Metal(*static_cast<const Metal*>(m));
+    default: return new Dielectric(*static_cast<const Dielectric*>(m));
+    }
+}
+
+static const Material* cloneMaterial(const Material* m, Scene& scene) {
+    switch (m->type()) {
+    case MaterialLambertian: return scene.addMaterial<Lambertian>(*static_cast<const Lambertian*>(m));
+    case MaterialMetal: return scene.addMaterial<Metal>(*static_cast<const Metal*>(m));
+    default: return scene.addMaterial<Dielectric>(*static_cast<const Dielectric*>(m));
+    }
+}
+
+// Distinct 64 byte cache lines holding a sphere per sphere, 0.5 when two spheres share
+// every line and above 1 when spheres straddle lines
+static double cacheLinesPerSphere(const std::vector<const Shape*>& shapes) {
+    std::vector<uintptr_t> lines;
+    for (const Shape* s : shapes) {
+        lines.push_back((uintptr_t)s / 64);
+        lines.push_back(((uintptr_t)s + sizeof(Sphere) - 1) / 64);
+    }
+    std::sort(lines.begin(), lines.end());
+    return (double)(std::unique(lines.begin(), lines.end()) - lines.begin()) / shapes.size();
+}
+
+// Creates the spheres and materials of a 1M sphere random scene the way scenes used to be
+// built, with new for every material and sphere and a shared_ptr control block per sphere,
+// and in the arenas of a Scene. Then builds a BVH over both and traces incoherent rays
+// from above the scene, where nearly every sphere visit is a cache miss.
+static void benchArena(const std::string& filter) {
+    if (!shouldRun(filter, "arena/")) return;
+    const int nSpheres = 1000000;
+    Scene description;
+    pcg32 rng;
+    rng.seed(42u, 64u);
+    initRandomScene(rng, description, nSpheres);
+    const size_t n = description.shapes.mObjects.size();
+
+    std::vector<std::shared_ptr<Shape>> heapShapes;
+    std::vector<std::unique_ptr<Material>> heapMaterials;
+    ShapeList heapList;
+    Timer heapTimer;
+    heapShapes.reserve(n);
+    heapMaterials.reserve(n);
+    for (const Shape* shape : description.shapes.mObjects) {
+        const Sphere* s = static_cast<const Sphere*>(shape);
+        heapMaterials.push_back(std::unique_ptr<Material>(cloneMaterial(s->material)));
+        heapShapes.push_back(std::shared_ptr<Shape>(new Sphere(s->center, s->radius, heapMaterials.back().get())));
+    }
+    for (auto& shape : heapShapes) heapList.mObjects.push_back(shape.get());
+    double heapBuild = heapTimer.elapsedMilliseconds();
+
+    Scene arenaScene;
+    Timer arenaTimer;
+    arenaScene.shapes.mObjects.reserve(n);
+    arenaScene.materials.reserve(n);
+    for (const Shape* shape : description.shapes.mObjects) {
+        const Sphere* s = static_cast<const Sphere*>(shape);
+        arenaScene.addShape<Sphere>(s->center, s->radius, cloneMaterial(s->material, arenaScene));
+    }
+    double arenaBuild = arenaTimer.elapsedMilliseconds();
+
+    std::printf("%-40s %10.3f ms %10.2f cache lines per sphere\n", "arena/create/heap", heapBuild,
+        cacheLinesPerSphere(heapList.mObjects));
+    std::printf("%-40s %10.3f ms %10.2f cache lines per sphere\n", "arena/create/arena", arenaBuild,
+        cacheLinesPerSphere(arenaScene.shapes.mObjects));
+
+    Timer heapBvhTimer;
+    BVH heapBvh(heapList);
+    double heapBvhBuild = heapBvhTimer.elapsedMilliseconds();
+    Timer arenaBvhTimer;
+    BVH arenaBvh(arenaScene.shapes);
+    double arenaBvhBuild = arenaBvhTimer.elapsedMilliseconds();
+    std::printf("%-40s %10.3f ms\n%-40s %10.3f ms\n", "arena/bvh/heap", heapBvhBuild, "arena/bvh/arena", arenaBvhBuild);
+
+    std::vector<Ray> rays;
+    pcg32 rayRng;
+    rayRng.seed(8u, 8u);
+    float extent = (float)std::max(11, (int)(std::sqrt((float)nSpheres) * 0.5f));
+    for (int i = 0; i < 100000; i++) {
+        Vec3 o((2.f * rayRng.nextFloat() - 1.f) * extent, 1.f, (2.f * rayRng.nextFloat() - 1.f) * extent);
+        Vec3 d = squareToCosineHemisphere(Point2f(rayRng.nextFloat(), rayRng.nextFloat()));
+        rays.push_back(Ray(o, Vec3(d.x(), -d.z(), d.y())));
+    }
+    double heapRays = benchClosestHit("arena/rays/heap", heapBvh, rays);
+    double arenaRays = benchClosestHit("arena/rays/arena", arenaBvh, rays);
+    std::printf("%-40s create %.2fx bvh %.2fx rays %.2fx\n", "arena/speedup", heapBuild / arenaBuild,
+        heapBvhBuild / arenaBvhBuild, heapRays / arenaRays);
+}
+
+// ---------------------------------------------------------------------------------------
+// Recursive vs iterative path tracing
+// ---------------------------------------------------------------------------------------
+
+// The recursive color() the renderer used before PathIntegrator
+static Vec3 recursiveColor(const Ray& r, const Shape& world, Sampler& sampler, int bounce) {
+    HitRecord hRec;
+    if (world.intersect(r, 0.001f, FLT_MAX, hRec)) {
+        BSDFSample bs;
+        if (bounce < 50 && hRec.material->sample(hRec, -r.d.normalized(), sampler, bs))
+            return bs.weight * recursiveColor(Ray(hRec.position, bs.wi), world, sampler, ++bounce);
+        return Vec3(0.f);
+    }
+    return PathIntegrator::background(r);
+}
+
+// Renders a small frame of the random scene and reports camera paths per second
+// together with the mean pixel value, which should agree between the integrators.
+template <typename Func>
+static double benchFrame(const std::string& name, const Camera& camera, int nx, int ny, int ns, Func pathColor) {
+    Vec3 mean;
+    double seconds = measure([&](long long iterations) {
+        for (long long it = 0; it < iterations; it++) {
+            IndependentSampler sampler(7u);
+            mean = Vec3(0.f);
+            for (int j = 0; j < ny; j++)
+                for (int i = 0; i < nx; i++)
+                    for (int s = 0; s < ns; s++) {
+                        sampler.startPixelSample(i, j, s);
+                        Point2f p = sampler.get2D();
+                        Ray r = camera.generateRay((i + p.x) / nx, (j + p.y) / ny);
+                        mean += pathColor(r, sampler);
+                    }
+            mean /= float(nx * ny * ns);
+        }
+    }, 0.5);
+    report(name, seconds, (double)nx * ny * ns);
+    std::printf("%-40s mean (%.4f, %.4f, %.4f)\n", name.c_str(), mean.x(), mean.y(), mean.z());
+    return seconds;
+}
+
+static void benchIntegrator(const std::string& filter) {
+    if (!shouldRun(filter, "integrator/")) return;
+    Scene scene;
+    buildSphereScene(scene, 500);
+    BVH bvh(scene.shapes);
+    const int nx = 40, ny = 20, ns = 16;
+    Camera camera = benchmarkCamera(nx, ny);
+    PathIntegrator noRoulette(50, 0);
+    PathIntegrator roulette(50, 5);
+
+    double recursive = benchFrame("integrator/recursive", camera, nx, ny, ns,
+        [&](const Ray& r, Sampler& sampler) { return recursiveColor(r, bvh, sampler, 0); });
+    double iterative = benchFrame("integrator/iterative", camera, nx, ny, ns,
+        [&](const Ray& r, Sampler& sampler) { return noRoulette.Li(r, bvh, sampler); });
+    double rr = benchFrame("integrator/iterative_rr5", camera, nx, ny, ns,
+        [&](const Ray& r, Sampler& sampler) { return roulette.Li(r, bvh, sampler); });
+    std::printf("integrator/iterative                     speedup %.2fx\n", recursive / iterative);
+    std::printf("integrator/iterative_rr5                 speedup %.2fx\n", recursive / rr);
+}
+
+// Depth first tiles against the breadth first wavefront renderer on the same frame,
+// single threaded so only the order of work differs.
+static void benchWavefront(const std::string& filter) {
+    if (!shouldRun(filter, "render/")) return;
+    Scene scene;
+    buildSphereScene(scene, 500);
+    BVH bvh(scene.shapes);
+    const int nx = 80, ny = 40, ns = 8;
+    Camera camera = benchmarkCamera(nx, ny);
+    PathIntegrator integrator(50, 5);
+    ThreadPool pool(1);
+    Framebuffer framebuffer(nx, ny);
+    SobolSampler sampler;
+
+    TileRenderer tiles(nx, ny, ns);
+    double tileSeconds = measure([&](long long iterations) {
+        for (long long it = 0; it < iterations; it++) tiles.render(camera, bvh, integrator, sampler, pool, framebuffer);
+    }, 0.5);
+    report("render/tiles", tileSeconds, (double)nx * ny * ns);
+
+    WavefrontRenderer wavefront(nx, ny, ns, 1 << 14);
+    double wavefrontSeconds = measure([&](long long iterations) {
+        for (long long it = 0; it < iterations; it++) wavefront.render(camera, bvh, integrator, sampler, pool, framebuffer);
+    }, 0.5);
+    report("render/wavefront", wavefrontSeconds, (double)nx * ny * ns);
+    std::printf("render/wavefront                         speedup %.2fx\n", tileSeconds / wavefrontSeconds);
+}
+
+// ---------------------------------------------------------------------------------------
+// Virtual vs tag dispatch
+// ---------------------------------------------------------------------------------------
+
+// Wrappers around copies of the scene classes, which are final, that report the Other
+// type, so the BVH leaves and the integrator fall back to the virtual calls every shape
+// and material used to go through.
+class VirtualSphere : public Shape
+{
+public:
+    VirtualSphere(const Sphere& s, const Material* m) : mSphere(s.center, s.radius, m) {}
+    bool hit(const Ray& r, const float minT, const float maxT, HitRecord& record) const {
+        if (!mSphere.hit(r, minT, maxT, record)) return false;
+        record.shape = this;
+        return true;
+    }
+    bool occluded(const Ray& r, const float minT, const float maxT) const { return mSphere.occluded(r, minT, maxT); }
+    void computeSurface(const Ray& r, HitRecord& record) const { mSphere.computeSurface(r, record); }
+    AABB bounds() const { return mSphere.bounds(); }
+
+private:
+    Sphere mSphere;
+};
+
+template <typename M>
+class VirtualMaterial : public Material
+{
+public:
+    VirtualMaterial(const M& m) : mMaterial(m) {}
+    Vec3 eval(const HitRecord& hit, const Vec3& wo, const Vec3& wi) const { return mMaterial.eval(hit, wo, wi); }
+    float pdf(const HitRecord& hit, const Vec3& wo, const Vec3& wi) const { return mMaterial.pdf(hit, wo, wi); }
+    bool sample(const HitRecord& hit, const Vec3& wo, Sampler& sampler, BSDFSample& bs) const {
+        return mMaterial.sample(hit, wo, sampler, bs);
+    }
+
+private:
+    M mMaterial;
+};
+
+static const Material* virtualMaterial(const Material* m, Arena& arena) {
+    switch (m->type()) {
+    case MaterialLambertian: return arena.create<VirtualMaterial<Lambertian>>(*static_cast<const Lambertian*>(m));
+    case MaterialMetal: return arena.create<VirtualMaterial<Metal>>(*static_cast<const Metal*>(m));
+    default: return arena.create<VirtualMaterial<Dielectric>>(*static_cast<const Dielectric*>(m));
+    }
+}
+
+// Samples the material of every hit, the call the integrator makes once per bounce
+static double benchMaterialSampling(const std::string& name, const std::vector<HitRecord>& hits) {
+    IndependentSampler sampler(3u);
+    double seconds = measure([&](long long iterations) {
+        float sum = 0.f;
+        for (long long it = 0; it < iterations; it++) {
+            for (size_t h = 0; h < hits.size(); h++) {
+                BSDFSample bs;
+                if (sampleMaterial(*hits[h].material, hits[h], Vec3(0.f, 1.f, 0.f), sampler, bs)) sum += bs.weight.x();
+            }
+        }
+        gSink = sum;
+    });
+    report(name, seconds, (double)hits.size());
+    return seconds;
+}
+
+// The closest hit and material sampling kernels and the frame of the render benchmark,
+// with every shape and material call dispatched through the vtable and through the type
+// tags. The images are identical.
+static void benchDispatch(const std::string& filter) {
+    if (!shouldRun(filter, "dispatch/")) return;
+    Scene scene;
+    buildSphereScene(scene, 500);
+    Arena arena;
+    ShapeList virtualList;
+    for (const Shape* shape : scene.shapes.mObjects) {
+        const Sphere* s = static_cast<const Sphere*>(shape);
+        virtualList.mObjects.push_back(arena.create<VirtualSphere>(*s, virtualMaterial(s->material, arena)));
+    }
+    BVH tagged(scene.shapes);
+    BVH virtualBVH(virtualList);
+    const int nx = 80, ny = 40, ns = 8;
+    Camera camera = benchmarkCamera(nx, ny);
+    PathIntegrator integrator(50, 5);
+    ThreadPool pool(1);
+    Framebuffer taggedImage(nx, ny), virtualImage(nx, ny);
+    SobolSampler sampler;
+    TileRenderer tiles(nx, ny, ns);
+
+    std::vector<Ray> rays;
+    std::vector<HitRecord> taggedHits, virtualHits;
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            rays.push_back(camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny));
+            HitRecord a, b;
+            if (tagged.intersect(rays.back(), 0.001f, FLT_MAX, a) && virtualBVH.intersect(rays.back(), 0.001f, FLT_MAX, b)) {
+                taggedHits.push_back(a);
+                virtualHits.push_back(b);
+            }
+        }
+    }
+    double virtualHit = benchClosestHit("dispatch/closesthit/virtual", virtualBVH, rays);
+    double taggedHit = benchClosestHit("dispatch/closesthit/tagged", tagged, rays);
+    std::printf("dispatch/closesthit/tagged               speedup %.2fx\n", virtualHit / taggedHit);
+    double virtualSample = benchMaterialSampling("dispatch/sample/virtual", virtualHits);
+    double taggedSample = benchMaterialSampling("dispatch/sample/tagged", taggedHits);
+    std::printf("dispatch/sample/tagged                   speedup %.2fx\n", virtualSample / taggedSample);
+
+    double virtualSeconds, taggedSeconds;
+    measurePair([&](long long iterations) {
+        for (long long it = 0; it < iterations; it++) tiles.render(camera, virtualBVH, integrator, sampler, pool, virtualImage);
+    }, [&](long long iterations) {
+        for (long long it = 0; it < iterations; it++) tiles.render(camera, tagged, integrator, sampler, pool, taggedImage);
+    }, virtualSeconds, taggedSeconds);
+    report("dispatch/render/virtual", virtualSeconds, (double)nx * ny * ns);
+    report("dispatch/render/tagged", taggedSeconds, (double)nx * ny * ns);
+    std::printf("dispatch/render/tagged                   speedup %.2fx, %d pixels differ\n", virtualSeconds / taggedSeconds,
+        differingPixels(taggedImage, virtualImage));
+}
+
+// ---------------------------------------------------------------------------------------
+// Generic vs specialized render kernels
+// ---------------------------------------------------------------------------------------
+
+// Camera rays of a frame with the lens sampled and scaled by the zero radius of the
+// benchmark camera, and with the pinhole kernel skipping it
+template <typename Lens>
+static double benchCameraRays(const std::string& name, const Camera& camera, int nx, int ny) {
+    SobolSampler sampler;
+    double seconds = measure([&](long long iterations) {
+        float sum = 0.f;
+        for (long long it = 0; it < iterations; it++) {
+            for (int j = 0; j < ny; j++)
+                for (int i = 0; i < nx; i++) {
+                    sampler.startPixelSample(i, j, (int)it);
+                    Point2f p = sampler.get2D();
+                    sum += camera.generateRay((i + p.x) / nx, (j + p.y) / ny, sampler, Lens()).d.x();
+                }
+        }
+        gSink = sum;
+    });
+    report(name, seconds, (double)nx * ny);
+    return seconds;
+}
+
+// The random scene has no lights and a pinhole camera, the frame of the render benchmark
+// with the generic kernel and with the one dispatchKernel picks for it
+static void benchKernels(const std::string& filter) {
+    if (!shouldRun(filter, "kernel/")) return;
+    Scene scene;
+    buildSphereScene(scene, 500);
+    BVH bvh(scene.shapes);
+    const int nx = 80, ny = 40, ns = 8;
+    Camera camera = benchmarkCamera(nx, ny);
+    PathIntegrator integrator(50, 5);
+
+    double thinLens = benchCameraRays<ThinLens>("kernel/camera/thinlens", camera, nx, ny);
+    double pinhole = benchCameraRays<PinholeLens>("kernel/camera/pinhole", camera, nx, ny);
+    std::printf("kernel/camera/pinhole                    speedup %.2fx\n", thinLens / pinhole);
+
+    typedef KernelTraits<PinholeLens, false> Specialized;
+    ThreadPool pool(1);
+    Framebuffer genericImage(nx, ny), specializedImage(nx, ny);
+    SobolSampler sampler;
+    TileRenderer tiles(nx, ny, ns);
+    double genericSeconds, specializedSeconds;
+    measurePair([&](long long iterations) {
+        for (long long it = 0; it < iterations; it++)
+            tiles.render<GenericKernel>(camera, bvh, integrator, sampler, pool, genericImage);
+    }, [&](long long iterations) {
+        for (long long it = 0; it < iterations; it++)
+            tiles.render<Specialized>(camera, bvh, integrator, sampler, pool, specializedImage);
+    }, genericSeconds, specializedSeconds);
+    report("kernel/render/generic", genericSeconds, (double)nx * ny * ns);
+    report("kernel/render/pinhole_nolights", specializedSeconds, (double)nx * ny * ns);
+    std::printf("kernel/render/pinhole_nolights           speedup %.2fx, %d pixels differ\n",
+        genericSeconds / specializedSeconds, differingPixels(genericImage, specializedImage));
+}
+
+// ---------------------------------------------------------------------------------------
+// Sampling warps, rejection vs closed form
+// ---------------------------------------------------------------------------------------
+
+// The rejection samplers the renderer used before warp.h
+static Vec3 rejectionUnitDisk(pcg32& rng) {
+    Vec3 p;
+    do {
+        p = 2.f * Vec3(rng.nextFloat(), rng.nextFloat(), 0.f) - Vec3(1.f, 1.f, 0.f);
+    } while (p.x() * p.x() + p.y() * p.y() >= 1.f);
+    return p;
+}
+
+static Vec3 rejectionUniformSphere(pcg32& rng) {
+    Vec3 p;
+    do {
+        p = 2.f * Vec3(rng.nextFloat(), rng.nextFloat(), rng.nextFloat()) - Vec3(1.f);
+    } while (p.sqrLength() >= 1.f || p.sqrLength() == 0.f);
+    return p.normalized();
+}
+
+// Points per second of each mapping. The closed form and batch versions read their
+// inputs from arrays of uniform numbers, the rejection versions draw as many as they need.
+static void benchWarps(const std::string& filter) {
+    if (!shouldRun(filter, "warp/")) return;
+    const int n = 1 << 16;
+    std::vector<float> ux(n), uy(n), x(n), y(n), z(n);
+    pcg32 rng;
+    rng.seed(9u, 2u);
+    for (int i = 0; i < n; i++) {
+        ux[i] = rng.nextFloat();
+        uy[i] = rng.nextFloat();
+    }
+
+    struct Case
+    {
+        const char* name;
+        std::function<void()> run;
+    };
+    Case cases[] = {
+        { "warp/disk/rejection", [&]() {
+            Vec3 sum(0.f);
+            for (int i = 0; i < n; i++) sum += rejectionUnitDisk(rng);
+            gSink = sum.x(); } },
+        { "warp/disk/concentric", [&]() {
+            Vec3 sum(0.f);
+            for (int i = 0; i < n; i++) sum += squareToConcentricDisk(Point2f(ux[i], uy[i]));
+            gSink = sum.x(); } },
+        { "warp/disk/concentric_batch", [&]() {
+            squareToConcentricDisk(ux.data(), uy.data(), n, x.data(), y.data());
+            gSink = x[n / 2]; } },
+        { "warp/sphere/rejection", [&]() {
+            Vec3 sum(0.f);
+            for (int i = 0; i < n; i++) sum += rejectionUniformSphere(rng);
+            gSink = sum.x(); } },
+        { "warp/sphere/closed", [&]() {
+            Vec3 sum(0.f);
+            for (int i = 0; i < n; i++) sum += squareToUniformSphere(Point2f(ux[i], uy[i]));
+            gSink = sum.x(); } },
+        { "warp/sphere/closed_batch", [&]() {
+            squareToUniformSphere(ux.data(), uy.data(), n, x.data(), y.data(), z.data());
+            gSink = x[n / 2]; } },
+        { "warp/cosine/closed", [&]() {
+            Vec3 sum(0.f);
+            for (int i = 0; i < n; i++) sum += squareToCosineHemisphere(Point2f(ux[i], uy[i]));
+            gSink = sum.x(); } },
+        { "warp/cosine/closed_batch", [&]() {
+            squareToCosineHemisphere(ux.data(), uy.data(), n, x.data(), y.data(), z.data());
+            gSink = x[n / 2]; } },
+    };
+    for (Case& c : cases) {
+        if (!shouldRun(filter, c.name)) continue;
+        double seconds = measure([&](long long iterations) {
+            for (long long it = 0; it < iterations; it++) c.run();
+        });
+        report(c.name, seconds, n);
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// Sampler convergence
+// ---------------------------------------------------------------------------------------
+
+// RMSE after gamma correction, the error as it shows in the written image
+static double imageRMSE(const Framebuffer& a, const Framebuffer& b) {
+    double sum = 0.0;
+    for (size_t p = 0; p < a.pixels.size(); p++)
+        for (int c = 0; c < 3; c++) {
+            double d = std::sqrt(std::max(a.pixels[p][c], 0.f)) - std::sqrt(std::max(b.pixels[p][c], 0.f));
+            sum += d * d;
+        }
+    return std::sqrt(sum / (3.0 * a.pixels.size()));
+}
+
+// Error against a 1024 spp reference at 1 to 256 spp for every sampler. A sampler that
+// converges faster reaches the error of the independent sampler with fewer samples.
+static void benchConvergence(const std::string& filter) {
+    if (!shouldRun(filter, "convergence/")) return;
+    Scene scene;
+    buildSphereScene(scene, 500);
+    BVH bvh(scene.shapes);
+    const int nx = 64, ny = 32;
+    Camera camera = benchmarkCamera(nx, ny);
+    PathIntegrator integrator(50, 5);
+    ThreadPool pool;
+
+    Framebuffer reference(nx, ny);
+    IndependentSampler referenceSampler(12345u);
+    TileRenderer(nx, ny, 1024).render(camera, bvh, integrator, referenceSampler, pool, reference);
+
+    const char* samplers[] = { "independent", "stratified", "sobol", "bluenoise" };
+    std::printf("%-40s", "convergence/spp");
+    for (int spp = 1; spp <= 256; spp *= 4) std::printf(" %8d", spp);
+    std::printf("\n");
+    for (const char* name : samplers) {
+        std::string benchName = std::string("convergence/") + name;
+        if (!shouldRun(filter, benchName)) continue;
+        std::printf("%-40s", benchName.c_str());
+        for (int spp = 1; spp <= 256; spp *= 4) {
+            std::unique_ptr<Sampler> sampler = createSampler(name, spp);
+            Framebuffer framebuffer(nx, ny);
+            TileRenderer(nx, ny, spp).render(camera, bvh, integrator, *sampler, pool, framebuffer);
+            std::printf(" %8.5f", imageRMSE(reference, framebuffer));
+        }
+        std::printf("\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter = argc > 1 ? argv[1] : "";
+    benchVec3(filter);
+    benchPackets(filter);
+    benchSphereSoA(filter);
+    benchDeferredShading(filter);
+    benchShadowRays(filter);
+    benchMesh(filter);
+    benchHitRecordMaterials(filter);
+    benchArena(filter);
+    benchIntegrator(filter);
+    benchWavefront(filter);
+    benchDispatch(filter);
+    benchKernels(filter);
+    benchWarps(filter);
+    benchConvergence(filter);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# pgo_benchmark.sh
+# Renders the full default frame with a renderer built without and with profile guided
+# optimization and reports the speedup. The two binaries take turns and the best time of
+# each is kept, so load on the machine affects both alike. Any further arguments are
+# passed to both renderers; the results are named after the --scene among them.
+#
+#   pgo_benchmark.sh BASELINE PGO [ROUNDS] [renderer options]
+#
+
+if [ $# -lt 2 ]; then
+    echo "Usage : $0 BASELINE PGO [ROUNDS] [renderer options]"
+    exit 1
+fi
+baseline=$1
+pgo=$2
+shift 2
+rounds=3
+case "$1" in
+    ''|-*) ;;
+    *) rounds=$1; shift ;;
+esac
+
+name=pgo/frame
+previous=
+for arg in "$@"; do
+    [ "$previous" = "--scene" ] && name=pgo/$arg
+    previous=$arg
+done
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# seconds of the render, as printed by the renderer
+render() {
+    binary=$1
+    image=$2
+    shift 2
+    "$binary" "$@" -o "$image" > "$dir/log" 2>&1 || { cat "$dir/log" >&2; exit 1; }
+    sed -n 's/^Tracing done in \([0-9.e+-]*\)s$/\1/p' "$dir/log"
+}
+
+best_baseline=
+best_pgo=
+round=1
+while [ $round -le $rounds ]; do
+    t=$(render "$baseline" "$dir/baseline.ppm" "$@") || exit 1
+    echo "$name/baseline round $round $t s"
+    best_baseline=$(echo "$t $best_baseline" | awk '{ print ($2 == "" || $1 < $2) ? $1 : $2 }')
+    t=$(render "$pgo" "$dir/pgo.ppm" "$@") || exit 1
+    echo "$name/pgo      round $round $t s"
+    best_pgo=$(echo "$t $best_pgo" | awk '{ print ($2 == "" || $1 < $2) ? $1 : $2 }')
+    round=$((round + 1))
+done
+
+echo "$best_baseline $best_pgo" | awk -v name="$name" '{ printf "%s baseline %.3fs pgo %.3fs speedup %.2fx\n", name, $1, $2, $1 / $2 }'
+if cmp -s "$dir/baseline.ppm" "$dir/pgo.ppm"; then
+    echo "$name images are identical"
+else
+    echo "$name images differ"
+fi
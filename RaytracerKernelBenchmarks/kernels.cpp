@@ -0,0 +1,332 @@
+//
+// kernels.cpp
+// Google Benchmark suite for the kernels of the renderer. Unlike RaytracerBenchmarks,
+// which compares alternative implementations side by side, this tracks the kernels the
+// renderer ships with over time. Results are written to kernels.json unless another file
+// is given with --benchmark_out, compare two runs with tools/compare.py of Google Benchmark.
+// The project links benchmark.lib, for example from vcpkg install benchmark.
+//
+
+#include "../Project2/vec3.h"
+#include "../Project2/pcg32.h"
+#include "../Project2/sampler.h"
+#include "../Project2/camera.h"
+#include "../Project2/shape.h"
+#include "../Project2/bvh.h"
+#include "../Project2/material.h"
+#include "../Project2/scene.h"
+#include "../Project2/integrator.h"
+#include "../Project2/kernel.h"
+#include "../Project2/threadpool.h"
+#include "../Project2/framebuffer.h"
+#include "../Project2/renderer.h"
+#include "../Project2/wavefront.h"
+#include <benchmark/benchmark.h>
+#include <cfloat>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+static const int NumVectors = 1024;
+static const int NumRays = 1024;
+
+static std::vector<Vec3> randomVectors(pcg32& rng, int n) {
+    std::vector<Vec3> vectors;
+    vectors.reserve(n);
+    for (int i = 0; i < n; i++)
+        vectors.push_back(Vec3(rng.nextFloat() + 0.1f, rng.nextFloat() + 0.1f, rng.nextFloat() + 0.1f));
+    return vectors;
+}
+
+// The camera of the renderer for a frame of nx by ny pixels
+static Camera frameCamera(int nx, int ny, float aperture = 0.f) {
+    return Camera(Vec3(13.f, 2.f, 3.f), Vec3(0.f), Vec3(0.f, 1.f, 0.f), 20.f, float(nx) / float(ny), aperture, 9.f);
+}
+
+// Rays through the pixel centers of a frame of NumRays pixels
+static std::vector<Ray> cameraRays() {
+    const int nx = 32, ny = NumRays / nx;
+    Camera camera = frameCamera(nx, ny);
+    std::vector<Ray> rays;
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++) rays.push_back(camera.generateRay((i + 0.5f) / nx, (j + 0.5f) / ny));
+    return rays;
+}
+
+// ---------------------------------------------------------------------------------------
+// Vec3
+// ---------------------------------------------------------------------------------------
+
+static void BM_Vec3AddMul(benchmark::State& state) {
+    pcg32 rng;
+    std::vector<Vec3> a = randomVectors(rng, NumVectors), b = randomVectors(rng, NumVectors), out(NumVectors);
+    for (auto _ : state) {
+        for (int i = 0; i < NumVectors; i++) out[i] = (a[i] + b[i]) * 0.5f - a[i] * b[i];
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * NumVectors);
+}
+BENCHMARK(BM_Vec3AddMul);
+
+static void BM_Vec3Dot(benchmark::State& state) {
+    pcg32 rng;
+    std::vector<Vec3> a = randomVectors(rng, NumVectors), b = randomVectors(rng, NumVectors);
+    for (auto _ : state) {
+        float sum = 0.f;
+        for (int i = 0; i < NumVectors; i++) sum += a[i].dot(b[i]);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * NumVectors);
+}
+BENCHMARK(BM_Vec3Dot);
+
+static void BM_Vec3Cross(benchmark::State& state) {
+    pcg32 rng;
+    std::vector<Vec3> a = randomVectors(rng, NumVectors), b = randomVectors(rng, NumVectors), out(NumVectors);
+    for (auto _ : state) {
+        for (int i = 0; i < NumVectors; i++) out[i] = a[i].cross(b[i]);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * NumVectors);
+}
+BENCHMARK(BM_Vec3Cross);
+
+static void BM_Vec3Normalized(benchmark::State& state) {
+    pcg32 rng;
+    std::vector<Vec3> a = randomVectors(rng, NumVectors), out(NumVectors);
+    for (auto _ : state) {
+        for (int i = 0; i < NumVectors; i++) out[i] = a[i].normalized();
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * NumVectors);
+}
+BENCHMARK(BM_Vec3Normalized);
+
+// ---------------------------------------------------------------------------------------
+// Intersection
+// ---------------------------------------------------------------------------------------
+
+// Rays towards a unit sphere at the origin that start at distance 5. Hit rays aim at
+// points inside the silhouette, miss rays pass next to it.
+static std::vector<Ray> sphereRays(bool hit) {
+    pcg32 rng;
+    std::vector<Ray> rays;
+    for (int i = 0; i < NumRays; i++) {
+        float r = hit ? 0.95f * std::sqrt(rng.nextFloat()) : 1.05f + rng.nextFloat();
+        float phi = 2.f * Pi * rng.nextFloat();
+        rays.push_back(Ray(Vec3(r * std::cos(phi), r * std::sin(phi), -5.f), Vec3(0.f, 0.f, 1.f)));
+    }
+    return rays;
+}
+
+// Closest hit with the surface interaction, which is only computed for hits
+static void BM_SphereIntersect(benchmark::State& state, bool hit) {
+    Lambertian material(Vec3(0.5f));
+    Sphere sphere(Vec3(0.f), 1.f, &material);
+    std::vector<Ray> rays = sphereRays(hit);
+    for (auto _ : state) {
+        int hits = 0;
+        for (const Ray& r : rays) {
+            HitRecord record;
+            hits += sphere.intersect(r, 0.001f, FLT_MAX, record) ? 1 : 0;
+            benchmark::DoNotOptimize(record);
+        }
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetItemsProcessed(state.iterations() * NumRays);
+}
+BENCHMARK_CAPTURE(BM_SphereIntersect, hit, true);
+BENCHMARK_CAPTURE(BM_SphereIntersect, miss, false);
+
+// The random scene of the renderer
+static void buildRandomScene(Scene& scene) {
+    pcg32 rng;
+    rng.seed(42u, 64u);
+    initRandomScene(rng, scene, 500);
+}
+
+// nSpheres small diffuse spheres scattered over the view of the camera. initRandomScene
+// has a minimum grid size, so it cannot be used for the small counts of the scaling runs.
+static void buildSpheres(Scene& scene, int nSpheres) {
+    pcg32 rng;
+    const Material* material = scene.addMaterial<Lambertian>(Vec3(0.5f));
+    for (int i = 0; i < nSpheres; i++) {
+        Vec3 center(12.f * rng.nextFloat() - 6.f, 2.f * rng.nextFloat(), 12.f * rng.nextFloat() - 6.f);
+        scene.addShape<Sphere>(center, 0.3f, material);
+    }
+}
+
+// Camera rays against the scene in a flat list, linear in the number of spheres
+static void BM_ShapeListIntersect(benchmark::State& state) {
+    Scene scene;
+    buildSpheres(scene, (int)state.range(0));
+    std::vector<Ray> rays = cameraRays();
+    for (auto _ : state) {
+        for (const Ray& r : rays) {
+            HitRecord record;
+            benchmark::DoNotOptimize(scene.shapes.intersect(r, 0.001f, FLT_MAX, record));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * NumRays);
+    state.SetComplexityN((int64_t)scene.shapes.mObjects.size());
+}
+BENCHMARK(BM_ShapeListIntersect)->RangeMultiplier(4)->Range(16, 4096)->Complexity(benchmark::oN);
+
+// The same rays and scenes through the BVH the renderer builds
+static void BM_BVHIntersect(benchmark::State& state) {
+    Scene scene;
+    buildSpheres(scene, (int)state.range(0));
+    BVH bvh(scene.shapes);
+    std::vector<Ray> rays = cameraRays();
+    for (auto _ : state) {
+        for (const Ray& r : rays) {
+            HitRecord record;
+            benchmark::DoNotOptimize(bvh.intersect(r, 0.001f, FLT_MAX, record));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * NumRays);
+    state.SetComplexityN((int64_t)scene.shapes.mObjects.size());
+}
+BENCHMARK(BM_BVHIntersect)->RangeMultiplier(4)->Range(16, 4096)->Complexity(benchmark::oLogN);
+
+// ---------------------------------------------------------------------------------------
+// Materials
+// ---------------------------------------------------------------------------------------
+
+// One sample of the material per hit with random incoming directions, through the same
+// dispatch the integrator uses
+static void BM_MaterialSample(benchmark::State& state, const Material* material) {
+    // hidden from the optimizer like the material of a hit, otherwise the constant global
+    // is propagated into the branches of the tag switch that do not match it
+    benchmark::DoNotOptimize(material);
+    pcg32 rng;
+    std::vector<Vec3> directions;
+    for (int i = 0; i < NumVectors; i++) {
+        Vec3 wo = squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+        directions.push_back(wo.z() < 0.f ? -wo : wo);
+    }
+    HitRecord hit = HitRecord();
+    hit.normal = Vec3(0.f, 0.f, 1.f);
+    hit.material = material;
+    IndependentSampler sampler(3u);
+    for (auto _ : state) {
+        float sum = 0.f;
+        for (const Vec3& wo : directions) {
+            BSDFSample bs;
+            if (sampleMaterial(*material, hit, wo, sampler, bs)) sum += bs.weight.x();
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * NumVectors);
+}
+
+static const Lambertian gLambertian(Vec3(0.5f));
+static const Metal gMirror(Vec3(0.7f, 0.6f, 0.5f), 0.f);
+static const Metal gRoughMetal(Vec3(0.7f, 0.6f, 0.5f), 0.3f);
+static const Dielectric gGlass(1.5f);
+BENCHMARK_CAPTURE(BM_MaterialSample, lambertian, &gLambertian);
+BENCHMARK_CAPTURE(BM_MaterialSample, metal_mirror, &gMirror);
+BENCHMARK_CAPTURE(BM_MaterialSample, metal_rough, &gRoughMetal);
+BENCHMARK_CAPTURE(BM_MaterialSample, dielectric, &gGlass);
+
+// ---------------------------------------------------------------------------------------
+// Random numbers and camera rays
+// ---------------------------------------------------------------------------------------
+
+static void BM_Pcg32NextFloat(benchmark::State& state) {
+    pcg32 rng;
+    for (auto _ : state) benchmark::DoNotOptimize(rng.nextFloat());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Pcg32NextFloat);
+
+static void BM_Pcg32NextDouble(benchmark::State& state) {
+    pcg32 rng;
+    for (auto _ : state) benchmark::DoNotOptimize(rng.nextDouble());
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Pcg32NextDouble);
+
+// Jittered camera rays of one sample per pixel, with the lens the kernel of the job uses
+template <typename Lens>
+static void BM_CameraGenerateRay(benchmark::State& state) {
+    const int nx = 32, ny = NumRays / nx;
+    Camera camera = frameCamera(nx, ny, std::is_same<Lens, ThinLens>::value ? 0.1f : 0.f);
+    SobolSampler sampler;
+    int sample = 0;
+    for (auto _ : state) {
+        for (int j = 0; j < ny; j++)
+            for (int i = 0; i < nx; i++) {
+                sampler.startPixelSample(i, j, sample);
+                Point2f p = sampler.get2D();
+                benchmark::DoNotOptimize(camera.generateRay((i + p.x) / nx, (j + p.y) / ny, sampler, Lens()));
+            }
+        sample++;
+    }
+    state.SetItemsProcessed(state.iterations() * NumRays);
+}
+BENCHMARK_TEMPLATE(BM_CameraGenerateRay, PinholeLens);
+BENCHMARK_TEMPLATE(BM_CameraGenerateRay, ThinLens);
+
+// ---------------------------------------------------------------------------------------
+// Frame
+// ---------------------------------------------------------------------------------------
+
+// A small frame of the default scene on one thread, with the kernel the renderer picks
+// for it. Items are camera paths.
+template <typename Renderer>
+static void renderFrame(benchmark::State& state, Renderer& renderer, int nx, int ny, int ns) {
+    Scene scene;
+    buildRandomScene(scene);
+    BVH bvh(scene.shapes);
+    Camera camera = frameCamera(nx, ny);
+    PathIntegrator integrator(50, 5);
+    ThreadPool pool(1);
+    Framebuffer framebuffer(nx, ny);
+    SobolSampler sampler;
+    for (auto _ : state) {
+        dispatchKernel(camera, !integrator.lights.empty(), [&](auto traits) {
+            typedef decltype(traits) Traits;
+            renderer.template render<Traits>(camera, bvh, integrator, sampler, pool, framebuffer);
+        });
+        benchmark::DoNotOptimize(framebuffer.pixels.data());
+    }
+    state.SetItemsProcessed(state.iterations() * nx * ny * ns);
+}
+
+static void BM_RenderFrameTiles(benchmark::State& state) {
+    const int nx = 80, ny = 40, ns = 8;
+    TileRenderer renderer(nx, ny, ns);
+    renderFrame(state, renderer, nx, ny, ns);
+}
+BENCHMARK(BM_RenderFrameTiles)->Unit(benchmark::kMillisecond);
+
+static void BM_RenderFrameWavefront(benchmark::State& state) {
+    const int nx = 80, ny = 40, ns = 8;
+    WavefrontRenderer renderer(nx, ny, ns, 1 << 14);
+    renderFrame(state, renderer, nx, ny, ns);
+}
+BENCHMARK(BM_RenderFrameWavefront)->Unit(benchmark::kMillisecond);
+
+// BENCHMARK_MAIN with a JSON results file by default
+int main(int argc, char** argv) {
+    std::vector<char*> args(argv, argv + argc);
+    bool hasOut = false;
+    for (int i = 1; i < argc; i++) hasOut = hasOut || std::strncmp(argv[i], "--benchmark_out=", 16) == 0;
+    char out[] = "--benchmark_out=kernels.json";
+    char format[] = "--benchmark_out_format=json";
+    if (!hasOut) {
+        args.push_back(out);
+        args.push_back(format);
+    }
+    int count = (int)args.size();
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data())) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -1,6 +1,18 @@
 #include "pch.h"
 #include "../Project2/vec3.h"
 #include "../Project2/ray.h"
+#include "../Project2/shape.h"
+#include "../Project2/bvh.h"
+#include "../Project2/spheresoa.h"
+#include "../Project2/pcg32.h"
+#include "../Project2/adaptive.h"
+#include "../Project2/warp.h"
+#include "../Project2/scene.h"
+#include "../Project2/meshio.h"
+#include "../Project2/scenecache.h"
+#include "../Project2/kernel.h"
+#include <cstdio>
+#include <fstream>
 
 TEST(TestVectorOperations, TestUnaryOperations) {
     // We will test all the unary operations
@@ -31,7 +43,605 @@ TEST(TestRay, TestRayOperations) {
     EXPECT_EQ(r(5.0f), Vec3(5.0f, 0.0f, 0.0)) << "Ray () operator failed";
 }
 
+TEST(TestBVH, TestBVHMatchesShapeList) {
+    pcg32 rng;
+    rng.seed(7u, 3u);
+    Arena arena;
+    ShapeList list;
+    for (int i = 0; i < 1000; i++) {
+        Vec3 c(20.f * rng.nextFloat() - 10.f, 20.f * rng.nextFloat() - 10.f, 20.f * rng.nextFloat() - 10.f);
+        list.mObjects.push_back(arena.create<Sphere>(c, 0.05f + 0.5f * rng.nextFloat()));
+    }
+    BVH bvh(list);
+    EXPECT_EQ(bvh.bounds().pMin, list.bounds().pMin) << "BVH bounds test failed";
+    EXPECT_EQ(bvh.bounds().pMax, list.bounds().pMax) << "BVH bounds test failed";
+    for (int i = 0; i < 1000; i++) {
+        Vec3 o(30.f * rng.nextFloat() - 15.f, 30.f * rng.nextFloat() - 15.f, 30.f * rng.nextFloat() - 15.f);
+        Vec3 d(2.f * rng.nextFloat() - 1.f, 2.f * rng.nextFloat() - 1.f, 2.f * rng.nextFloat() - 1.f);
+        Ray r(o, d);
+        HitRecord listRec, bvhRec;
+        bool listHit = list.intersect(r, 0.001f, FLT_MAX, listRec);
+        bool bvhHit = bvh.intersect(r, 0.001f, FLT_MAX, bvhRec);
+        ASSERT_EQ(listHit, bvhHit) << "BVH hit test failed for ray " << i;
+        if (listHit) {
+            EXPECT_EQ(listRec.t, bvhRec.t) << "BVH closest hit test failed for ray " << i;
+        }
+        EXPECT_EQ(list.intersect(r, 0.001f, 5.f, listRec), bvh.occluded(r, 0.001f, 5.f)) << "BVH occluded test failed for ray " << i;
+    }
+}
+
+TEST(TestBVH, TestBVHDepthLimit) {
+    // spheres growing geometrically along each axis, every SAH split cuts off one sphere
+    Arena arena;
+    ShapeList list;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int i = 0; i < 120; i++) {
+            float c[3] = { 0.f, 0.f, 0.f };
+            c[axis] = std::ldexp(1.f, i);
+            list.mObjects.push_back(arena.create<Sphere>(Vec3(c[0], c[1], c[2]), 1e-3f * std::ldexp(1.f, i)));
+        }
+    }
+    BVH bvh(list);
+    const std::vector<LinearBVHNode>& nodes = bvh.nodes();
+    std::vector<int> depth(nodes.size(), 0);
+    int maxDepth = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].nPrimitives > 0) continue;
+        maxDepth = std::max(maxDepth, depth[i]);
+        depth[i + 1] = depth[nodes[i].secondChildOffset] = depth[i] + 1;
+    }
+    EXPECT_LT(maxDepth, (int)BVH::TraversalStackSize) << "BVH depth test failed";
+    for (int axis = 0; axis < 3; axis++) {
+        for (int i = 0; i < 120; i += 7) {
+            // from beside sphere i towards it
+            float o[3] = { 0.f, 0.f, 0.f }, d[3] = { 0.f, 0.f, 0.f };
+            o[axis] = std::ldexp(1.f, i);
+            o[(axis + 1) % 3] = 1.f;
+            d[(axis + 1) % 3] = -1.f;
+            Ray r(Vec3(o[0], o[1], o[2]), Vec3(d[0], d[1], d[2]));
+            HitRecord listRec, bvhRec;
+            ASSERT_EQ(list.intersect(r, 0.001f, FLT_MAX, listRec), bvh.intersect(r, 0.001f, FLT_MAX, bvhRec))
+                << "BVH depth hit test failed for sphere " << i;
+            EXPECT_EQ(list.occluded(r, 0.001f, FLT_MAX), bvh.occluded(r, 0.001f, FLT_MAX))
+                << "BVH depth occluded test failed for sphere " << i;
+        }
+    }
+}
+
+TEST(TestRayPacket, TestPacketMatchesScalar) {
+    pcg32 rng;
+    rng.seed(11u, 5u);
+    Arena arena;
+    ShapeList list;
+    for (int i = 0; i < 200; i++) {
+        Vec3 c(10.f * rng.nextFloat() - 5.f, 10.f * rng.nextFloat() - 5.f, 10.f * rng.nextFloat() - 5.f);
+        list.mObjects.push_back(arena.create<Sphere>(c, 0.1f + 0.5f * rng.nextFloat()));
+    }
+    BVH bvh(list);
+    for (int i = 0; i < 200; i++) {
+        RayPacket packet;
+        Ray rays[RT_SIMD_WIDTH];
+        Vec3 o(0.f, 0.f, 10.f);
+        for (int k = 0; k < RT_SIMD_WIDTH; k++) {
+            rays[k] = Ray(o, Vec3(rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f, -1.f));
+            packet.set(k, rays[k]);
+        }
+        vmask active = firstLanes(RT_SIMD_WIDTH - 1);
+        PacketHitRecord listHits(FLT_MAX), bvhHits(FLT_MAX);
+        vmask listMask = list.intersect(packet, 0.001f, active, listHits);
+        vmask bvhMask = bvh.intersect(packet, 0.001f, active, bvhHits);
+        for (int k = 0; k < RT_SIMD_WIDTH; k++) {
+            HitRecord record;
+            bool hit = k < RT_SIMD_WIDTH - 1 && list.intersect(rays[k], 0.001f, FLT_MAX, record);
+            ASSERT_EQ(hit, listMask[k]) << "Packet list hit test failed";
+            ASSERT_EQ(hit, bvhMask[k]) << "Packet BVH hit test failed";
+            if (hit) {
+                EXPECT_FLOAT_EQ(record.t, listHits.t[k]) << "Packet list closest hit test failed";
+                EXPECT_FLOAT_EQ(record.t, bvhHits.t[k]) << "Packet BVH closest hit test failed";
+            }
+        }
+    }
+}
+
+TEST(TestSphereSoA, TestSphereSoAMatchesShapeList) {
+    pcg32 rng;
+    rng.seed(5u, 9u);
+    Arena arena;
+    ShapeList list;
+    for (int i = 0; i < 37; i++) {
+        Vec3 c(10.f * rng.nextFloat() - 5.f, 10.f * rng.nextFloat() - 5.f, 10.f * rng.nextFloat() - 5.f);
+        list.mObjects.push_back(arena.create<Sphere>(c, 0.2f + rng.nextFloat()));
+    }
+    SphereSoA soa;
+    ASSERT_TRUE(soa.build(list)) << "SphereSoA build test failed";
+    EXPECT_EQ(soa.size(), 37) << "SphereSoA size test failed";
+    EXPECT_EQ((int)soa.centersX.size() % SphereSoA::BlockSize, 0) << "SphereSoA padding test failed";
+    for (int i = 0; i < 1000; i++) {
+        Ray r(Vec3(0.f, 0.f, 8.f), Vec3(rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f, -1.f));
+        HitRecord listRec, soaRec;
+        bool listHit = list.intersect(r, 0.001f, FLT_MAX, listRec);
+        bool soaHit = soa.intersect(r, 0.001f, FLT_MAX, soaRec);
+        ASSERT_EQ(listHit, soaHit) << "SphereSoA hit test failed for ray " << i;
+        if (listHit) {
+            EXPECT_FLOAT_EQ(listRec.t, soaRec.t) << "SphereSoA closest hit test failed for ray " << i;
+            EXPECT_EQ(listRec.normal, soaRec.normal) << "SphereSoA normal test failed for ray " << i;
+        }
+        EXPECT_EQ(list.intersect(r, 0.001f, 6.f, listRec), soa.occluded(r, 0.001f, 6.f)) << "SphereSoA occluded test failed for ray " << i;
+    }
+}
+
+TEST(TestAdaptive, TestAdaptiveSkyConverges) {
+    // an empty scene only shows the smooth sky, every pixel should converge after the first pass
+    const int nx = 16, ny = 8;
+    ShapeList empty;
+    Camera camera(Vec3(0.f), Vec3(0.f, 0.f, -1.f), Vec3(0.f, 1.f, 0.f), 90.f, float(nx) / float(ny));
+    PathIntegrator integrator;
+    ThreadPool pool(2);
+    Framebuffer framebuffer(nx, ny);
+    AdaptiveRenderer renderer(nx, ny, 64, 0.01f, 8);
+    SobolSampler sampler;
+    renderer.render(camera, empty, integrator, sampler, pool, framebuffer);
+    EXPECT_EQ(renderer.convergedPixels(), nx * ny) << "Adaptive convergence test failed";
+    EXPECT_EQ(renderer.totalSamples(), 8 * nx * ny) << "Adaptive sample count test failed";
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+            EXPECT_NEAR(framebuffer(i, j).z(), 1.f, 1e-5f) << "Adaptive sky color test failed";
+}
+
+TEST(TestSampler, TestSamplerStratification) {
+    // 16 samples of a pixel cover every 1/16 interval in 1D and every cell of a 4x4 grid in 2D
+    std::unique_ptr<Sampler> samplers[] = { createSampler("stratified", 16), createSampler("sobol", 16) };
+    for (auto& sampler : samplers) {
+        for (int dimension = 0; dimension < 4; dimension++) {
+            int intervals[16] = {}, cells[16] = {};
+            for (int s = 0; s < 16; s++) {
+                sampler->startPixelSample(3, 7, s, dimension);
+                float u = sampler->get1D();
+                sampler->startPixelSample(3, 7, s, dimension);
+                Point2f p = sampler->get2D();
+                ASSERT_TRUE(u >= 0.f && u < 1.f && p.x >= 0.f && p.x < 1.f && p.y >= 0.f && p.y < 1.f)
+                    << "Sampler range test failed";
+                intervals[(int)(u * 16)]++;
+                cells[(int)(p.y * 4) * 4 + (int)(p.x * 4)]++;
+            }
+            for (int k = 0; k < 16; k++) {
+                EXPECT_EQ(intervals[k], 1) << "Sampler 1D stratification test failed";
+                EXPECT_EQ(cells[k], 1) << "Sampler 2D stratification test failed";
+            }
+        }
+    }
+}
+
+// Pearson chi-square statistic of n samples over bins of equal probability. bin() maps a
+// sample to one of nBins bins.
+template <typename Func>
+static double chiSquare(int n, int nBins, Func bin) {
+    pcg32 rng;
+    rng.seed(17u, 3u);
+    std::vector<int> counts(nBins, 0);
+    for (int i = 0; i < n; i++) {
+        Point2f u(rng.nextFloat(), rng.nextFloat());
+        int b = bin(u, rng.nextFloat());
+        if (b < 0 || b >= nBins) return 1e30;
+        counts[b]++;
+    }
+    double expected = double(n) / nBins, chi2 = 0.0;
+    for (int c : counts) chi2 += (c - expected) * (c - expected) / expected;
+    return chi2;
+}
+
+TEST(TestCamera, TestPinholeMatchesThinLens) {
+    // without an aperture both lens models give the same ray and leave the sampler at the same dimension
+    Camera camera(Vec3(13.f, 2.f, 3.f), Vec3(0.f), Vec3(0.f, 1.f, 0.f), 20.f, 2.f);
+    const char* names[] = { "independent", "stratified", "sobol", "bluenoise" };
+    for (const char* name : names) {
+        std::unique_ptr<Sampler> sampler = createSampler(name, 16);
+        for (int s = 0; s < 16; s++) {
+            sampler->startPixelSample(5, 2, s);
+            Ray thinLens = camera.generateRay(0.3f, 0.6f, *sampler, ThinLens());
+            float afterThinLens = sampler->get1D();
+            sampler->startPixelSample(5, 2, s);
+            Ray pinhole = camera.generateRay(0.3f, 0.6f, *sampler, PinholeLens());
+            EXPECT_EQ(pinhole.o, thinLens.o) << "Failed pinhole origin test " << name << " " << s;
+            EXPECT_EQ(pinhole.d, thinLens.d) << "Failed pinhole direction test " << name << " " << s;
+            EXPECT_EQ(sampler->get1D(), afterThinLens) << "Failed pinhole sampler test " << name << " " << s;
+        }
+    }
+}
+
+TEST(TestWarp, TestWarpChiSquare) {
+    // 10 x 10 bins of equal probability per domain. With 99 degrees of freedom the
+    // statistic stays below 148 with probability 0.999.
+    const int n = 100000, nBins = 100;
+    const double limit = 148.0;
+    auto angleBin = [](float x, float y) {
+        float phi = std::atan2(y, x);
+        return std::min((int)((phi + Pi) / (2.f * Pi) * 10.f), 9);
+    };
+    // uniform disk, equal area rings in r^2
+    EXPECT_LT(chiSquare(n, nBins, [&](const Point2f& u, float) {
+        Vec3 p = squareToConcentricDisk(u);
+        int ring = std::min((int)((p.x() * p.x() + p.y() * p.y()) * 10.f), 9);
+        return ring * 10 + angleBin(p.x(), p.y());
+    }), limit) << "Failed concentric disk chi-square test";
+    // uniform sphere, equal area bands in z (Archimedes)
+    EXPECT_LT(chiSquare(n, nBins, [&](const Point2f& u, float) {
+        Vec3 d = squareToUniformSphere(u);
+        int band = std::min((int)((d.z() + 1.f) * 5.f), 9);
+        return band * 10 + angleBin(d.x(), d.y());
+    }), limit) << "Failed uniform sphere chi-square test";
+    // cosine hemisphere, its projection onto the disk is uniform
+    EXPECT_LT(chiSquare(n, nBins, [&](const Point2f& u, float) {
+        Vec3 d = squareToCosineHemisphere(u);
+        if (d.z() < 0.f) return -1;
+        int ring = std::min((int)((1.f - d.z() * d.z()) * 10.f), 9);
+        return ring * 10 + angleBin(d.x(), d.y());
+    }), limit) << "Failed cosine hemisphere chi-square test";
+    // uniform ball, equal volume shells in r^3 and equal area bands in z
+    EXPECT_LT(chiSquare(n, nBins, [&](const Point2f& u, float w) {
+        Vec3 p = squareToUniformBall(u, w);
+        float r = p.length();
+        int shell = std::min((int)(r * r * r * 10.f), 9);
+        int band = std::min((int)((p.z() / r + 1.f) * 5.f), 9);
+        return shell * 10 + band;
+    }), limit) << "Failed uniform ball chi-square test";
+}
+
+TEST(TestWarp, TestWarpBatchMatchesScalar) {
+    const int n = 1000;
+    pcg32 rng;
+    rng.seed(4u, 4u);
+    std::vector<float> ux(n), uy(n), x(n), y(n), z(n);
+    for (int i = 0; i < n; i++) {
+        ux[i] = rng.nextFloat();
+        uy[i] = rng.nextFloat();
+    }
+    ux[0] = uy[0] = 0.5f;   // center of the disk
+    squareToConcentricDisk(ux.data(), uy.data(), n, x.data(), y.data());
+    for (int i = 0; i < n; i++) {
+        Vec3 p = squareToConcentricDisk(Point2f(ux[i], uy[i]));
+        EXPECT_NEAR(x[i], p.x(), 1e-5f) << "Failed disk batch test " << i;
+        EXPECT_NEAR(y[i], p.y(), 1e-5f) << "Failed disk batch test " << i;
+    }
+    squareToUniformSphere(ux.data(), uy.data(), n, x.data(), y.data(), z.data());
+    for (int i = 0; i < n; i++) {
+        Vec3 d = squareToUniformSphere(Point2f(ux[i], uy[i]));
+        EXPECT_NEAR(x[i], d.x(), 1e-5f) << "Failed sphere batch test " << i;
+        EXPECT_NEAR(y[i], d.y(), 1e-5f) << "Failed sphere batch test " << i;
+        EXPECT_NEAR(z[i], d.z(), 1e-5f) << "Failed sphere batch test " << i;
+    }
+    squareToCosineHemisphere(ux.data(), uy.data(), n, x.data(), y.data(), z.data());
+    for (int i = 0; i < n; i++) {
+        Vec3 d = squareToCosineHemisphere(Point2f(ux[i], uy[i]));
+        EXPECT_NEAR(z[i], d.z(), 1e-5f) << "Failed cosine hemisphere batch test " << i;
+    }
+}
+
+TEST(TestBSDF, TestBSDFSampleMatchesEvalAndPdf) {
+    Lambertian diffuse(Vec3(0.5f, 0.6f, 0.7f));
+    Metal rough(Vec3(0.9f, 0.8f, 0.6f), 0.3f);
+    Metal veryRough(Vec3(0.9f, 0.8f, 0.6f), 0.8f);
+    const Material* materials[] = { &diffuse, &rough, &veryRough };
+    HitRecord hit;
+    hit.position = Vec3(0.f);
+    hit.normal = Vec3(0.f, 1.f, 0.f);
+    Vec3 wo = Vec3(0.6f, 0.5f, 0.2f).normalized();
+    IndependentSampler sampler(3u);
+    const int n = 100000;
+    for (int m = 0; m < 3; m++) {
+        // sample() must agree with eval() / pdf() for the direction it returns
+        int failed = 0;
+        for (int i = 0; i < n; i++) {
+            sampler.startPixelSample(0, 0, i);
+            BSDFSample bs;
+            if (!materials[m]->sample(hit, wo, sampler, bs)) {
+                failed++;
+                continue;
+            }
+            if (i >= 1000) continue;
+            float pdf = materials[m]->pdf(hit, wo, bs.wi);
+            Vec3 f = materials[m]->eval(hit, wo, bs.wi);
+            EXPECT_NEAR(pdf, bs.pdf, 1e-3f * std::max(1.f, pdf)) << "Failed BSDF pdf test " << m << " " << i;
+            for (int c = 0; c < 3; c++)
+                EXPECT_NEAR(f[c] / pdf, bs.weight[c], 1e-3f) << "Failed BSDF weight test " << m << " " << i;
+        }
+        // the pdf integrates to one minus the samples GGX reflects below the horizon
+        double integral = 0.0;
+        for (int i = 0; i < n; i++) {
+            sampler.startPixelSample(1, 0, i);
+            integral += materials[m]->pdf(hit, wo, squareToUniformSphere(sampler.get2D())) * 4.0 * Pi;
+        }
+        integral /= n;
+        EXPECT_NEAR(integral, 1.0 - double(failed) / n, 0.02) << "Failed BSDF pdf integral test " << m;
+    }
+}
+
+TEST(TestBSDF, TestTagDispatchMatchesVirtual) {
+    Lambertian diffuse(Vec3(0.5f, 0.6f, 0.7f));
+    Metal rough(Vec3(0.9f, 0.8f, 0.6f), 0.3f);
+    Dielectric glass(1.5f);
+    Emissive light(Vec3(4.f));
+    const Material* materials[] = { &diffuse, &rough, &glass, &light };
+    MaterialType types[] = { MaterialLambertian, MaterialMetal, MaterialDielectric, MaterialEmissive };
+    HitRecord hit;
+    hit.position = Vec3(0.f);
+    hit.normal = Vec3(0.f, 1.f, 0.f);
+    Vec3 wo = Vec3(0.6f, 0.5f, 0.2f).normalized();
+    IndependentSampler sampler(5u);
+    for (int m = 0; m < 4; m++) {
+        EXPECT_EQ(materials[m]->type(), types[m]) << "Failed material type test " << m;
+        for (int i = 0; i < 100; i++) {
+            BSDFSample expected, actual;
+            sampler.startPixelSample(0, 0, i);
+            bool expectedHit = materials[m]->sample(hit, wo, sampler, expected);
+            sampler.startPixelSample(0, 0, i);
+            bool actualHit = sampleMaterial(*materials[m], hit, wo, sampler, actual);
+            EXPECT_EQ(actualHit, expectedHit) << "Failed tag dispatch sample test " << m << " " << i;
+            if (!expectedHit) continue;
+            EXPECT_EQ(actual.wi, expected.wi) << "Failed tag dispatch direction test " << m << " " << i;
+            EXPECT_EQ(actual.weight, expected.weight) << "Failed tag dispatch weight test " << m << " " << i;
+            EXPECT_EQ(evalMaterial(*materials[m], hit, wo, expected.wi), materials[m]->eval(hit, wo, expected.wi))
+                << "Failed tag dispatch eval test " << m << " " << i;
+            EXPECT_EQ(pdfMaterial(*materials[m], hit, wo, expected.wi), materials[m]->pdf(hit, wo, expected.wi))
+                << "Failed tag dispatch pdf test " << m << " " << i;
+        }
+    }
+}
+
+TEST(TestLight, TestNextEventEstimationMatchesBSDFSampling) {
+    Scene scene;
+    const Material* white = scene.addMaterial<Lambertian>(Vec3(0.8f));
+    scene.addShape<Quad>(Vec3(-2.f, 0.f, -2.f), Vec3(0.f, 0.f, 4.f), Vec3(4.f, 0.f, 0.f), white);
+    scene.addShape<Sphere>(Vec3(0.5f, 0.4f, 0.f), 0.4f, scene.addMaterial<Metal>(Vec3(0.9f), 0.3f));
+    scene.addLight<QuadLight>(Vec3(-0.5f, 1.f, -0.5f), Vec3(1.f, 0.f, 0.f), Vec3(0.f, 0.f, 1.f), Vec3(5.f));
+    scene.addLight<SphereLight>(Vec3(-1.f, 0.5f, 0.5f), 0.2f, Vec3(10.f));
+    // the shadow ray query agrees with the closest hit query
+    pcg32 rng;
+    rng.seed(5u, 5u);
+    for (int i = 0; i < 1000; i++) {
+        Ray r(Vec3(0.f, 0.5f, 0.f), squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat())));
+        HitRecord rec;
+        EXPECT_EQ(scene.shapes.intersect(r, 0.001f, 3.f, rec), scene.shapes.occluded(r, 0.001f, 3.f)) << "Failed occluded test " << i;
+    }
+    // next event estimation with MIS and pure BSDF sampling converge to the same radiance
+    PathIntegrator withLights(8, 0, scene.lightList());
+    PathIntegrator withoutLights(8, 0);
+    Ray ray(Vec3(0.f, 0.5f, 1.5f), Vec3(0.f, -0.5f, -1.f));
+    const int n = 100000;
+    IndependentSampler sampler(9u);
+    Vec3 nee(0.f), bsdf(0.f);
+    for (int i = 0; i < n; i++) {
+        sampler.startPixelSample(0, 0, i);
+        nee += withLights.Li(ray, scene.shapes, sampler);
+        sampler.startPixelSample(1, 0, i);
+        bsdf += withoutLights.Li(ray, scene.shapes, sampler);
+    }
+    for (int c = 0; c < 3; c++)
+        EXPECT_NEAR(nee[c] / n, bsdf[c] / n, 0.03f * bsdf[c] / n) << "Failed NEE test " << c;
+}
+
+TEST(TestMesh, TestTriangleWatertight) {
+    // closed octahedron around the origin, every ray from inside must leave through a face
+    TriangleMesh mesh;
+    const float s = 0.7f;
+    mesh.positions = { Vec3(s, 0.f, 0.f), Vec3(-s, 0.f, 0.f), Vec3(0.f, s, 0.f),
+                       Vec3(0.f, -s, 0.f), Vec3(0.f, 0.f, s), Vec3(0.f, 0.f, -s) };
+    mesh.indices = { 0, 2, 4,  2, 1, 4,  1, 3, 4,  3, 0, 4,  2, 0, 5,  1, 2, 5,  3, 1, 5,  0, 3, 5 };
+    Arena arena;
+    ShapeList list;
+    for (int i = 0; i < mesh.numTriangles(); i++) list.mObjects.push_back(arena.create<Triangle>(&mesh, i));
+    pcg32 rng;
+    rng.seed(17u, 3u);
+    std::vector<Vec3> targets(mesh.positions);
+    for (int i = 0; i < 6; i++)
+        for (int j = i + 1; j < 6; j++)
+            if ((mesh.positions[i] + mesh.positions[j]).length() > 0.f) targets.push_back(0.5f * (mesh.positions[i] + mesh.positions[j]));
+    for (int i = 0; i < 2000; i++) {
+        // aimed at the vertices and edge midpoints from slightly moved origins, then random directions
+        Vec3 o(0.01f * (rng.nextFloat() - 0.5f), 0.01f * (rng.nextFloat() - 0.5f), 0.01f * (rng.nextFloat() - 0.5f));
+        Vec3 d = i < 1000 ? targets[i % targets.size()] - o : squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+        Ray r(o, d);
+        HitRecord rec;
+        ASSERT_TRUE(list.intersect(r, 0.f, FLT_MAX, rec)) << "Failed watertight test " << i;
+        Vec3 p = rec.position;
+        EXPECT_NEAR(std::fabs(p.x()) + std::fabs(p.y()) + std::fabs(p.z()), s, 1e-4f) << "Failed position test " << i;
+        EXPECT_NEAR((r(rec.t) - p).length(), 0.f, 1e-4f) << "Failed distance test " << i;
+        EXPECT_TRUE(list.occluded(r, 0.f, FLT_MAX)) << "Failed occluded test " << i;
+    }
+}
+
+TEST(TestMesh, TestLoadOBJAndPLY) {
+    ThreadPool pool(2);
+    std::string error;
+    // a quad and a triangle with shared position/normal indices, the triangle uses negative indices
+    {
+        std::ofstream obj("test_mesh.obj");
+        obj << "# test\ng quad\nv 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+            << "vn 0 0 1\nvn 0 0 1\nvn 0 0 1\nvn 0 0 1\nf 1//1 2//2 3//3 4//4\n"
+            << "v 2 0 0\r\nvn 0 0 1\nv 2.5e0 1E0 -0.5\nvn 0 0 1\nf -2//-2 -1//-1 -3//-3\n";
+    }
+    TriangleMesh mesh;
+    ASSERT_TRUE(loadMesh("test_mesh.obj", mesh, pool, error)) << error;
+    const int objIndices[] = { 0, 1, 2, 0, 2, 3, 4, 5, 3 };
+    ASSERT_EQ(mesh.numTriangles(), 3) << "Failed OBJ triangle count";
+    for (int i = 0; i < 9; i++) EXPECT_EQ(mesh.indices[i], objIndices[i]) << "Failed OBJ index " << i;
+    EXPECT_EQ(mesh.positions.size(), 6u) << "Failed OBJ vertex count";
+    EXPECT_EQ(mesh.normals.size(), 6u) << "Failed OBJ normal count";
+    EXPECT_TRUE(mesh.uvs.empty()) << "Failed OBJ uv count";
+    EXPECT_NEAR(mesh.positions[5].x(), 2.5f, 1e-6f) << "Failed OBJ exponent";
+    EXPECT_NEAR(mesh.positions[5].z(), -0.5f, 1e-6f) << "Failed OBJ negative";
+
+    // separate uv indices split the vertices
+    {
+        std::ofstream obj("test_mesh.obj");
+        obj << "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nvt 0 0\nvt 1 0\nvt 0 1\nf 1/1 2/2 3/3\nf 2/1 4/2 3/3\n";
+    }
+    ASSERT_TRUE(loadMesh("test_mesh.obj", mesh, pool, error)) << error;
+    EXPECT_EQ(mesh.positions.size(), 5u) << "Failed OBJ split vertices";
+    EXPECT_EQ(mesh.uvs.size(), 5u) << "Failed OBJ split uvs";
+    EXPECT_EQ(mesh.indices[2], mesh.indices[5]) << "Failed OBJ shared corner";
+    {
+        std::ofstream obj("test_mesh.obj");
+        obj << "v 0 0 0\nf 1 2 3\n";
+    }
+    EXPECT_FALSE(loadMesh("test_mesh.obj", mesh, pool, error)) << "Failed OBJ range check";
+    // uv and normal indices that are 0 or resolve to before the first entry are errors, not missing
+    const char* badAttributes[] = { "v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nf 1/0 2/1 3/1\n",
+                                    "v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//-2 3//1\n" };
+    for (const char* text : badAttributes) {
+        {
+            std::ofstream obj("test_mesh.obj");
+            obj << text;
+        }
+        EXPECT_FALSE(loadMesh("test_mesh.obj", mesh, pool, error)) << "Failed OBJ attribute range check";
+    }
+    std::remove("test_mesh.obj");
+
+    // big endian PLY with double positions, an extra vertex property and a quad
+    {
+        std::ofstream ply("test_mesh.ply", std::ios::binary);
+        ply << "ply\nformat binary_big_endian 1.0\ncomment test\nelement vertex 4\nproperty double x\nproperty double y\n"
+            << "property double z\nproperty uchar red\nelement face 1\nproperty uchar flags\nproperty list uchar ushort vertex_indices\n"
+            << "end_header\n";
+        auto put = [&](const void* p, int size) {
+            for (int i = size - 1; i >= 0; i--) ply.put(((const char*)p)[i]);
+        };
+        for (int v = 0; v < 4; v++) {
+            double xyz[3] = { (double)(v & 1), (double)(v >> 1), 0.25 * v };
+            for (int k = 0; k < 3; k++) put(&xyz[k], 8);
+            ply.put((char)255);
+        }
+        ply.put(0);
+        ply.put(4);
+        for (unsigned short i : { 0, 1, 3, 2 }) put(&i, 2);
+    }
+    ASSERT_TRUE(loadMesh("test_mesh.ply", mesh, pool, error)) << error;
+    const int plyIndices[] = { 0, 1, 3, 0, 3, 2 };
+    ASSERT_EQ(mesh.numTriangles(), 2) << "Failed PLY triangle count";
+    for (int i = 0; i < 6; i++) EXPECT_EQ(mesh.indices[i], plyIndices[i]) << "Failed PLY index " << i;
+    ASSERT_EQ(mesh.positions.size(), 4u) << "Failed PLY vertex count";
+    EXPECT_EQ(mesh.positions[3], Vec3(1.f, 1.f, 0.75f)) << "Failed PLY position";
+    EXPECT_TRUE(mesh.normals.empty()) << "Failed PLY normals";
+
+    // more faces declared than stored, and a negative element count
+    {
+        std::ofstream ply("test_mesh.ply", std::ios::binary);
+        ply << "ply\nformat binary_little_endian 1.0\nelement vertex 3\nproperty float x\nproperty float y\n"
+            << "property float z\nelement face 1000\nproperty list uchar int vertex_indices\nend_header\n";
+        for (int v = 0; v < 3; v++) {
+            float xyz[3] = { (float)(v & 1), (float)(v >> 1), 0.f };
+            ply.write((const char*)xyz, sizeof(xyz));
+        }
+        int face[3] = { 0, 1, 2 };
+        ply.put(3);
+        ply.write((const char*)face, sizeof(face));
+    }
+    error.clear();
+    EXPECT_FALSE(loadMesh("test_mesh.ply", mesh, pool, error)) << "Failed PLY truncation check";
+    EXPECT_NE(error.find("unexpected end of file in face"), std::string::npos) << "Failed PLY truncation error: " << error;
+    // a corrupt list count of about 4e9 fails at the end of the file instead of allocating it
+    {
+        std::ofstream ply("test_mesh.ply", std::ios::binary);
+        ply << "ply\nformat binary_little_endian 1.0\nelement vertex 3\nproperty float x\nproperty float y\n"
+            << "property float z\nelement face 1\nproperty list uint int vertex_indices\nend_header\n";
+        for (int v = 0; v < 3; v++) {
+            float xyz[3] = { (float)(v & 1), (float)(v >> 1), 0.f };
+            ply.write((const char*)xyz, sizeof(xyz));
+        }
+        unsigned int count = 0xfffffff0u;
+        int face[3] = { 0, 1, 2 };
+        ply.write((const char*)&count, sizeof(count));
+        ply.write((const char*)face, sizeof(face));
+    }
+    error.clear();
+    EXPECT_FALSE(loadMesh("test_mesh.ply", mesh, pool, error)) << "Failed PLY list count check";
+    EXPECT_NE(error.find("unexpected end of file in face"), std::string::npos) << "Failed PLY list count error: " << error;
+    {
+        std::ofstream ply("test_mesh.ply", std::ios::binary);
+        ply << "ply\nformat binary_little_endian 1.0\nelement vertex -1\nproperty float x\nproperty float y\n"
+            << "property float z\nend_header\n";
+    }
+    EXPECT_FALSE(loadMesh("test_mesh.ply", mesh, pool, error)) << "Failed PLY negative count check";
+    std::remove("test_mesh.ply");
+}
+
+TEST(TestSceneCache, TestSceneCacheMatchesBVH) {
+    // spheres, quads, a mesh and both kinds of lights
+    Scene scene;
+    initCornellScene(scene);
+    TriangleMesh* mesh = new TriangleMesh();
+    mesh->positions = { Vec3(-0.5f, 0.2f, -0.8f), Vec3(0.5f, 0.2f, -0.8f), Vec3(0.f, 1.f, -0.6f), Vec3(0.f, 0.5f, -0.2f) };
+    mesh->normals = { Vec3(0.f, 0.f, 1.f), Vec3(0.f, 0.f, 1.f), Vec3(0.f, 0.3f, 1.f).normalized(), Vec3(0.f, 1.f, 0.f) };
+    mesh->indices = { 0, 1, 2, 0, 1, 3 };
+    scene.addMesh(mesh, scene.addMaterial<Metal>(Vec3(0.5f), 0.5f));
+    BVH bvh(scene.shapes);
+    std::string error;
+    SceneCacheKey key;
+    key.add("test").add(42);
+    ASSERT_TRUE(writeSceneCache("test_scene.rtscene", key.value(), scene, bvh, error)) << error;
+
+    Scene cachedScene;
+    SceneCache cache;
+    EXPECT_FALSE(cache.open("test_scene.rtscene", key.value() + 1, cachedScene, error)) << "Failed key test";
+    EXPECT_TRUE(cachedScene.materials.empty()) << "Failed key test, materials added";
+    ASSERT_TRUE(cache.open("test_scene.rtscene", key.value(), cachedScene, error)) << error;
+    EXPECT_EQ(cachedScene.materials.size(), scene.materials.size()) << "Failed material count";
+    EXPECT_EQ(cachedScene.lights.size(), scene.lights.size()) << "Failed light count";
+
+    pcg32 rng;
+    rng.seed(11u, 2u);
+    for (int i = 0; i < 2000; i++) {
+        Ray r(Vec3(1.6f * rng.nextFloat() - 0.8f, 0.1f + 1.8f * rng.nextFloat(), 1.4f * rng.nextFloat() - 0.5f),
+              squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat())));
+        HitRecord expected, actual;
+        bool hit = bvh.intersect(r, 0.001f, FLT_MAX, expected);
+        ASSERT_EQ(cache.intersect(r, 0.001f, FLT_MAX, actual), hit) << "Failed hit test " << i;
+        EXPECT_EQ(cache.occluded(r, 0.001f, 1.f), bvh.occluded(r, 0.001f, 1.f)) << "Failed occluded test " << i;
+        if (!hit) continue;
+        EXPECT_EQ(actual.t, expected.t) << "Failed distance test " << i;
+        EXPECT_EQ(actual.position, expected.position) << "Failed position test " << i;
+        EXPECT_EQ(actual.normal, expected.normal) << "Failed normal test " << i;
+        EXPECT_EQ(actual.material->type(), expected.material->type()) << "Failed material test " << i;
+    }
+
+    // a truncated file is rejected
+    {
+        std::ifstream in("test_scene.rtscene", std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out("test_scene.rtscene", std::ios::binary);
+        out.write(data.data(), data.size() / 2);
+    }
+    SceneCache truncated;
+    EXPECT_FALSE(truncated.open("test_scene.rtscene", key.value(), cachedScene, error)) << "Failed truncation test";
+
+    // a tree deeper than the traversal stack is rejected: the nodes of a scene of single
+    // sphere leaves are rewritten into a chain whose second children are interior nodes
+    Scene deepScene;
+    const Material* white = deepScene.addMaterial<Lambertian>(Vec3(0.5f));
+    for (int i = 0; i < 2 * SceneCacheStackSize; i++) deepScene.addShape<Sphere>(Vec3((float)i, 0.f, 0.f), 0.4f, white);
+    BVH deepBVH(deepScene.shapes, 1);
+    ASSERT_TRUE(writeSceneCache("test_scene.rtscene", key.value(), deepScene, deepBVH, error)) << error;
+    {
+        std::fstream file("test_scene.rtscene", std::ios::in | std::ios::out | std::ios::binary);
+        SceneCacheHeader header;
+        file.read((char*)&header, sizeof(header));
+        std::vector<LinearBVHNode> nodes(deepBVH.nodes());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            bool leaf = i % 2 == 1 || i + 1 == nodes.size();
+            nodes[i].nPrimitives = leaf ? 1 : 0;
+            nodes[i].axis = 0;
+            if (leaf) nodes[i].primitivesOffset = 0;
+            else nodes[i].secondChildOffset = (int)i + 2;
+        }
+        file.seekp(header.sections[SectionNodes].offset);
+        file.write((const char*)nodes.data(), nodes.size() * sizeof(LinearBVHNode));
+    }
+    SceneCache deep;
+    EXPECT_FALSE(deep.open("test_scene.rtscene", key.value(), cachedScene, error)) << "Failed stack depth test";
+    std::remove("test_scene.rtscene");
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
-    RUN_ALL_TESTS();
+    return RUN_ALL_TESTS();
 }
\ No newline at end of file